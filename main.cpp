@@ -5,7 +5,9 @@
 
 #include <seastar/core/app-template.hh>
 #include <seastar/core/coroutine.hh>
+#include <seastar/core/prometheus.hh>
 #include <seastar/core/reactor.hh> // seastar::condition_variable
+#include <seastar/core/seastar.hh>
 #include <seastar/core/sleep.hh>
 #include <seastar/coroutine/parallel_for_each.hh>
 #include <seastar/http/function_handlers.hh>
@@ -14,14 +16,26 @@
 
 #include <nlohmann/json.hpp>
 
+#include <array>
+#include <charconv>
+#include <chrono>
 #include <expected>
+#include <filesystem>
+#include <functional>
+#include <optional>
 #include <ranges>
 #include <string>
 #include <string_view>
-#include <tuple>
-#include <unordered_set>
-
+#include <vector>
+
+#include "pkvs/detail/compression.hpp"
+#include "pkvs/detail/crc32c.hpp"
+#include "pkvs/detail/hex.hpp"
+#include "pkvs/detail/json.hpp"
+#include "pkvs/detail/store_metadata.hpp"
+#include "pkvs/detail/value_file_format.hpp"
 #include "pkvs/pkvs_shard.hpp"
+#include "pkvs/resp_server.hpp"
 
 #include <iostream>
 
@@ -63,14 +77,368 @@ namespace
     seastar::condition_variable cv_;
   };
 
+  // page sizes of range requests
+  constexpr size_t range_default_limit = 100;
+  constexpr size_t range_max_limit = 1000;
+  // page size with which /sorted_keys walks the whole key space
+  constexpr size_t sorted_keys_page_limit = 1000;
+  constexpr size_t batch_max_operations = 10000;
+  // json bodies are read into memory, larger values have to be sent to the
+  // streaming /value endpoint
+  constexpr size_t max_json_content_size = 16 * 1024 * 1024;
+
+  std::chrono::milliseconds elapsed_since( std::chrono::steady_clock::time_point start )
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start );
+  }
+
+  // whole parameter has to be a number
+  template< typename number_t >
+  std::optional<number_t> parse_number( std::string_view text )
+  {
+    number_t number;
+    auto [ last, error ] = std::from_chars( text.data(), text.data() + text.size(), number );
+
+    if( text.empty() || error != std::errc{} || last != text.data() + text.size() )
+      return std::nullopt;
+
+    return number;
+  }
+
+  seastar::future<> write_keys
+  (
+    seastar::output_stream<char>& out,
+    std::vector<std::string> const& keys,
+    bool& first
+  )
+  {
+    for( auto const& key : keys )
+    {
+      std::string element{ first ? "" : "," };
+
+      pkvs::json::append_string( element, key );
+      co_await out.write( element );
+      first = false;
+    }
+  }
+
+  seastar::future<> write_range_reply
+  (
+    seastar::output_stream<char> out,
+    pkvs::key_range_t page
+  )
+  {
+    std::exception_ptr failure;
+
+    try
+    {
+      bool first = true;
+
+      co_await out.write( "{\"keys\":[" );
+      co_await write_keys( out, page.keys, first );
+      co_await out.write( "]" );
+
+      if( page.next != std::nullopt )
+        co_await out.write( ",\"cursor\":\"" + pkvs::to_hex( *page.next ) + '"' );
+
+      co_await out.write( "}" );
+      co_await out.flush();
+    }
+    catch( ... )
+    {
+      failure = std::current_exception();
+    }
+
+    co_await out.close();
+
+    if( failure )
+      std::rethrow_exception( failure );
+  }
+
+  // streams all keys page by page from a single scan, the status was already
+  // sent so errors after the first page can only cut the reply short
+  seastar::future<> write_sorted_keys_reply
+  (
+    seastar::output_stream<char> out,
+    pkvs::store_range_t range,
+    pkvs::key_range_t page
+  )
+  {
+    std::exception_ptr failure;
+
+    try
+    {
+      bool first = true;
+
+      co_await out.write( "{\"keys\":[" );
+      co_await write_keys( out, page.keys, first );
+
+      while( page.next != std::nullopt )
+      {
+        page = co_await range.next( sorted_keys_page_limit );
+
+        co_await write_keys( out, page.keys, first );
+      }
+
+      co_await out.write( "]}" );
+      co_await out.flush();
+    }
+    catch( ... )
+    {
+      failure = std::current_exception();
+    }
+
+    co_await out.close();
+
+    if( failure )
+    {
+      std::cerr << "keys failed: " << failure << '\n';
+
+      std::rethrow_exception( failure );
+    }
+  }
+
+  // writes that were rejected by admission control get a status on which
+  // clients can retry after a while
+  std::unique_ptr<seastar::http::reply> busy_reply( std::unique_ptr<seastar::http::reply> rep )
+  {
+    rep->set_status( seastar::http::reply::status_type::service_unavailable );
+    rep->add_header( "Retry-After", "1" );
+    rep->_content += "{\"result\":\"busy\"}";
+
+    return rep;
+  }
+
+  // reads the streamed body into req.content, returns false if it's larger
+  // than max_json_content_size in which case the body is discarded
+  seastar::future<bool> read_content( seastar::http::request& req )
+  {
+    std::string content;
+    bool too_large = false;
+
+    while( true )
+    {
+      auto buffer = co_await req.content_stream->read();
+
+      if( buffer.empty() )
+        break;
+      else if( too_large )
+        continue;
+
+      if( content.size() + buffer.size() > max_json_content_size )
+      {
+        too_large = true;
+        content.clear();
+      }
+      else
+        content.append( buffer.get(), buffer.size() );
+    }
+
+    req.content = std::move( content );
+
+    co_return too_large == false;
+  }
+
+  // writes the body to the staged file which is removed again on failure
+  seastar::future<> write_staged_value( seastar::http::request& req, std::filesystem::path staged )
+  {
+    auto out_file =
+      co_await seastar::open_file_dma
+      (
+        staged.native(),
+        seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate
+      );
+    auto out_stream = co_await seastar::make_file_output_stream( out_file );
+    std::exception_ptr failure;
+
+    try
+    {
+      uint32_t checksum = 0;
+
+      while( true )
+      {
+        auto buffer = co_await req.content_stream->read();
+
+        if( buffer.empty() )
+          break;
+
+        checksum = pkvs::crc32c( { buffer.get(), buffer.size() }, checksum );
+        co_await out_stream.write( buffer.get(), buffer.size() );
+      }
+
+      std::string trailer;
+
+      pkvs::value_file_format::append_trailer( trailer, checksum );
+      co_await out_stream.write( trailer );
+      co_await out_stream.flush();
+      // the commit log only records that the value is in its file
+      co_await out_file.flush();
+    }
+    catch( ... )
+    {
+      failure = std::current_exception();
+    }
+
+    co_await out_stream.close();
+
+    if( failure )
+    {
+      co_await seastar::remove_file( staged.native() );
+
+      std::rethrow_exception( failure );
+    }
+  }
+
+  // value files are copied to the socket in chunks instead of being read
+  // into memory
+  //
+  // the checksum can only be verified once the whole value was sent so a
+  // corrupted value fails the reply after the fact and the client sees a
+  // truncated body
+  seastar::future<> write_value_reply
+  (
+    seastar::output_stream<char> out,
+    pkvs::stored_value_t value
+  )
+  {
+    std::exception_ptr failure;
+
+    try
+    {
+      if( value.file != std::nullopt )
+      {
+        auto in = seastar::make_file_input_stream( std::move( *value.file ).to_file(), 0, value.size );
+
+        co_await
+          [ & ] -> seastar::future<>
+          {
+            uint32_t checksum = 0;
+
+            while( true )
+            {
+              auto buffer = co_await in.read();
+
+              if( buffer.empty() )
+                break;
+
+              if( value.checksum != std::nullopt )
+                checksum = pkvs::crc32c( { buffer.get(), buffer.size() }, checksum );
+
+              co_await out.write( std::move( buffer ) );
+            }
+
+            if( value.checksum != std::nullopt && checksum != *value.checksum )
+              throw std::runtime_error{ "streamed value doesn't match its checksum" };
+          }()
+          .finally( [ & ]{ return in.close(); } );
+      }
+      else
+        co_await out.write( value.value );
+
+      co_await out.flush();
+    }
+    catch( ... )
+    {
+      failure = std::current_exception();
+    }
+
+    co_await out.close();
+
+    if( failure )
+      std::rethrow_exception( failure );
+  }
+
+  // {"operations":[{"op":"get|post|delete","key":"...","value":"..."},...]}
+  // where value is only present for post
+  std::expected<std::vector<pkvs::batch_operation_t>, std::string> parse_batch
+  (
+    seastar::http::request& req
+  )
+  {
+    try
+    {
+      nlohmann::json data = nlohmann::json::parse( req.content.c_str() );
+
+      if( data.size() != 1 || data.contains( "operations" ) == false || data["operations"].is_array() == false )
+        return std::unexpected("{\"result\":\"request error\"}");
+
+      auto const& operations = data["operations"];
+
+      if( operations.size() > batch_max_operations )
+        return std::unexpected("{\"result\":\"batch too large\"}");
+
+      std::vector<pkvs::batch_operation_t> parsed;
+      parsed.reserve( operations.size() );
+
+      for( auto const& operation : operations )
+      {
+        if
+        (
+          operation.is_object() == false ||
+          operation.contains( "op" ) == false ||
+          operation["op"].is_string() == false ||
+          operation.contains( "key" ) == false ||
+          operation["key"].is_string() == false
+        )
+        {
+          return std::unexpected("{\"result\":\"request error\"}");
+        }
+
+        auto op = operation["op"].get<std::string_view>();
+        auto key = operation["key"].get<std::string_view>();
+        bool has_value = operation.contains( "value" );
+        size_t expected_size = has_value ? 3 : 2;
+        pkvs::batch_operation_type_t type;
+
+        if( op == "get" )
+          type = pkvs::batch_operation_type_t::get;
+        else if( op == "post" && has_value && operation["value"].is_string() )
+          type = pkvs::batch_operation_type_t::insert;
+        else if( op == "delete" )
+          type = pkvs::batch_operation_type_t::remove;
+        else
+          return std::unexpected("{\"result\":\"request error\"}");
+
+        if( operation.size() != expected_size || ( has_value && type != pkvs::batch_operation_type_t::insert ) )
+          return std::unexpected("{\"result\":\"request error\"}");
+
+        if( key.empty() || key.size() >= 256 )
+          return std::unexpected("{\"result\":\"invalid key size\"}");
+
+        parsed.emplace_back(
+          type,
+          std::string{ key },
+          has_value ? operation["value"].get<std::string>() : std::string{} );
+      }
+
+      return parsed;
+    }
+    catch( ... )
+    {
+      return std::unexpected("{\"result\":\"request error\"}");
+    }
+  }
+
   seastar::future<> service_loop
   (
     uint16_t port,
-    size_t memtable_memory_footprint_eviction_threshold
+    uint16_t resp_port,
+    pkvs::store_directories_t directories,
+    std::optional<size_t> segments_count,
+    double rebalance_threshold,
+    size_t memtable_memory_budget,
+    pkvs::sstable_options_t sstable_options,
+    pkvs::commitlog_options_t commitlog_options,
+    size_t file_cache_capacity,
+    size_t block_cache_capacity,
+    pkvs::flush_scheduler_options_t flush_scheduler_options,
+    pkvs::write_admission_options_t write_admission_options,
+    std::chrono::seconds scrub_period
   )
   {
     stop_signal signal;
     seastar::sharded< pkvs::pkvs_shard > store;
+    seastar::sharded< pkvs::resp_server_t > resp_server;
 
     std::cout << "running on: " << seastar::smp::count << '\n';
 
@@ -80,83 +448,195 @@ namespace
 
     std::cout << "server start\n";
     co_await http_server.start( "pkvs" );
+    // bodies are read from content_stream so that large values don't have
+    // to be buffered
+    co_await http_server.server().invoke_on_all(
+      []( seastar::httpd::http_server& server )
+      {
+        server.set_content_streaming( true );
+      });
 
     co_await
       [&] -> seastar::future<>
       {
+        auto startup_start = std::chrono::steady_clock::now();
+        auto phase_start = startup_start;
+        auto const& root_pksv_data_dir = directories.data.front();
+        auto const& commitlog_dir = directories.commitlog;
+
+        for( auto const& data_dir : directories.data )
+          co_await seastar::recursive_touch_directory( data_dir.native() );
+
+        co_await seastar::recursive_touch_directory( commitlog_dir.native() );
+
+        // segment count, key hash and directories are only chosen when the
+        // store is created
+        auto metadata = co_await pkvs::store_metadata_t::load( root_pksv_data_dir );
+
+        if( metadata == std::nullopt )
         {
-          auto root_pksv_data_dir = std::filesystem::current_path() / "pkvs_data";
+          metadata = pkvs::store_metadata_t{};
+
+          if( segments_count )
+            metadata->segments_count = *segments_count;
+
+          metadata->data_directories_count = directories.data.size();
+
+          // a creation that was interrupted before the metadata was saved
+          // could have marked some of the directories already
+          auto store_id = co_await pkvs::unfinished_store_id( root_pksv_data_dir );
+
+          metadata->store_id = store_id ? *store_id : pkvs::make_store_id();
 
-          if( co_await seastar::file_exists( root_pksv_data_dir.native() ) == false )
-            co_await seastar::make_directory( root_pksv_data_dir.native() );
+          co_await pkvs::check_store_directories( metadata->store_id, directories.data, commitlog_dir, true );
         }
+        else if( segments_count && *segments_count != metadata->segments_count )
+        {
+          throw
+            std::invalid_argument(
+              "store was created with " + std::to_string( metadata->segments_count ) + " segments" );
+        }
+        else if( metadata->data_directories_count != directories.data.size() )
+        {
+          // markers can't tell that a directory is missing
+          throw
+            std::invalid_argument(
+              "store was created with " + std::to_string( metadata->data_directories_count ) +
+              " data directories" );
+        }
+        else if( metadata->store_id.empty() )
+        {
+          // stores from before directories were marked are checked by path
+          // one last time
+          auto created_with = metadata->commitlog_directory.value_or( root_pksv_data_dir / "commitlog" );
+
+          // writes that were not flushed yet would not be replayed
+          if( created_with != commitlog_dir )
+            throw std::invalid_argument( "store was created with commit logs in " + created_with.native() );
+
+          metadata->store_id = pkvs::make_store_id();
+        }
+        else
+          co_await pkvs::check_store_directories( metadata->store_id, directories.data, commitlog_dir );
+
+        metadata->commitlog_directory.reset();
+
+        // directories are marked before the metadata is saved so that a new
+        // store is never without markers
+        co_await pkvs::mark_store_directories( metadata->store_id, directories.data, commitlog_dir );
+
+        // also records the values that stores from before the metadata file
+        // were created with
+        co_await metadata->save( root_pksv_data_dir );
+
+        auto commitlog_generation = co_await pkvs::commitlog_t::next_generation( commitlog_dir );
+        auto metadata_duration = elapsed_since( phase_start );
+
+        phase_start = std::chrono::steady_clock::now();
 
         co_await store.invoke_on_all(
-          [ memtable_memory_footprint_eviction_threshold ]( pkvs::pkvs_shard& local_shard )
+          [
+            directories,
+            metadata = *metadata,
+            memtable_memory_budget,
+            sstable_options,
+            commitlog_options,
+            commitlog_generation,
+            file_cache_capacity,
+            block_cache_capacity,
+            flush_scheduler_options,
+            write_admission_options,
+            scrub_period
+          ]
+          (
+            pkvs::pkvs_shard& local_shard
+          )
           {
-            return local_shard.run( memtable_memory_footprint_eviction_threshold );
+            return
+              local_shard.run(
+                directories,
+                metadata,
+                memtable_memory_budget,
+                sstable_options,
+                commitlog_options,
+                commitlog_generation,
+                file_cache_capacity,
+                block_cache_capacity,
+                flush_scheduler_options,
+                write_admission_options,
+                scrub_period );
           });
 
+        auto shards_duration = elapsed_since( phase_start );
+
+        phase_start = std::chrono::steady_clock::now();
+
+        // every shard flushed the replayed writes of its segments
+        co_await pkvs::commitlog_t::remove_old_generations( commitlog_dir, commitlog_generation );
+
+        auto cleanup_duration = elapsed_since( phase_start );
+
+        std::cout
+          << "startup took " << elapsed_since( startup_start ).count() << " ms: "
+          << "directories and metadata " << metadata_duration.count() << " ms, "
+          << "shards " << shards_duration.count() << " ms, "
+          << "old commit logs removal " << cleanup_duration.count() << " ms\n";
+
+        for( unsigned shard_no = 0; shard_no < seastar::smp::count; ++shard_no )
+        {
+          auto timings =
+            co_await
+              store.invoke_on(
+                shard_no,
+                []( pkvs::pkvs_shard& local_shard )
+                {
+                  return local_shard.startup_timings();
+                });
+
+          std::cout
+            << "shard " << shard_no << " startup: "
+            << "commit log replay " << timings.commitlog_replay.count() << " ms, "
+            << "segments open " << timings.segments_open.count() << " ms\n";
+        }
+
+        {
+          // exposes /metrics route with prometheus formatted metrics
+          seastar::prometheus::config metrics_config;
+          metrics_config.prefix = "pkvs";
+
+          co_await seastar::prometheus::start( http_server, metrics_config );
+        }
+
         std::cout << "setting routes\n";
         co_await
           http_server
             .set_routes(
               [ &store ]( seastar::httpd::routes& r )
               {
+                // parses the request body in place, the returned views point
+                // into req.content and are in the same order as names
                 auto common_request_processing =
-                  []
+                  []< size_t N >
                   (
                     seastar::http::request& req,
-                    std::unordered_set< std::string > expected_keys
+                    std::string_view const ( &names )[ N ]
                   )
                     ->
-                      std::expected
-                      <
-                        std::tuple
-                        <
-                          nlohmann::json,
-                          size_t
-                        >,
-                        std::string
-                      >
+                      std::expected< std::array< std::string_view, N >, std::string >
                   {
-                      // FIXME server-side deprecated: use content_stream instead
-                      // throws if data is not in utf-8 format
-                      try
-                      {
-                        nlohmann::json data = nlohmann::json::parse( req.content.c_str() );
-
-                        if( expected_keys.contains( "key" ) == false )
-                          return std::unexpected("{\"result\":\"internal server error\"}");
+                      if( names[ 0 ] != "key" )
+                        return std::unexpected("{\"result\":\"internal server error\"}");
 
-                        for( auto& [key, val] : data.items() )
-                        {
-                          if
-                          (
-                            expected_keys.erase( key ) == 0 ||
-                            val.type() != nlohmann::json::value_t::string
-                          )
-                          {
-                            return std::unexpected("{\"result\":\"request error\"}");
-                          }
-                        }
-
-                        if( expected_keys.empty() == false )
-                          return std::unexpected("{\"result\":\"request error\"}");
-
-                        auto key = data["key"].template get<std::string_view>();
+                      std::array< std::string_view, N > values;
 
-                        if( key.empty() || key.size() > 256 )
-                          return std::unexpected("{\"result\":\"invalid key size\"}");
+                      // also fails if data is not in utf-8 format
+                      if( pkvs::json::parse_object( { req.content.data(), req.content.size() }, names, values ) != std::nullopt )
+                        return std::unexpected("{\"result\":\"request error\"}");
 
-                        size_t shard_no = pkvs::key_to_shard_no( key );
+                      if( values[ 0 ].empty() || values[ 0 ].size() >= 256 )
+                        return std::unexpected("{\"result\":\"invalid key size\"}");
 
-                        return std::tuple{ std::move( data ), shard_no };
-                      }
-                      catch( ... )
-                      {
-                        return std::unexpected("{\"result\":\"request error\"}");
-                      }
+                      return values;
                   };
                 r.add(
                   seastar::httpd::operation_type::GET,
@@ -168,6 +648,13 @@ namespace
                       std::unique_ptr<seastar::http::reply> rep
                     ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
                     {
+                      if( co_await read_content( *req ) == false )
+                      {
+                        rep->_content += "{\"result\":\"request too large\"}";
+
+                        co_return std::move( rep );
+                      }
+
                       auto processed = common_request_processing( *req, { "key" } );
 
                       if( processed.has_value() == false )
@@ -177,22 +664,24 @@ namespace
                         co_return std::move( rep );
                       }
 
-                      auto const& [ data, shard_no ] = *processed;
+                      auto const& fields = *processed;
 
                       auto result =
                         co_await
-                          store.invoke_on(
-                            shard_no,
-                            [key = data["key"].template get<std::string_view>()]
-                            (
-                              pkvs::pkvs_shard& local_shard
-                            )
+                          pkvs::invoke_on_owner(
+                            store,
+                            fields[ 0 ],
+                            []( pkvs::pkvs_shard& local_shard, std::string_view key )
                             {
                               return local_shard.get_item( key );
                             });
 
                       if( result != std::nullopt )
-                        rep->_content += "{\"value\":\"" + result.value() + "\"}";
+                      {
+                        rep->_content += "{\"value\":";
+                        pkvs::json::append_string( rep->_content, *result );
+                        rep->_content += "}";
+                      }
                       else
                         rep->_content += "{\"result\":\"missing\"}";
 
@@ -210,6 +699,13 @@ namespace
                       std::unique_ptr<seastar::http::reply> rep
                     ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
                     {
+                      if( co_await read_content( *req ) == false )
+                      {
+                        rep->_content += "{\"result\":\"request too large\"}";
+
+                        co_return std::move( rep );
+                      }
+
                       auto processed = common_request_processing( *req, { "key", "value" } );
 
                       if( processed.has_value() == false )
@@ -219,21 +715,25 @@ namespace
                         co_return std::move( rep );
                       }
 
-                      auto const& [ data, shard_no ] = *processed;
+                      auto const& fields = *processed;
 
-                      co_await
-                        store.invoke_on(
-                          shard_no,
-                          [
-                            key = data["key"].template get<std::string_view>(),
-                            value = data["value"].template get<std::string_view>()
-                          ]
-                          (
-                            pkvs::pkvs_shard& local_shard
-                          )
-                          {
-                            return local_shard.insert_item( key, value );
-                          });
+                      try
+                      {
+                        // the value is copied into the memtable of the owning
+                        // shard
+                        co_await
+                          pkvs::invoke_on_owner(
+                            store,
+                            fields[ 0 ],
+                            [ value = fields[ 1 ] ]( pkvs::pkvs_shard& local_shard, std::string_view key )
+                            {
+                              return local_shard.insert_item( key, value );
+                            });
+                      }
+                      catch( pkvs::overloaded_error const& )
+                      {
+                        co_return busy_reply( std::move( rep ) );
+                      }
 
                       rep->_content += "{\"result\":\"ok\"}";
 
@@ -251,6 +751,13 @@ namespace
                       std::unique_ptr<seastar::http::reply> rep
                     ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
                     {
+                      if( co_await read_content( *req ) == false )
+                      {
+                        rep->_content += "{\"result\":\"request too large\"}";
+
+                        co_return std::move( rep );
+                      }
+
                       auto processed = common_request_processing( *req, { "key" } );
 
                       if( processed.has_value() == false )
@@ -260,18 +767,99 @@ namespace
                         co_return std::move( rep );
                       }
 
-                      auto const& [ data, shard_no ] = *processed;
+                      auto const& fields = *processed;
+
+                      try
+                      {
+                        co_await
+                          pkvs::invoke_on_owner(
+                            store,
+                            fields[ 0 ],
+                            []( pkvs::pkvs_shard& local_shard, std::string_view key )
+                            {
+                              return local_shard.delete_item( key );
+                            });
+                      }
+                      catch( pkvs::overloaded_error const& )
+                      {
+                        co_return busy_reply( std::move( rep ) );
+                      }
+
+                      rep->_content += "{\"result\":\"ok\"}";
+
+                      co_return std::move( rep );
+                    },
+                    "json"));
+
+                // raw value bodies that are streamed directly to and from
+                // value files - /value?key=...
+                r.add(
+                  seastar::httpd::operation_type::POST,
+                  seastar::httpd::url("/value"),
+                  new seastar::httpd::function_handler(
+                    [ &store ]
+                    (
+                      std::unique_ptr<seastar::http::request> req,
+                      std::unique_ptr<seastar::http::reply> rep
+                    ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
+                    {
+                      std::string key = req->get_query_param( "key" );
+
+                      if( key.empty() || key.size() >= 256 )
+                      {
+                        rep->_content += "{\"result\":\"invalid key size\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      std::filesystem::path staged;
+                      bool overloaded = false;
 
-                      co_await
-                        store.invoke_on(
-                          shard_no,
-                          [key = data["key"].template get<std::string_view>()]
-                          (
-                            pkvs::pkvs_shard& local_shard
-                          )
-                          {
-                            return local_shard.delete_item( key );
-                          });
+                      try
+                      {
+                        // the body is written on this shard, only the
+                        // finished file is handed over to the owning shard
+                        staged =
+                          co_await
+                            pkvs::invoke_on_owner(
+                              store,
+                              key,
+                              []( pkvs::pkvs_shard& local_shard, std::string_view key )
+                              {
+                                return local_shard.value_staging_path( key );
+                              });
+
+                        co_await write_staged_value( *req, staged );
+
+                        co_await
+                          pkvs::invoke_on_owner(
+                            store,
+                            key,
+                            [ &staged ]( pkvs::pkvs_shard& local_shard, std::string_view key )
+                            {
+                              return local_shard.insert_value_file( std::string{ key }, staged );
+                            });
+                      }
+                      catch( pkvs::overloaded_error const& )
+                      {
+                        overloaded = true;
+                      }
+                      catch( ... )
+                      {
+                        std::cerr << "value upload failed: " << std::current_exception() << '\n';
+
+                        rep->_content += "{\"result\":\"internal server error\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      if( overloaded )
+                      {
+                        // the staged file was not installed
+                        co_await seastar::remove_file( staged.native() ).handle_exception( []( std::exception_ptr ){} );
+
+                        co_return busy_reply( std::move( rep ) );
+                      }
 
                       rep->_content += "{\"result\":\"ok\"}";
 
@@ -279,33 +867,242 @@ namespace
                     },
                     "json"));
 
+                r.add(
+                  seastar::httpd::operation_type::GET,
+                  seastar::httpd::url("/value"),
+                  new seastar::httpd::function_handler(
+                    [ &store ]
+                    (
+                      std::unique_ptr<seastar::http::request> req,
+                      std::unique_ptr<seastar::http::reply> rep
+                    ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
+                    {
+                      std::string key = req->get_query_param( "key" );
+
+                      if( key.empty() || key.size() >= 256 )
+                      {
+                        rep->_content += "{\"result\":\"invalid key size\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      std::optional<pkvs::stored_value_t> value;
+
+                      try
+                      {
+                        value =
+                          co_await
+                            pkvs::invoke_on_owner(
+                              store,
+                              key,
+                              []( pkvs::pkvs_shard& local_shard, std::string_view key )
+                              {
+                                return local_shard.get_value( key );
+                              });
+                      }
+                      catch( ... )
+                      {
+                        std::cerr << "value read failed: " << std::current_exception() << '\n';
+
+                        rep->_content += "{\"result\":\"internal server error\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      if( value == std::nullopt )
+                      {
+                        rep->_content += "{\"result\":\"missing\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      rep->write_body(
+                        "bin",
+                        [ value = std::move( *value ) ]( seastar::output_stream<char>&& out ) mutable
+                        {
+                          return write_value_reply( std::move( out ), std::move( value ) );
+                        });
+                      rep->add_header( "Content-Type", "application/octet-stream" );
+
+                      co_return std::move( rep );
+                    },
+                    "json"));
+
+                r.add(
+                  seastar::httpd::operation_type::POST,
+                  seastar::httpd::url("/batch"),
+                  new seastar::httpd::function_handler(
+                    [ &store ]
+                    (
+                      std::unique_ptr<seastar::http::request> req,
+                      std::unique_ptr<seastar::http::reply> rep
+                    ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
+                    {
+                      if( co_await read_content( *req ) == false )
+                      {
+                        rep->_content += "{\"result\":\"request too large\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      auto operations = parse_batch( *req );
+
+                      if( operations.has_value() == false )
+                      {
+                        rep->_content += operations.error();
+
+                        co_return std::move( rep );
+                      }
+
+                      std::vector< pkvs::batch_operation_type_t > types;
+
+                      types.reserve( operations->size() );
+
+                      for( auto const& operation : *operations )
+                        types.push_back( operation.type );
+
+                      std::vector< std::optional<std::string> > results;
+
+                      try
+                      {
+                        results = co_await pkvs::batch_on_all_shards( store, std::move( *operations ) );
+                      }
+                      catch( pkvs::overloaded_error const& )
+                      {
+                        // writes of other shards may have been executed
+                        co_return busy_reply( std::move( rep ) );
+                      }
+                      catch( ... )
+                      {
+                        std::cerr << "batch failed: " << std::current_exception() << '\n';
+
+                        rep->_content += "{\"result\":\"internal server error\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      auto& result = rep->_content;
+
+                      result += "{\"results\":[";
+
+                      for( size_t i = 0; i < results.size(); ++i )
+                      {
+                        if( types[ i ] != pkvs::batch_operation_type_t::get )
+                          result += "{\"result\":\"ok\"},";
+                        else if( results[ i ] != std::nullopt )
+                        {
+                          result += "{\"value\":";
+                          pkvs::json::append_string( result, *results[ i ] );
+                          result += "},";
+                        }
+                        else
+                          result += "{\"result\":\"missing\"},";
+                      }
+
+                      if( results.empty() == false )
+                        result.resize( result.size() - 1 );
+
+                      result += "]}";
+
+                      co_return std::move( rep );
+                    },
+                    "json"));
+
+                r.add(
+                  seastar::httpd::operation_type::GET,
+                  seastar::httpd::url("/range"),
+                  new seastar::httpd::function_handler(
+                    [ &store ]
+                    (
+                      std::unique_ptr<seastar::http::request> req,
+                      std::unique_ptr<seastar::http::reply> rep
+                    ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
+                    {
+                      // keys from [start, end), cursor from the previous
+                      // page replaces start
+                      std::string start = req->get_query_param( "start" );
+                      std::string end = req->get_query_param( "end" );
+                      std::string limit_param = req->get_query_param( "limit" );
+                      std::string cursor = req->get_query_param( "cursor" );
+                      size_t limit = range_default_limit;
+
+                      if( limit_param.empty() == false )
+                      {
+                        auto [ last, error ] =
+                          std::from_chars( limit_param.data(), limit_param.data() + limit_param.size(), limit );
+
+                        if
+                        (
+                          error != std::errc{} ||
+                          last != limit_param.data() + limit_param.size() ||
+                          limit == 0 ||
+                          limit > range_max_limit
+                        )
+                        {
+                          rep->_content += "{\"result\":\"invalid limit\"}";
+
+                          co_return std::move( rep );
+                        }
+                      }
+
+                      if( cursor.empty() == false )
+                      {
+                        auto decoded = pkvs::from_hex( cursor );
+
+                        if( decoded == std::nullopt )
+                        {
+                          rep->_content += "{\"result\":\"invalid cursor\"}";
+
+                          co_return std::move( rep );
+                        }
+
+                        start = std::move( *decoded );
+                      }
+
+                      pkvs::key_range_t page;
+
+                      try
+                      {
+                        page = co_await pkvs::range_on_all_shards( store, std::move( start ), std::move( end ), limit );
+                      }
+                      catch( ... )
+                      {
+                        std::cerr << "range failed: " << std::current_exception() << '\n';
+
+                        rep->_content += "{\"result\":\"internal server error\"}";
+
+                        co_return std::move( rep );
+                      }
+
+                      rep->write_body(
+                        "json",
+                        [ page = std::move( page ) ]( seastar::output_stream<char>&& out ) mutable
+                        {
+                          return write_range_reply( std::move( out ), std::move( page ) );
+                        });
+
+                      co_return std::move( rep );
+                    },
+                    "json"));
+
                 r.add(
                   seastar::httpd::operation_type::GET,
                   seastar::httpd::url("/sorted_keys"),
                   new seastar::httpd::function_handler(
-                    [ &store, common_request_processing ]
+                    [ &store ]
                     (
                       std::unique_ptr<seastar::http::request> req,
                       std::unique_ptr<seastar::http::reply> rep
                     ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
                     {
-                      std::set< std::string > keys;
+                      pkvs::store_range_t range{ store, {}, {} };
+                      pkvs::key_range_t page;
 
+                      // the first page is read before the reply is started so
+                      // that failures can still be reported
                       try
                       {
-                        co_await seastar::coroutine::parallel_for_each(
-                          std::views::iota( 0u, seastar::smp::count ),
-                          [ &store, &keys ]( size_t shard_no ) -> seastar::future<>
-                          {
-                            keys.merge(
-                              co_await
-                                store.invoke_on(
-                                  shard_no,
-                                  []( pkvs::pkvs_shard& local_shard )
-                                  {
-                                    return local_shard.sorted_keys();
-                                  }));
-                          });
+                        page = co_await range.next( sorted_keys_page_limit );
                       }
                       catch( ... )
                       {
@@ -316,17 +1113,62 @@ namespace
                         co_return std::move( rep );
                       }
 
-                      std::string result{ "{\"keys\":[" };
+                      rep->write_body(
+                        "json",
+                        [ range = std::move( range ), page = std::move( page ) ]
+                        (
+                          seastar::output_stream<char>&& out
+                        ) mutable
+                        {
+                          return write_sorted_keys_reply( std::move( out ), std::move( range ), std::move( page ) );
+                        });
 
-                      for( auto const& key : keys )
-                        result += '"' + key + "\",";
+                      co_return std::move( rep );
+                    },
+                    "json"));
+
+                // moves a segment to another shard, rebalancing does the same
+                // on its own
+                r.add(
+                  seastar::httpd::operation_type::POST,
+                  seastar::httpd::url("/move_segment"),
+                  new seastar::httpd::function_handler(
+                    [ &store ]
+                    (
+                      std::unique_ptr<seastar::http::request> req,
+                      std::unique_ptr<seastar::http::reply> rep
+                    ) -> seastar::future<std::unique_ptr<seastar::http::reply>>
+                    {
+                      auto segment_no = parse_number<size_t>( req->get_query_param( "segment" ) );
+                      auto shard_no = parse_number<unsigned>( req->get_query_param( "shard" ) );
+
+                      if
+                      (
+                        segment_no == std::nullopt ||
+                        shard_no == std::nullopt ||
+                        *segment_no >= store.local().segments_count() ||
+                        *shard_no >= seastar::smp::count
+                      )
+                      {
+                        rep->_content += "{\"result\":\"invalid segment or shard\"}";
 
-                      if( keys.empty() == false )
-                        result.pop_back();
+                        co_return std::move( rep );
+                      }
 
-                      result += "]}";
+                      try
+                      {
+                        co_await store.local().move_segment( *segment_no, *shard_no );
+                      }
+                      catch( ... )
+                      {
+                        std::cerr << "segment move failed: " << std::current_exception() << '\n';
+
+                        rep->_content += "{\"result\":\"internal server error\"}";
+
+                        co_return std::move( rep );
+                      }
 
-                      rep->_content += result;
+                      rep->_content += "{\"result\":\"ok\"}";
 
                       co_return std::move( rep );
                     },
@@ -337,22 +1179,31 @@ namespace
         co_await http_server.listen(seastar::ipv4_addr("0.0.0.0", port));
         std::cout << "listening\n";
 
+        if( resp_port != 0 )
+        {
+          std::cout << "try listening for resp on port " << resp_port << '\n';
+          co_await resp_server.start( std::ref( store ) );
+          co_await resp_server.invoke_on_all(
+            [ resp_port ]( pkvs::resp_server_t& local_server )
+            {
+              return local_server.listen( resp_port );
+            });
+          std::cout << "listening for resp\n";
+        }
+
+        // flushes and compactions are scheduled by every shard on its own
         while( signal.stopping() == false )
         {
           co_await seastar::sleep( std::chrono::seconds( 1 ) );
 
-          co_await seastar::coroutine::parallel_for_each(
-            std::views::iota( 0u, seastar::smp::count ),
-            [ &store ]( size_t shard_no ) -> seastar::future<>
-            {
-              co_await
-                store.invoke_on(
-                  shard_no,
-                  []( pkvs::pkvs_shard& local_shard )
-                  {
-                    return local_shard.housekeeping();
-                  });
-            });
+          try
+          {
+            co_await pkvs::rebalance( store, rebalance_threshold );
+          }
+          catch( ... )
+          {
+            std::cerr << "segment rebalancing failed: " << std::current_exception() << '\n';
+          }
         }
       }()
       .finally(
@@ -361,6 +1212,7 @@ namespace
           {
             std::cout << "shutting down\n";
             co_await http_server.stop();
+            co_await resp_server.stop();
             co_await store.stop();
           }));
   }
@@ -374,10 +1226,106 @@ int main( int argc, char** argv )
     "port,p",
     boost::program_options::value<uint16_t>()->default_value( 8080 ),
     "HTTP Server port");
+  app.add_options()(
+    "resp_port",
+    boost::program_options::value<uint16_t>()->default_value( 6380 ),
+    "Redis protocol (RESP) server port (0 disables it)");
+  app.add_options()(
+    "data_dir",
+    boost::program_options::value<std::vector<std::string>>()
+      ->composing()
+      ->default_value( { "pkvs_data" }, "pkvs_data" ),
+    "Directory in which segments are stored, segments are spread over all of them if given more than once");
+  app.add_options()(
+    "commitlog_dir",
+    boost::program_options::value<std::string>()->default_value( "" ),
+    "Directory of commit logs (defaults to commitlog in the first data directory)");
+  app.add_options()(
+    "segments",
+    boost::program_options::value<size_t>()->default_value( pkvs::default_segments_count ),
+    "Amount of segments into which keys are split, only used when the store is created");
+  app.add_options()(
+    "rebalance_threshold",
+    boost::program_options::value<double>()->default_value( 0.5 ),
+    "Segments are moved away from shards with this much more than the average load (0 disables it)");
   app.add_options()(
     "memory_threshold,t",
     boost::program_options::value<size_t>()->default_value( 100000000 ),
-    "HTTP Server port");
+    "Bytes of memtables per shard, split among its segments by write rate");
+  app.add_options()(
+    "bloom_filter_bits_per_key",
+    boost::program_options::value<size_t>()->default_value( 10 ),
+    "Size of per sstable bloom filters (0 disables them)");
+  app.add_options()(
+    "compaction_strategy",
+    boost::program_options::value<std::string>()->default_value( "size_tiered" ),
+    "Sstables compaction strategy (size_tiered or leveled)");
+  app.add_options()(
+    "compaction_io_budget",
+    boost::program_options::value<size_t>()->default_value( 4 * 1024 * 1024 ),
+    "Bytes of sstables a segment may read for compaction per housekeeping pass");
+  app.add_options()(
+    "flush_period_ms",
+    boost::program_options::value<unsigned>()->default_value( 100 ),
+    "How often every shard looks for memtables that need to be flushed");
+  app.add_options()(
+    "flush_concurrency",
+    boost::program_options::value<size_t>()->default_value( 2 ),
+    "Memtable flushes that every shard runs at once");
+  app.add_options()(
+    "dirty_memory_limit",
+    boost::program_options::value<size_t>()->default_value( 0 ),
+    "Bytes of unflushed memtables per shard after which the largest ones are flushed early and writes are throttled (0 for twice the memory_threshold)");
+  app.add_options()(
+    "write_stall_timeout_ms",
+    boost::program_options::value<unsigned>()->default_value( 1000 ),
+    "How long writes wait for flushes at twice the dirty memory limit before they are rejected");
+  app.add_options()(
+    "max_stalled_writes",
+    boost::program_options::value<size_t>()->default_value( 1024 ),
+    "Writes per shard that may wait for flushes, further ones are rejected");
+  app.add_options()(
+    "inline_value_threshold",
+    boost::program_options::value<size_t>()->default_value( 1024 ),
+    "Values up to this size are stored inside sstables instead of separate files");
+  app.add_options()(
+    "compression",
+    boost::program_options::value<std::string>()
+      ->default_value( std::string{ pkvs::compression_name( pkvs::default_compression ) } ),
+    "Codec of sstable blocks written by memtable flushes (none, lz4 or zstd)");
+  app.add_options()(
+    "compaction_compression",
+    boost::program_options::value<std::string>()
+      ->default_value( std::string{ pkvs::compression_name( pkvs::default_cold_compression ) } ),
+    "Codec of sstable blocks written by compaction (none, lz4 or zstd)");
+  app.add_options()(
+    "verify_checksums",
+    boost::program_options::value<bool>()->default_value( true ),
+    "Check sstable blocks and values against their checksums when they are read from disk");
+  app.add_options()(
+    "scrub_period_s",
+    boost::program_options::value<unsigned>()->default_value( 24 * 60 * 60 ),
+    "How often every shard verifies the checksums of all of its files (0 disables it)");
+  app.add_options()(
+    "commitlog_sync",
+    boost::program_options::value<std::string>()->default_value( "group" ),
+    "When writes are acknowledged (none, periodic or group)");
+  app.add_options()(
+    "commitlog_sync_period_ms",
+    boost::program_options::value<unsigned>()->default_value( 10 ),
+    "Commit log write interval for none and sync interval for periodic sync mode");
+  app.add_options()(
+    "commitlog_file_size",
+    boost::program_options::value<uint64_t>()->default_value( 32 * 1024 * 1024 ),
+    "Size after which a new commit log file is started");
+  app.add_options()(
+    "file_cache_size",
+    boost::program_options::value<size_t>()->default_value( 1024 ),
+    "Amount of sstable and value file handles each shard keeps open");
+  app.add_options()(
+    "block_cache_size",
+    boost::program_options::value<size_t>()->default_value( 64 * 1024 * 1024 ),
+    "Bytes of sstable blocks and values each shard keeps in memory (at most a quarter of shard memory)");
 
   try
   {
@@ -387,10 +1335,114 @@ int main( int argc, char** argv )
       [ &app ]
       {
         auto&& configuration = app.configuration();
+
+        pkvs::sstable_options_t sstable_options;
+        sstable_options.bloom_filter_bits_per_key =
+          configuration["bloom_filter_bits_per_key"].as<size_t>();
+        sstable_options.compaction_io_budget =
+          configuration["compaction_io_budget"].as<size_t>();
+        sstable_options.inline_value_threshold =
+          configuration["inline_value_threshold"].as<size_t>();
+        sstable_options.verify_checksums = configuration["verify_checksums"].as<bool>();
+
+        for
+        (
+          auto [ name, codec ] :
+            {
+              std::pair{ "compression", &sstable_options.compression },
+              { "compaction_compression", &sstable_options.compaction_compression }
+            }
+        )
+        {
+          auto value = configuration[ name ].as<std::string>();
+          auto parsed = pkvs::compression_from_name( value );
+
+          if( parsed == std::nullopt )
+            throw std::invalid_argument( "unknown " + std::string{ name } + " codec: " + value );
+          else if( pkvs::compression_supported( *parsed ) == false )
+            throw std::invalid_argument( std::string{ name } + " codec " + value + " is not supported by this build" );
+
+          *codec = *parsed;
+        }
+
+        if( auto strategy = configuration["compaction_strategy"].as<std::string>(); strategy == "leveled" )
+          sstable_options.compaction_strategy = pkvs::compaction_strategy_t::leveled;
+        else if( strategy != "size_tiered" )
+          throw std::invalid_argument( "unknown compaction strategy: " + strategy );
+
+        pkvs::commitlog_options_t commitlog_options;
+        commitlog_options.sync_period =
+          std::chrono::milliseconds( configuration["commitlog_sync_period_ms"].as<unsigned>() );
+        commitlog_options.file_size =
+          configuration["commitlog_file_size"].as<uint64_t>();
+
+        if( auto sync = configuration["commitlog_sync"].as<std::string>(); sync == "none" )
+          commitlog_options.sync = pkvs::commitlog_sync_t::none;
+        else if( sync == "periodic" )
+          commitlog_options.sync = pkvs::commitlog_sync_t::periodic;
+        else if( sync != "group" )
+          throw std::invalid_argument( "unknown commit log sync mode: " + sync );
+
+        pkvs::flush_scheduler_options_t flush_scheduler_options;
+        flush_scheduler_options.period =
+          std::chrono::milliseconds( configuration["flush_period_ms"].as<unsigned>() );
+        flush_scheduler_options.concurrency = configuration["flush_concurrency"].as<size_t>();
+        flush_scheduler_options.dirty_memory_limit = configuration["dirty_memory_limit"].as<size_t>();
+
+        if( flush_scheduler_options.period.count() == 0 || flush_scheduler_options.concurrency == 0 )
+          throw std::invalid_argument( "flush_period_ms and flush_concurrency must be greater than 0" );
+
+        pkvs::write_admission_options_t write_admission_options;
+        write_admission_options.stall_timeout =
+          std::chrono::milliseconds( configuration["write_stall_timeout_ms"].as<unsigned>() );
+        write_admission_options.max_stalled_writes = configuration["max_stalled_writes"].as<size_t>();
+
+        // segment count of an existing store can't be changed, an explicitly
+        // given one is checked against it
+        std::optional<size_t> segments_count;
+
+        if( configuration["segments"].defaulted() == false )
+        {
+          segments_count = configuration["segments"].as<size_t>();
+
+          if( *segments_count == 0 )
+            throw std::invalid_argument( "segments must be greater than 0" );
+        }
+
+        // paths are normalized so that they can be compared with the ones
+        // that the store was created with
+        auto normalized =
+          []( std::string const& directory )
+          {
+            auto path = std::filesystem::absolute( directory ).lexically_normal();
+
+            return path.has_filename() ? path : path.parent_path();
+          };
+        pkvs::store_directories_t directories;
+
+        for( auto const& data_dir : configuration["data_dir"].as<std::vector<std::string>>() )
+          directories.data.push_back( normalized( data_dir ) );
+
+        if( auto commitlog_dir = configuration["commitlog_dir"].as<std::string>(); commitlog_dir.empty() == false )
+          directories.commitlog = normalized( commitlog_dir );
+        else
+          directories.commitlog = directories.data.front() / "commitlog";
+
         return
           service_loop(
             configuration["port"].as<uint16_t>(),
-            configuration["memory_threshold"].as<size_t>() );
+            configuration["resp_port"].as<uint16_t>(),
+            directories,
+            segments_count,
+            configuration["rebalance_threshold"].as<double>(),
+            configuration["memory_threshold"].as<size_t>(),
+            sstable_options,
+            commitlog_options,
+            configuration["file_cache_size"].as<size_t>(),
+            configuration["block_cache_size"].as<size_t>(),
+            flush_scheduler_options,
+            write_admission_options,
+            std::chrono::seconds( configuration["scrub_period_s"].as<unsigned>() ) );
       });
   }
   catch (...)
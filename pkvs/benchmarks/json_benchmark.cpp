@@ -0,0 +1,138 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+// compares the request parsing and reply serialization of pkvs::json with the
+// nlohmann::json based path that the http handlers used before
+
+#include <nlohmann/json.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "pkvs/detail/json.hpp"
+
+namespace
+{
+  // keeps the optimizer from dropping the measured work
+  volatile size_t sink = 0;
+
+  template< typename function_t >
+  void measure( std::string_view name, size_t iterations, function_t&& function )
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    for( size_t i = 0; i < iterations; ++i )
+      sink = sink + function();
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << ": " << elapsed.count() / iterations << " ns/op\n";
+  }
+
+  size_t nlohmann_parse( std::string const& content, std::unordered_set<std::string> expected_keys )
+  {
+    nlohmann::json data = nlohmann::json::parse( content.c_str() );
+
+    for( auto& [key, val] : data.items() )
+    {
+      if( expected_keys.erase( key ) == 0 || val.type() != nlohmann::json::value_t::string )
+        return 0;
+    }
+
+    if( expected_keys.empty() == false )
+      return 0;
+
+    return data["key"].get<std::string_view>().size() + data["value"].get<std::string_view>().size();
+  }
+
+  size_t pkvs_parse( std::string const& content, std::string& buffer )
+  {
+    constexpr std::string_view names[] = { "key", "value" };
+    std::string_view values[ 2 ];
+
+    // parsing is in place so every iteration needs a fresh copy, the buffer
+    // is reused the same way as the request content is
+    buffer.assign( content );
+
+    if( pkvs::json::parse_object( { buffer.data(), buffer.size() }, names, values ) != std::nullopt )
+      return 0;
+
+    return values[ 0 ].size() + values[ 1 ].size();
+  }
+}
+
+int main()
+{
+  constexpr size_t iterations = 1000000;
+
+  std::string const small = R"({"key":"user:1234","value":"some short value"})";
+  std::string const escaped = R"({"key":"user:1234","value":"line\none \"quoted\" éè tab\tend"})";
+  std::string const large =
+    R"({"key":"user:1234","value":")" + std::string( 4096, 'x' ) + R"("})";
+  std::string buffer;
+
+  for( auto const& [ name, content ] : { std::pair{ "small", &small }, { "escaped", &escaped }, { "4KiB", &large } } )
+  {
+    measure(
+      std::string{ "parse nlohmann " } + name,
+      iterations,
+      [ & ]{ return nlohmann_parse( *content, { "key", "value" } ); } );
+    measure(
+      std::string{ "parse pkvs::json " } + name,
+      iterations,
+      [ & ]{ return pkvs_parse( *content, buffer ); } );
+  }
+
+  std::string const plain_value = "some short value";
+  std::string const escaped_value = "line\none \"quoted\" \xC3\xA9\xC3\xA8 tab\tend";
+  std::string const large_value( 4096, 'x' );
+
+  for
+  (
+    auto const& [ name, value ] :
+      { std::pair{ "small", &plain_value }, { "escaped", &escaped_value }, { "4KiB", &large_value } }
+  )
+  {
+    // unescaped concatenation is only correct for values without special
+    // characters but it is the lower bound
+    measure(
+      std::string{ "reply concatenation " } + name,
+      iterations,
+      [ & ]
+      {
+        std::string reply;
+        reply += "{\"value\":\"" + *value + "\"}";
+
+        return reply.size();
+      } );
+    measure(
+      std::string{ "reply nlohmann " } + name,
+      iterations,
+      [ & ]
+      {
+        std::string reply;
+        reply += "{\"value\":" + nlohmann::json( *value ).dump() + "}";
+
+        return reply.size();
+      } );
+    measure(
+      std::string{ "reply pkvs::json " } + name,
+      iterations,
+      [ & ]
+      {
+        std::string reply;
+        reply += "{\"value\":";
+        pkvs::json::append_string( reply, *value );
+        reply += "}";
+
+        return reply.size();
+      } );
+  }
+
+  return 0;
+}
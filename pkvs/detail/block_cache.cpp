@@ -0,0 +1,134 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "block_cache.hpp"
+
+#include <algorithm>
+
+using namespace pkvs;
+
+namespace
+{
+  // amount of memory that is given back per allocator request
+  constexpr size_t reclaim_step = 1024 * 1024;
+
+  // list and map nodes of an entry next to the entry itself, the path is
+  // stored in both of them
+  template< typename entry_t, typename map_value_t >
+  size_t entry_charge( std::string const& path, size_t block_size )
+  {
+    constexpr size_t node_links = 6 * sizeof( void* );
+
+    return block_size + 2 * path.capacity() + sizeof( entry_t ) + sizeof( map_value_t ) + node_links;
+  }
+}
+
+block_cache_t::block_cache_t( size_t capacity )
+  // the cache shares shard memory with memtables so it's never allowed to
+  // take more than a quarter of it
+  : capacity_{ std::min( capacity, seastar::memory::stats().total_memory() / 4 ) }
+  , reclaimer_{ [ this ]{ return reclaim(); } }
+{}
+
+std::optional< seastar::temporary_buffer<char> > block_cache_t::get
+(
+  std::filesystem::path const& file,
+  uint64_t offset
+)
+{
+  auto found = entries_.find( key_t{ file.native(), offset } );
+
+  if( found == entries_.end() )
+  {
+    ++stats_.misses;
+
+    return std::nullopt;
+  }
+
+  ++stats_.hits;
+  lru_.splice( lru_.begin(), lru_, found->second );
+
+  return found->second->block.share();
+}
+
+void block_cache_t::put
+(
+  std::filesystem::path const& file,
+  uint64_t offset,
+  seastar::temporary_buffer<char> block
+)
+{
+  // a single block shouldn't flush a large part of the cache
+  if( block.size() > capacity_ / 8 )
+    return;
+
+  key_t key{ file.native(), offset };
+
+  if( entries_.contains( key ) )
+    return;
+
+  auto charge =
+    entry_charge< entry_t, decltype( entries_ )::value_type >( key.first, block.size() );
+
+  size_ += charge;
+  lru_.push_front( entry_t{ key, block.clone(), charge } );
+  entries_.emplace( std::move( key ), lru_.begin() );
+
+  shrink( capacity_ );
+}
+
+void block_cache_t::evict( std::filesystem::path const& file )
+{
+  for
+  (
+    auto it = entries_.lower_bound( key_t{ file.native(), 0 } );
+    it != entries_.end() && it->first.first == file.native();
+  )
+  {
+    size_ -= it->second->charge;
+    lru_.erase( it->second );
+    it = entries_.erase( it );
+  }
+}
+
+void block_cache_t::evict_directory( std::filesystem::path const& directory )
+{
+  // paths of the directory are a contiguous range of the ordered map
+  std::string prefix = ( directory / "" ).native();
+
+  for
+  (
+    auto it = entries_.lower_bound( key_t{ prefix, 0 } );
+    it != entries_.end() && it->first.first.starts_with( prefix );
+  )
+  {
+    size_ -= it->second->charge;
+    lru_.erase( it->second );
+    it = entries_.erase( it );
+  }
+}
+
+void block_cache_t::shrink( size_t target )
+{
+  while( size_ > target )
+  {
+    auto& last = lru_.back();
+
+    size_ -= last.charge;
+    entries_.erase( last.key );
+    lru_.pop_back();
+    ++stats_.evictions;
+  }
+}
+
+seastar::memory::reclaiming_result block_cache_t::reclaim()
+{
+  if( size_ == 0 )
+    return seastar::memory::reclaiming_result::reclaimed_nothing;
+
+  shrink( size_ > reclaim_step ? size_ - reclaim_step : 0 );
+
+  return seastar::memory::reclaiming_result::reclaimed_something;
+}
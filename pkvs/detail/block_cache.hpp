@@ -0,0 +1,96 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef BLOCK_CACHE_HPP_INCLUDED
+#define BLOCK_CACHE_HPP_INCLUDED
+
+#include <seastar/core/memory.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace pkvs
+{
+  struct block_cache_stats_t
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  // shard local least recently used cache of sstable blocks and small value
+  // files - blocks are kept decompressed so that cache hits don't pay for
+  // decompression
+  //
+  // cached blocks are shared with the reads that use them so an evicted block
+  // is freed only once the last read releases it
+  //
+  // the cache also gives memory back when the seastar allocator of the shard
+  // runs low
+  class block_cache_t
+  {
+  public:
+    // capacity in bytes per shard, 0 disables the cache
+    explicit block_cache_t( size_t capacity );
+
+    block_cache_t( block_cache_t const& ) = delete;
+    block_cache_t& operator=( block_cache_t const& ) = delete;
+
+    std::optional< seastar::temporary_buffer<char> > get
+    (
+      std::filesystem::path const& file,
+      uint64_t offset
+    );
+
+    // the block is copied so that the cache holds exactly its bytes and not
+    // the larger aligned read buffer that it can be a view of
+    void put
+    (
+      std::filesystem::path const& file,
+      uint64_t offset,
+      seastar::temporary_buffer<char> block
+    );
+
+    // drops all blocks of a file that is about to be removed or rewritten
+    void evict( std::filesystem::path const& file );
+    // drops blocks of all files under the directory
+    void evict_directory( std::filesystem::path const& directory );
+
+    block_cache_stats_t const& stats() const { return stats_; }
+    size_t memory_footprint() const { return size_; }
+
+  private:
+    using key_t = std::pair< std::string, uint64_t >;
+
+    struct entry_t
+    {
+      key_t key;
+      seastar::temporary_buffer<char> block;
+      // memory of the block and of the bookkeeping of the entry
+      size_t charge;
+    };
+
+    // evicts least recently used blocks until at most target bytes remain
+    void shrink( size_t target );
+    seastar::memory::reclaiming_result reclaim();
+
+    size_t capacity_;
+    // charges of all entries
+    size_t size_ = 0;
+    block_cache_stats_t stats_;
+    // most recently used first
+    std::list<entry_t> lru_;
+    std::map< key_t, std::list<entry_t>::iterator > entries_;
+    seastar::memory::reclaimer reclaimer_;
+  };
+}
+
+#endif // BLOCK_CACHE_HPP_INCLUDED
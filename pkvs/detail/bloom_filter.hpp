@@ -0,0 +1,147 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef BLOOM_FILTER_HPP_INCLUDED
+#define BLOOM_FILTER_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pkvs
+{
+  class bloom_filter_t
+  {
+  public:
+    // filters are persisted so the hash function must never change for an
+    // existing format version
+    static uint64_t hash( std::string_view key )
+    {
+      // FNV-1a followed by murmur3 finalizer for better bit dispersion
+      uint64_t h = 14695981039346656037ull;
+
+      for( unsigned char c : key )
+      {
+        h ^= c;
+        h *= 1099511628211ull;
+      }
+
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+      h *= 0xc4ceb9fe1a85ec53ull;
+      h ^= h >> 33;
+
+      return h;
+    }
+
+    bloom_filter_t() = default;
+
+    bloom_filter_t( std::span< uint64_t const > key_hashes, size_t bits_per_key )
+      // k = bits_per_key * ln( 2 ) minimizes the false positive rate
+      : hashes_count_{ std::clamp< uint32_t >( bits_per_key * 69 / 100, 1, 30 ) }
+      , bits_( ( std::max< size_t >( key_hashes.size() * bits_per_key, 64 ) + 63 ) / 64 )
+    {
+      for( auto h : key_hashes )
+      {
+        for_each_bit(
+          h,
+          [ this ]( uint64_t bit )
+          {
+            bits_[ bit / 64 ] |= uint64_t{ 1 } << ( bit % 64 );
+          });
+      }
+    }
+
+    bool empty() const { return bits_.empty(); }
+
+    bool may_contain( std::string_view key ) const
+    {
+      if( empty() )
+        return true;
+
+      bool contains = true;
+
+      for_each_bit(
+        hash( key ),
+        [ this, &contains ]( uint64_t bit )
+        {
+          contains = contains && ( bits_[ bit / 64 ] & ( uint64_t{ 1 } << ( bit % 64 ) ) );
+        });
+
+      return contains;
+    }
+
+    size_t memory_footprint() const
+    {
+      return bits_.size() * sizeof( uint64_t );
+    }
+
+    // layout: uint32_t version, uint32_t hashes count, bit words
+    std::string serialize() const
+    {
+      std::string out( 2 * sizeof( uint32_t ) + memory_footprint(), '\0' );
+      uint32_t version = 1;
+
+      std::memcpy( out.data(), &version, sizeof( version ) );
+      std::memcpy( out.data() + sizeof( uint32_t ), &hashes_count_, sizeof( hashes_count_ ) );
+      std::memcpy( out.data() + 2 * sizeof( uint32_t ), bits_.data(), memory_footprint() );
+
+      return out;
+    }
+
+    static std::optional< bloom_filter_t > deserialize( std::string_view in )
+    {
+      uint32_t version;
+      bloom_filter_t filter;
+
+      if
+      (
+        in.size() < 2 * sizeof( uint32_t ) ||
+        ( in.size() - 2 * sizeof( uint32_t ) ) % sizeof( uint64_t ) != 0
+      )
+      {
+        return std::nullopt;
+      }
+
+      std::memcpy( &version, in.data(), sizeof( version ) );
+      std::memcpy( &filter.hashes_count_, in.data() + sizeof( uint32_t ), sizeof( uint32_t ) );
+
+      if( version != 1 || filter.hashes_count_ == 0 || filter.hashes_count_ > 30 )
+        return std::nullopt;
+
+      in.remove_prefix( 2 * sizeof( uint32_t ) );
+      filter.bits_.resize( in.size() / sizeof( uint64_t ) );
+      std::memcpy( filter.bits_.data(), in.data(), in.size() );
+
+      return filter;
+    }
+
+  private:
+    // double hashing - derive all k bit positions from a single hash
+    template < typename Func >
+    void for_each_bit( uint64_t h, Func&& func ) const
+    {
+      uint64_t bits_count = bits_.size() * 64;
+      uint64_t delta = ( h >> 17 ) | ( h << 47 );
+
+      for( uint32_t i = 0; i < hashes_count_; ++i )
+      {
+        func( h % bits_count );
+        h += delta;
+      }
+    }
+
+    uint32_t hashes_count_ = 0;
+    std::vector< uint64_t > bits_;
+  };
+}
+
+#endif // BLOOM_FILTER_HPP_INCLUDED
@@ -0,0 +1,626 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "commitlog.hpp"
+
+#include <seastar/core/coroutine.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "crc32c.hpp"
+#include "sstable_format.hpp"
+
+using namespace pkvs;
+
+namespace
+{
+  // files are written in whole pages which also satisfies the dma alignment
+  constexpr uint64_t page_size = 4096;
+
+  struct log_file_name_t
+  {
+    uint64_t generation;
+    unsigned shard;
+    uint64_t file_no;
+  };
+
+  std::optional<log_file_name_t> parse_file_name( std::string_view name )
+  {
+    uint64_t parts[ 3 ];
+
+    for( size_t i = 0; i < 3; ++i )
+    {
+      auto end = i < 2 ? name.find( '_' ) : name.size();
+
+      if
+      (
+        end == std::string_view::npos ||
+        end == 0 ||
+        std::all_of( name.begin(), name.begin() + end, []( char c ){ return c >= '0' && c <= '9'; } ) == false
+      )
+      {
+        return std::nullopt;
+      }
+
+      parts[ i ] = std::stoull( std::string{ name.substr( 0, end ) } );
+      name.remove_prefix( i < 2 ? end + 1 : end );
+    }
+
+    return log_file_name_t{ parts[ 0 ], static_cast<unsigned>( parts[ 1 ] ), parts[ 2 ] };
+  }
+
+  seastar::future<std::vector<log_file_name_t>> list_files( std::filesystem::path const& directory )
+  {
+    std::vector<log_file_name_t> files;
+
+    auto dir = co_await seastar::open_directory( directory.native() );
+    auto lister = dir.experimental_list_directory();
+
+    co_await
+      [&] -> seastar::future<>
+      {
+        while( auto de = co_await lister() )
+        {
+          if( auto parsed = parse_file_name( de->name ) )
+            files.push_back( *parsed );
+        }
+      }()
+      .finally( [&]{ return dir.close(); } );
+
+    std::ranges::sort(
+      files,
+      []( auto const& a, auto const& b )
+      {
+        return
+          std::tuple{ a.generation, a.shard, a.file_no } <
+          std::tuple{ b.generation, b.shard, b.file_no };
+      });
+
+    co_return files;
+  }
+
+  std::filesystem::path make_file_path
+  (
+    std::filesystem::path const& directory,
+    log_file_name_t const& name
+  )
+  {
+    return
+      directory /
+      ( std::to_string( name.generation ) + '_' +
+        std::to_string( name.shard ) + '_' +
+        std::to_string( name.file_no ) );
+  }
+
+  // version 1 files have no header and frames without checksums, their
+  // first frame size can't be the marker
+  constexpr uint32_t header_marker = 0xFFFFFFFF;
+  constexpr uint32_t current_version = 2;
+  constexpr size_t header_size = 2 * sizeof( uint32_t );
+
+  std::string encode_header()
+  {
+    std::string header( header_size, '\0' );
+
+    std::memcpy( header.data(), &header_marker, sizeof( header_marker ) );
+    std::memcpy( header.data() + sizeof( header_marker ), &current_version, sizeof( current_version ) );
+
+    return header;
+  }
+
+  // uint32_t payload size and uint32_t crc32c of the payload
+  constexpr size_t frame_header_size = 2 * sizeof( uint32_t );
+
+  // reserves the frame header in front of a payload that is appended next
+  size_t start_frame( std::string& buffer )
+  {
+    auto frame_start = buffer.size();
+
+    buffer.append( frame_header_size, '\0' );
+
+    return frame_start;
+  }
+
+  // fills the frame header once the whole payload was appended
+  void finish_frame( std::string& buffer, size_t frame_start )
+  {
+    auto payload = std::string_view{ buffer }.substr( frame_start + frame_header_size );
+    uint32_t size = payload.size();
+    uint32_t crc = crc32c( payload );
+
+    std::memcpy( buffer.data() + frame_start, &size, sizeof( size ) );
+    std::memcpy( buffer.data() + frame_start + sizeof( size ), &crc, sizeof( crc ) );
+  }
+
+  constexpr uint8_t segment_flushed_type = 3;
+
+  // returns false for a torn or otherwise unreadable record, segment_flushed
+  // is set for type 3 records which only fill record.segment_no
+  bool decode_record( std::string_view in, commitlog_record_t& record, bool& segment_flushed )
+  {
+    uint64_t segment_no;
+    uint64_t key_size;
+
+    if( in.empty() || static_cast<uint8_t>( in.front() ) > segment_flushed_type )
+      return false;
+
+    bool has_value = in.front() == 1;
+    bool in_value_file = in.front() == 2;
+    segment_flushed = in.front() == segment_flushed_type;
+    in.remove_prefix( 1 );
+
+    if( segment_flushed )
+    {
+      if( sstable_format::take_varint( in, segment_no ) == false || in.empty() == false )
+        return false;
+
+      record.segment_no = segment_no;
+
+      return true;
+    }
+
+    if
+    (
+      sstable_format::take_varint( in, segment_no ) == false ||
+      sstable_format::take_varint( in, key_size ) == false ||
+      key_size == 0 ||
+      in.size() < key_size
+    )
+    {
+      return false;
+    }
+
+    record.segment_no = segment_no;
+    record.key.assign( in.substr( 0, key_size ) );
+    in.remove_prefix( key_size );
+    record.value.reset();
+    record.in_value_file = in_value_file;
+
+    if( in_value_file )
+      record.value.emplace();
+
+    if( has_value )
+    {
+      uint64_t value_size;
+
+      if( sstable_format::take_varint( in, value_size ) == false || in.size() != value_size )
+        return false;
+
+      record.value.emplace( in );
+    }
+    else if( in.empty() == false )
+      return false;
+
+    return true;
+  }
+
+  // calls func with the offset and payload of every frame of a log file until
+  // func returns false or the file ends - records that were only partially
+  // written before a crash were never acknowledged so the rest of the file is
+  // ignored and a checksum mismatch, which can't be told apart from a torn
+  // write, ends the file as well
+  seastar::future<> read_frames
+  (
+    std::filesystem::path path,
+    bool report,
+    std::function< bool ( uint64_t offset, std::string_view payload ) > func
+  )
+  {
+    auto in_file = co_await seastar::open_file_dma( path.native(), seastar::open_flags::ro );
+    seastar::temporary_buffer<char> content;
+
+    co_await
+      [ & ] -> seastar::future<>
+      {
+        if( auto size = co_await in_file.size(); size > 0 )
+          content = co_await in_file.dma_read_exactly<char>( 0, size );
+      }()
+      .finally( [ & ]{ return in_file.close(); } );
+
+    std::string_view in{ content.get(), content.size() };
+    bool checksums = false;
+    uint32_t marker = 0;
+
+    if( in.size() >= header_size )
+      std::memcpy( &marker, in.data(), sizeof( marker ) );
+
+    if( marker == header_marker )
+    {
+      uint32_t version;
+      std::memcpy( &version, in.data() + sizeof( marker ), sizeof( version ) );
+
+      if( version != current_version )
+      {
+        if( report )
+          std::cerr << "commitlog " << path << " has unsupported version " << version << ", skipping it\n";
+
+        co_return;
+      }
+
+      in.remove_prefix( header_size );
+      checksums = true;
+    }
+
+    // version 1 frames have only the size
+    size_t frame_header = checksums ? frame_header_size : sizeof( uint32_t );
+
+    while( in.size() >= sizeof( uint32_t ) )
+    {
+      uint32_t size;
+      std::memcpy( &size, in.data(), sizeof( size ) );
+
+      if( size == 0 )
+        break;
+
+      uint64_t offset = content.size() - in.size();
+
+      if
+      (
+        in.size() < frame_header + size ||
+        ( checksums && crc32c( in.substr( frame_header, size ) ) != read_crc32c( in.substr( 0, frame_header ) ) ) ||
+        func( offset, in.substr( frame_header, size ) ) == false
+      )
+      {
+        if( report )
+          std::cerr << "commitlog " << path << " ends with an incomplete or corrupted record\n";
+
+        break;
+      }
+
+      in.remove_prefix( frame_header );
+      in.remove_prefix( size );
+    }
+  }
+}
+
+seastar::future<uint64_t> commitlog_t::next_generation( std::filesystem::path directory )
+{
+  uint64_t generation = 0;
+
+  for( auto const& file : co_await list_files( directory ) )
+    generation = std::max( generation, file.generation + 1 );
+
+  co_return generation;
+}
+
+seastar::future<> commitlog_t::replay
+(
+  std::filesystem::path directory,
+  uint64_t generation,
+  std::function< bool ( size_t segment_no ) > wanted,
+  std::function< void ( commitlog_record_t&& ) > func
+)
+{
+  auto files = co_await list_files( directory );
+
+  std::erase_if( files, [ generation ]( auto const& file ){ return file.generation >= generation; } );
+
+  // files of a single log (generation and shard) are listed next to each other
+  for( auto first = files.begin(); first != files.end(); )
+  {
+    auto last =
+      std::find_if(
+        first,
+        files.end(),
+        [ & ]( auto const& file )
+        {
+          return file.generation != first->generation || file.shard != first->shard;
+        });
+
+    // a segment flushed record drops the records of its segment that were
+    // written before it in the same log so the first pass only looks for the
+    // position (file number and offset) of the last such record per segment
+    // and the second pass streams the records that follow it
+    std::unordered_map< size_t, std::pair< uint64_t, uint64_t > > flushed_at;
+
+    for( auto file = first; file != last; ++file )
+    {
+      co_await read_frames(
+        make_file_path( directory, *file ),
+        false,
+        [ & ]( uint64_t offset, std::string_view payload )
+        {
+          commitlog_record_t record;
+          bool segment_flushed;
+
+          if( payload.empty() || static_cast<uint8_t>( payload.front() ) != segment_flushed_type )
+            return true;
+
+          if( decode_record( payload, record, segment_flushed ) == false )
+            return false;
+
+          if( wanted( record.segment_no ) )
+            flushed_at[ record.segment_no ] = { file->file_no, offset };
+
+          return true;
+        });
+    }
+
+    for( auto file = first; file != last; ++file )
+    {
+      co_await read_frames(
+        make_file_path( directory, *file ),
+        true,
+        [ & ]( uint64_t offset, std::string_view payload )
+        {
+          commitlog_record_t record;
+          bool segment_flushed;
+
+          if( decode_record( payload, record, segment_flushed ) == false )
+            return false;
+
+          if( segment_flushed || wanted( record.segment_no ) == false )
+            return true;
+
+          if
+          (
+            auto found = flushed_at.find( record.segment_no );
+            found != flushed_at.end() && std::pair{ file->file_no, offset } < found->second
+          )
+          {
+            return true;
+          }
+
+          func( std::move( record ) );
+
+          return true;
+        });
+    }
+
+    first = last;
+  }
+}
+
+seastar::future<> commitlog_t::remove_old_generations
+(
+  std::filesystem::path directory,
+  uint64_t generation
+)
+{
+  for( auto const& file : co_await list_files( directory ) )
+  {
+    if( file.generation < generation )
+      co_await seastar::remove_file( make_file_path( directory, file ).native() );
+  }
+
+  co_await seastar::sync_directory( directory.native() );
+}
+
+seastar::future<std::unique_ptr<commitlog_t>> commitlog_t::make
+(
+  std::filesystem::path directory,
+  uint64_t generation,
+  unsigned shard,
+  commitlog_options_t options
+)
+{
+  std::unique_ptr<commitlog_t> log{ new commitlog_t{ directory, generation, shard, options } };
+
+  co_await log->open_file();
+
+  if( options.sync != commitlog_sync_t::group )
+    log->timer_.arm_periodic( options.sync_period );
+
+  co_return log;
+}
+
+commitlog_t::commitlog_t
+(
+  std::filesystem::path directory,
+  uint64_t generation,
+  unsigned shard,
+  commitlog_options_t options
+)
+  : directory_{ std::move( directory ) }
+  , generation_{ generation }
+  , shard_{ shard }
+  , options_{ options }
+  , timer_{ [ this ]{ on_timer(); } }
+{}
+
+std::filesystem::path commitlog_t::file_path( uint64_t file_no ) const
+{
+  return make_file_path( directory_, { generation_, shard_, file_no } );
+}
+
+seastar::future<> commitlog_t::open_file()
+{
+  file_ =
+    co_await seastar::open_file_dma
+    (
+      file_path( file_no_ ).native(),
+      seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::exclusive
+    );
+  file_offset_ = 0;
+  tail_.clear();
+  // records that were added while the previous file was written follow the
+  // header, it isn't counted as added as no write waits for it
+  buffer_.insert( 0, encode_header() );
+
+  // make sure that the new file is still there after a crash
+  co_await seastar::sync_directory( directory_.native() );
+}
+
+uint64_t commitlog_t::add
+(
+  size_t segment_no,
+  std::string_view key,
+  std::optional<std::string_view> value
+)
+{
+  return append( value ? 1 : 0, segment_no, key, value );
+}
+
+uint64_t commitlog_t::add_value_file( size_t segment_no, std::string_view key )
+{
+  return append( 2, segment_no, key, std::nullopt );
+}
+
+void commitlog_t::add_segment_flushed( size_t segment_no )
+{
+  auto frame_start = start_frame( buffer_ );
+
+  buffer_ += static_cast<char>( segment_flushed_type );
+  sstable_format::append_varint( buffer_, segment_no );
+
+  finish_frame( buffer_, frame_start );
+  added_ += buffer_.size() - frame_start;
+}
+
+uint64_t commitlog_t::append
+(
+  uint8_t type,
+  size_t segment_no,
+  std::string_view key,
+  std::optional<std::string_view> value
+)
+{
+  auto frame_start = start_frame( buffer_ );
+
+  buffer_ += static_cast<char>( type );
+  sstable_format::append_varint( buffer_, segment_no );
+  sstable_format::append_varint( buffer_, key.size() );
+  buffer_.append( key );
+
+  if( value )
+  {
+    sstable_format::append_varint( buffer_, value->size() );
+    buffer_.append( *value );
+  }
+
+  finish_frame( buffer_, frame_start );
+  added_ += buffer_.size() - frame_start;
+
+  return file_no_;
+}
+
+seastar::future<> commitlog_t::wait_durable()
+{
+  if( options_.sync != commitlog_sync_t::group )
+    co_return;
+
+  auto holder = gate_.hold();
+  uint64_t target = added_;
+  // writers that queue up here while a sync is in progress are all covered
+  // by the next sync
+  auto units = co_await seastar::get_units( write_lock_, 1 );
+
+  if( synced_ < target )
+    co_await write( true );
+}
+
+seastar::future<> commitlog_t::sync()
+{
+  auto holder = gate_.hold();
+  auto units = co_await seastar::get_units( write_lock_, 1 );
+
+  co_await write( true );
+}
+
+seastar::future<> commitlog_t::write( bool sync )
+{
+  size_t size = buffer_.size();
+  uint64_t covered = added_;
+
+  if( size > 0 )
+  {
+    // the last partially written page is rewritten together with new records
+    uint64_t start = file_offset_ - tail_.size();
+    size_t length = ( tail_.size() + size + page_size - 1 ) / page_size * page_size;
+    auto pages = seastar::temporary_buffer<char>::aligned( page_size, length );
+
+    std::memset( pages.get_write(), 0, length );
+    std::memcpy( pages.get_write(), tail_.data(), tail_.size() );
+    std::memcpy( pages.get_write() + tail_.size(), buffer_.data(), size );
+
+    for( size_t written = 0; written < length; )
+    {
+      auto count =
+        co_await file_.dma_write( start + written, pages.get() + written, length - written );
+
+      if( count == 0 )
+        throw std::runtime_error( "commitlog write failed: " + file_path( file_no_ ).native() );
+
+      written += count;
+    }
+
+    file_offset_ += size;
+
+    size_t tail_size = file_offset_ % page_size;
+    tail_.assign( pages.get() + ( file_offset_ - start ) - tail_size, tail_size );
+    // records added during the write stay in the buffer for the next one
+    buffer_.erase( 0, size );
+  }
+
+  if( sync && synced_ < covered )
+  {
+    co_await file_.flush();
+    synced_ = covered;
+  }
+
+  if( file_offset_ >= options_.file_size )
+  {
+    co_await file_.flush();
+    co_await file_.close();
+
+    ++file_no_;
+    co_await open_file();
+  }
+}
+
+void commitlog_t::on_timer()
+{
+  if
+  (
+    write_lock_.available_units() == 0 ||
+    ( buffer_.empty() && ( options_.sync == commitlog_sync_t::none || synced_ == added_ ) )
+  )
+  {
+    return;
+  }
+
+  (void)seastar::with_gate(
+    gate_,
+    [ this ]
+    {
+      return
+        seastar::with_semaphore(
+          write_lock_,
+          1,
+          [ this ]{ return write( options_.sync == commitlog_sync_t::periodic ); } );
+    })
+    .handle_exception(
+      [ this ]( std::exception_ptr e )
+      {
+        std::cerr << "commitlog " << directory_ << " write failed: " << e << '\n';
+      });
+}
+
+seastar::future<> commitlog_t::discard_before( uint64_t file_no )
+{
+  file_no = std::min( file_no, file_no_ );
+
+  for( ; oldest_file_no_ < file_no; ++oldest_file_no_ )
+    co_await seastar::remove_file( file_path( oldest_file_no_ ).native() );
+}
+
+seastar::future<> commitlog_t::stop()
+{
+  timer_.cancel();
+  co_await gate_.close();
+
+  co_await
+    seastar::with_semaphore( write_lock_, 1, [ this ]{ return write( true ); } )
+      .finally( [ this ]{ return file_.close(); } );
+}
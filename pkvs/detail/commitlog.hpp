@@ -0,0 +1,186 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef COMMITLOG_HPP_INCLUDED
+#define COMMITLOG_HPP_INCLUDED
+
+#include <seastar/core/file.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/timer.hh>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace pkvs
+{
+  enum class commitlog_sync_t
+  {
+    // records are written out every sync period but never synced - survives
+    // app crashes but not os crashes or power loss
+    none,
+    // writes are acknowledged immediately and synced every sync period
+    periodic,
+    // writes are acknowledged once synced, concurrent writes share a sync
+    group
+  };
+
+  struct commitlog_options_t
+  {
+    commitlog_sync_t sync = commitlog_sync_t::group;
+    std::chrono::milliseconds sync_period{ 10 };
+    // log files are rotated once they grow past this size
+    uint64_t file_size = 32 * 1024 * 1024;
+  };
+
+  struct commitlog_record_t
+  {
+    size_t segment_no;
+    std::string key;
+    std::optional<std::string> value; // std::nullopt for deletes
+    // value was written directly to its value file (value is empty)
+    bool in_value_file = false;
+  };
+
+  // per shard append only log of writes that were not yet flushed to sstables
+  //
+  // files in the commitlog directory are named <generation>_<shard>_<number>
+  // where generation is increased on every start so that logs of previous
+  // runs (possibly with a different shard count) can be told apart from the
+  // ones that are currently being written
+  //
+  // file layout: header of uint32_t 0xFFFFFFFF marker and uint32_t version
+  // followed by frames of uint32_t payload size, uint32_t crc32c of the
+  // payload and the payload, a zero size marks the end of the written part
+  // (files are written in whole pages so the tail is zero padded)
+  //
+  // version 1 files (written before checksums were added) have no header
+  // and frames without the checksum
+  //
+  // payload: uint8_t type (0 delete, 1 value, 2 value file, 3 segment
+  //          flushed), varint segment number, varint key size, key, varint
+  //          value size, value (only for type 1) - type 3 has no key
+  //
+  // a segment flushed record is written when a segment moves to another
+  // shard, replay drops the earlier records of that segment from the same
+  // log as they were already flushed to sstables and newer writes are in the
+  // log of the new owner
+  class commitlog_t
+  {
+  public:
+    // generation that is greater than generations of all existing log files
+    static seastar::future<uint64_t> next_generation( std::filesystem::path directory );
+
+    // calls func for every record of generations older than the given one in
+    // the order in which they were written (per segment) except for records
+    // that were superseded by a segment flushed record and records of
+    // segments for which wanted returns false - records are streamed so
+    // every log file is read twice, once to find the segment flushed records
+    static seastar::future<> replay
+    (
+      std::filesystem::path directory,
+      uint64_t generation,
+      std::function< bool ( size_t segment_no ) > wanted,
+      std::function< void ( commitlog_record_t&& ) > func
+    );
+
+    // removes log files of generations older than the given one
+    static seastar::future<> remove_old_generations
+    (
+      std::filesystem::path directory,
+      uint64_t generation
+    );
+
+    static seastar::future<std::unique_ptr<commitlog_t>> make
+    (
+      std::filesystem::path directory,
+      uint64_t generation,
+      unsigned shard,
+      commitlog_options_t options
+    );
+
+    commitlog_t( commitlog_t const& ) = delete;
+    commitlog_t& operator=( commitlog_t const& ) = delete;
+
+    // buffers the record and returns the number of the log file that will
+    // contain it (the record may also end up in a later file)
+    uint64_t add
+    (
+      size_t segment_no,
+      std::string_view key,
+      std::optional<std::string_view> value
+    );
+    // records a value that was already made durable in its value file
+    uint64_t add_value_file( size_t segment_no, std::string_view key );
+    // records that all earlier writes of the segment were flushed
+    void add_segment_flushed( size_t segment_no );
+
+    // resolves once all records added so far are as durable as the sync mode
+    // promises
+    seastar::future<> wait_durable();
+
+    // writes and syncs all records added so far regardless of the sync mode
+    seastar::future<> sync();
+
+    uint64_t file_no() const { return file_no_; }
+
+    // removes log files with numbers lower than the given one - called once
+    // their content was flushed to sstables
+    seastar::future<> discard_before( uint64_t file_no );
+
+    // writes and syncs the remaining records and closes the log
+    seastar::future<> stop();
+
+  private:
+    commitlog_t
+    (
+      std::filesystem::path directory,
+      uint64_t generation,
+      unsigned shard,
+      commitlog_options_t options
+    );
+
+    std::filesystem::path file_path( uint64_t file_no ) const;
+    uint64_t append
+    (
+      uint8_t type,
+      size_t segment_no,
+      std::string_view key,
+      std::optional<std::string_view> value
+    );
+    seastar::future<> open_file();
+    // writes buffered records to the current file and rotates it if needed
+    seastar::future<> write( bool sync );
+    void on_timer();
+
+    std::filesystem::path directory_;
+    uint64_t generation_;
+    unsigned shard_;
+    commitlog_options_t options_;
+    seastar::file file_;
+    uint64_t file_no_ = 0;
+    uint64_t oldest_file_no_ = 0;
+    uint64_t file_offset_ = 0;
+    // content of the last partially written page of the current file
+    std::string tail_;
+    std::string buffer_;
+    // bytes that were ever added to the buffer and bytes that were synced
+    uint64_t added_ = 0;
+    uint64_t synced_ = 0;
+    // serializes writes and file rotation
+    seastar::semaphore write_lock_{ 1 };
+    seastar::timer<> timer_;
+    seastar::gate gate_;
+  };
+}
+
+#endif // COMMITLOG_HPP_INCLUDED
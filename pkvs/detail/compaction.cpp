@@ -0,0 +1,284 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "compaction.hpp"
+
+#include <seastar/core/coroutine.hh>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace pkvs;
+
+namespace
+{
+  // size tiered strategy
+  constexpr size_t size_tiered_min_threshold = 4;
+  constexpr size_t size_tiered_max_threshold = 32;
+  // sstables smaller than this are all considered to be of similar size
+  constexpr uint64_t size_tiered_min_size = 1024 * 1024;
+
+  // leveled strategy
+  constexpr size_t leveled_level0_runs = 4;
+  constexpr uint64_t leveled_base_size = 4 * 1024 * 1024;
+  constexpr uint64_t leveled_fanout = 10;
+
+  std::optional<compaction_plan_t> pick_size_tiered
+  (
+    std::span< seastar::lw_shared_ptr<sstable_t> const > sstables
+  )
+  {
+    // walk from newest to oldest and group adjacent sstables of similar size
+    // into buckets - [first, last)
+    for( size_t last = sstables.size(); last > 0; )
+    {
+      size_t first = last - 1;
+      uint64_t total = sstables[ first ]->data_size();
+
+      while( first > 0 && last - first < size_tiered_max_threshold )
+      {
+        uint64_t candidate = sstables[ first - 1 ]->data_size();
+        uint64_t average = total / ( last - first );
+        bool similar =
+          ( candidate <= size_tiered_min_size && average <= size_tiered_min_size ) ||
+          ( candidate * 2 >= average && candidate * 2 <= average * 3 );
+
+        if( similar == false )
+          break;
+
+        --first;
+        total += candidate;
+      }
+
+      if( last - first >= size_tiered_min_threshold )
+        return compaction_plan_t{ first, last - 1 };
+
+      last = first;
+    }
+
+    return std::nullopt;
+  }
+
+  size_t level_of( seastar::lw_shared_ptr<sstable_t> const& sstable )
+  {
+    size_t level = 0;
+
+    for
+    (
+      uint64_t capacity = leveled_base_size;
+      sstable->data_size() > capacity;
+      capacity *= leveled_fanout
+    )
+    {
+      ++level;
+    }
+
+    return level;
+  }
+
+  std::optional<compaction_plan_t> pick_leveled
+  (
+    std::span< seastar::lw_shared_ptr<sstable_t> const > sstables
+  )
+  {
+    // freshly flushed level 0 runs pile up until there's enough of them
+    size_t first = sstables.size();
+
+    while( first > 0 && level_of( sstables[ first - 1 ] ) == 0 )
+      --first;
+
+    if( sstables.size() - first >= leveled_level0_runs )
+      return compaction_plan_t{ first, sstables.size() - 1 };
+
+    // every other level holds a single run so a run that didn't end up at
+    // least a level below its older neighbour gets merged into it
+    for( size_t i = sstables.size(); i-- > 1; )
+    {
+      auto level = level_of( sstables[ i ] );
+
+      if( level > 0 && level_of( sstables[ i - 1 ] ) <= level )
+        return compaction_plan_t{ i - 1, i };
+    }
+
+    return std::nullopt;
+  }
+}
+
+std::optional<compaction_plan_t> pkvs::pick_compaction
+(
+  compaction_strategy_t strategy,
+  std::span< seastar::lw_shared_ptr<sstable_t> const > sstables
+)
+{
+  switch( strategy )
+  {
+  case compaction_strategy_t::size_tiered:
+    return pick_size_tiered( sstables );
+  case compaction_strategy_t::leveled:
+    return pick_leveled( sstables );
+  }
+
+  return std::nullopt;
+}
+
+compaction_t::compaction_t
+(
+  std::vector< seastar::lw_shared_ptr<sstable_t> >&& inputs,
+  std::vector<cursor_t>&& cursors,
+  sstable_writer_t&& writer,
+  bool drop_tombstones
+)
+  : inputs_{ std::move( inputs ) }
+  , cursors_{ std::move( cursors ) }
+  , writer_{ std::move( writer ) }
+  , drop_tombstones_{ drop_tombstones }
+{}
+
+seastar::future<compaction_t> compaction_t::make
+(
+  std::filesystem::path directory,
+  unsigned long output_id,
+  sstable_options_t options,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache,
+  std::vector< seastar::lw_shared_ptr<sstable_t> > inputs,
+  bool drop_tombstones
+)
+{
+  assert( inputs.empty() == false );
+
+  std::vector<cursor_t> cursors;
+
+  for( size_t i = 0; i < inputs.size(); ++i )
+    cursors.emplace_back( sstable_t::make_reader( inputs[ i ] ), std::nullopt, i );
+
+  // compacted data is read less often than freshly flushed data
+  options.compression = options.compaction_compression;
+
+  // merged sstable takes the place of the newest input in the age ordering
+  auto writer =
+    co_await sstable_writer_t::make
+    (
+      std::move( directory ),
+      output_id,
+      inputs.back()->order(),
+      options,
+      file_cache,
+      block_cache
+    );
+
+  co_return
+    compaction_t
+    {
+      std::move( inputs ),
+      std::move( cursors ),
+      std::move( writer ),
+      drop_tombstones
+    };
+}
+
+bool compaction_t::lower_priority( cursor_t const& a, cursor_t const& b )
+{
+  return
+    a.current->key > b.current->key ||
+    ( a.current->key == b.current->key && a.age < b.age );
+}
+
+uint64_t compaction_t::bytes_read() const
+{
+  uint64_t bytes = exhausted_bytes_read_;
+
+  for( auto const& cursor : cursors_ )
+    bytes += cursor.reader.bytes_read();
+
+  return bytes;
+}
+
+seastar::future<> compaction_t::advance_back()
+{
+  auto& cursor = cursors_.back();
+
+  cursor.current = co_await cursor.reader.next();
+
+  if( cursor.current != std::nullopt )
+    std::push_heap( cursors_.begin(), cursors_.end(), lower_priority );
+  else
+  {
+    exhausted_bytes_read_ += cursor.reader.bytes_read();
+    cursors_.pop_back();
+  }
+}
+
+seastar::future<bool> compaction_t::step( size_t io_budget )
+{
+  auto start = bytes_read();
+
+  if( primed_ == false )
+  {
+    primed_ = true;
+
+    auto pending = std::move( cursors_ );
+    cursors_.clear();
+
+    for( auto& cursor : pending )
+    {
+      cursor.current = co_await cursor.reader.next();
+
+      if( cursor.current != std::nullopt )
+        cursors_.push_back( std::move( cursor ) );
+      else
+        exhausted_bytes_read_ += cursor.reader.bytes_read();
+    }
+
+    std::make_heap( cursors_.begin(), cursors_.end(), lower_priority );
+  }
+
+  while( cursors_.empty() == false && bytes_read() - start < io_budget )
+  {
+    std::pop_heap( cursors_.begin(), cursors_.end(), lower_priority );
+
+    auto record = std::move( cursors_.back().current.value() );
+    bool shadows_value_file = false;
+
+    co_await advance_back();
+
+    // older versions of the same key are shadowed by the newest one
+    while( cursors_.empty() == false && cursors_.front().current->key == record.key )
+    {
+      std::pop_heap( cursors_.begin(), cursors_.end(), lower_priority );
+
+      shadows_value_file =
+        shadows_value_file ||
+        cursors_.back().current->type == sstable_entry_type_t::value;
+
+      co_await advance_back();
+    }
+
+    if( shadows_value_file && record.type != sstable_entry_type_t::value )
+      orphaned_value_keys_.push_back( record.key );
+
+    if( record.type != sstable_entry_type_t::tombstone || drop_tombstones_ == false )
+      co_await writer_.add( record.key, record.type, record.value );
+  }
+
+  co_return cursors_.empty();
+}
+
+seastar::future< seastar::lw_shared_ptr<sstable_t> > compaction_t::finish()
+{
+  if( writer_.records_count() == 0 )
+  {
+    co_await writer_.abort();
+
+    co_return nullptr;
+  }
+
+  co_return co_await writer_.finish();
+}
+
+seastar::future<> compaction_t::abort()
+{
+  return writer_.abort();
+}
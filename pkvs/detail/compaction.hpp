@@ -0,0 +1,101 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef COMPACTION_HPP_INCLUDED
+#define COMPACTION_HPP_INCLUDED
+
+#include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "sstable.hpp"
+
+namespace pkvs
+{
+  // range of sstables (indexes into oldest to newest ordered sstables) that
+  // should be merged - always contiguous so that the merged sstable can take
+  // their place in the age ordering
+  struct compaction_plan_t
+  {
+    size_t first;
+    size_t last; // inclusive
+  };
+
+  std::optional<compaction_plan_t> pick_compaction
+  (
+    compaction_strategy_t strategy,
+    std::span< seastar::lw_shared_ptr<sstable_t> const > sstables
+  );
+
+  // incremental k-way merge of sorted sstables into a single sstable
+  class compaction_t
+  {
+  public:
+    // drop_tombstones should only be set when inputs include the oldest
+    // sstable as there is nothing older that a tombstone would need to shadow
+    static seastar::future<compaction_t> make
+    (
+      std::filesystem::path directory,
+      unsigned long output_id,
+      sstable_options_t options,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache,
+      std::vector< seastar::lw_shared_ptr<sstable_t> > inputs,
+      bool drop_tombstones
+    );
+
+    // merges until io_budget bytes of input were read or until the inputs are
+    // exhausted in which case true is returned
+    seastar::future<bool> step( size_t io_budget );
+
+    // returns nullptr if nothing survived the merge
+    seastar::future< seastar::lw_shared_ptr<sstable_t> > finish();
+    seastar::future<> abort();
+
+    std::vector< seastar::lw_shared_ptr<sstable_t> > const& inputs() const { return inputs_; }
+    // keys whose newest version no longer uses a value file while a version
+    // that was merged away did
+    std::vector<std::string> const& orphaned_value_keys() const { return orphaned_value_keys_; }
+    uint64_t bytes_read() const;
+
+  private:
+    struct cursor_t
+    {
+      sstable_t::reader_t reader;
+      std::optional<sstable_record_t> current;
+      size_t age; // index in inputs - higher is newer
+    };
+
+    compaction_t
+    (
+      std::vector< seastar::lw_shared_ptr<sstable_t> >&& inputs,
+      std::vector<cursor_t>&& cursors,
+      sstable_writer_t&& writer,
+      bool drop_tombstones
+    );
+
+    // heap order - smallest key first and newest first for equal keys
+    static bool lower_priority( cursor_t const& a, cursor_t const& b );
+
+    // moves the cursor at the back of cursors_ to its next record
+    seastar::future<> advance_back();
+
+    std::vector< seastar::lw_shared_ptr<sstable_t> > inputs_;
+    // heap of cursors that still have records once primed
+    std::vector<cursor_t> cursors_;
+    bool primed_ = false;
+    sstable_writer_t writer_;
+    bool drop_tombstones_;
+    uint64_t exhausted_bytes_read_ = 0;
+    std::vector<std::string> orphaned_value_keys_;
+  };
+}
+
+#endif // COMPACTION_HPP_INCLUDED
@@ -0,0 +1,212 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "compression.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <vector>
+
+#if defined( PKVS_HAVE_LZ4 )
+#include <lz4.h>
+#endif
+
+#if defined( PKVS_HAVE_ZSTD )
+#include <zstd.h>
+#endif
+
+using namespace pkvs;
+
+namespace
+{
+#if defined( PKVS_HAVE_LZ4 )
+  // kept per thread so that compression doesn't put the lz4 state on the
+  // stack or allocate it for every block
+  void* lz4_state()
+  {
+    static thread_local std::vector<uint64_t> state(
+      ( LZ4_sizeofState() + sizeof( uint64_t ) - 1 ) / sizeof( uint64_t ) );
+
+    return state.data();
+  }
+#endif
+
+#if defined( PKVS_HAVE_ZSTD )
+  struct zstd_contexts_t
+  {
+    std::unique_ptr< ZSTD_CCtx, decltype( &ZSTD_freeCCtx ) > compression{ ZSTD_createCCtx(), &ZSTD_freeCCtx };
+    std::unique_ptr< ZSTD_DCtx, decltype( &ZSTD_freeDCtx ) > decompression{ ZSTD_createDCtx(), &ZSTD_freeDCtx };
+  };
+
+  zstd_contexts_t& zstd_contexts()
+  {
+    static thread_local zstd_contexts_t contexts;
+
+    return contexts;
+  }
+#endif
+}
+
+bool pkvs::compression_supported( compression_t codec )
+{
+  switch( codec )
+  {
+  case compression_t::none:
+    return true;
+  case compression_t::lz4:
+#if defined( PKVS_HAVE_LZ4 )
+    return true;
+#else
+    return false;
+#endif
+  case compression_t::zstd:
+#if defined( PKVS_HAVE_ZSTD )
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  return false;
+}
+
+std::string_view pkvs::compression_name( compression_t codec )
+{
+  switch( codec )
+  {
+  case compression_t::none:
+    return "none";
+  case compression_t::lz4:
+    return "lz4";
+  case compression_t::zstd:
+    return "zstd";
+  }
+
+  return "unknown";
+}
+
+std::optional<compression_t> pkvs::compression_from_name( std::string_view name )
+{
+  for( auto codec : { compression_t::none, compression_t::lz4, compression_t::zstd } )
+  {
+    if( compression_name( codec ) == name )
+      return codec;
+  }
+
+  return std::nullopt;
+}
+
+bool pkvs::compress( compression_t codec, std::string_view in, std::string& out )
+{
+  [[maybe_unused]] auto start = out.size();
+
+  switch( codec )
+  {
+  case compression_t::none:
+    out.append( in );
+
+    return true;
+  case compression_t::lz4:
+  {
+#if defined( PKVS_HAVE_LZ4 )
+    if( in.size() > LZ4_MAX_INPUT_SIZE )
+      return false;
+
+    out.resize( start + LZ4_compressBound( in.size() ) );
+
+    int size =
+      LZ4_compress_fast_extState(
+        lz4_state(),
+        in.data(),
+        out.data() + start,
+        in.size(),
+        out.size() - start,
+        1 );
+
+    out.resize( start + size );
+
+    return size > 0;
+#else
+    return false;
+#endif
+  }
+  case compression_t::zstd:
+  {
+#if defined( PKVS_HAVE_ZSTD )
+    out.resize( start + ZSTD_compressBound( in.size() ) );
+
+    size_t size =
+      ZSTD_compressCCtx(
+        zstd_contexts().compression.get(),
+        out.data() + start,
+        out.size() - start,
+        in.data(),
+        in.size(),
+        ZSTD_CLEVEL_DEFAULT );
+
+    if( ZSTD_isError( size ) )
+    {
+      out.resize( start );
+
+      return false;
+    }
+
+    out.resize( start + size );
+
+    return true;
+#else
+    return false;
+#endif
+  }
+  }
+
+  return false;
+}
+
+bool pkvs::decompress( compression_t codec, std::string_view in, std::span<char> out )
+{
+  switch( codec )
+  {
+  case compression_t::none:
+    if( in.size() != out.size() )
+      return false;
+
+    std::copy( in.begin(), in.end(), out.begin() );
+
+    return true;
+  case compression_t::lz4:
+  {
+#if defined( PKVS_HAVE_LZ4 )
+    if( in.size() > INT_MAX || out.size() > INT_MAX )
+      return false;
+
+    int size = LZ4_decompress_safe( in.data(), out.data(), in.size(), out.size() );
+
+    return size >= 0 && static_cast<size_t>( size ) == out.size();
+#else
+    return false;
+#endif
+  }
+  case compression_t::zstd:
+  {
+#if defined( PKVS_HAVE_ZSTD )
+    size_t size =
+      ZSTD_decompressDCtx(
+        zstd_contexts().decompression.get(),
+        out.data(),
+        out.size(),
+        in.data(),
+        in.size() );
+
+    return ZSTD_isError( size ) == false && size == out.size();
+#else
+    return false;
+#endif
+  }
+  }
+
+  return false;
+}
@@ -0,0 +1,57 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef COMPRESSION_HPP_INCLUDED
+#define COMPRESSION_HPP_INCLUDED
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace pkvs
+{
+  // codec of an sstable block, stored on disk so the values must not change
+  //
+  // lz4 and zstd are optional dependencies (PKVS_HAVE_LZ4 and
+  // PKVS_HAVE_ZSTD), sstables that use a codec which the build doesn't
+  // support can't be read
+  enum class compression_t : uint8_t
+  {
+    none,
+    // fast enough for every flush and read
+    lz4,
+    // better ratio at a higher cost, meant for compacted (colder) data
+    zstd
+  };
+
+  inline constexpr compression_t max_compression = compression_t::zstd;
+
+#if defined( PKVS_HAVE_LZ4 )
+  inline constexpr compression_t default_compression = compression_t::lz4;
+#else
+  inline constexpr compression_t default_compression = compression_t::none;
+#endif
+
+#if defined( PKVS_HAVE_ZSTD )
+  inline constexpr compression_t default_cold_compression = compression_t::zstd;
+#else
+  inline constexpr compression_t default_cold_compression = default_compression;
+#endif
+
+  bool compression_supported( compression_t codec );
+  std::string_view compression_name( compression_t codec );
+  std::optional<compression_t> compression_from_name( std::string_view name );
+
+  // appends the compressed input to out, returns false if the codec is not
+  // supported or failed
+  bool compress( compression_t codec, std::string_view in, std::string& out );
+  // out must have exactly the size of the uncompressed data, returns false
+  // if the codec is not supported or in doesn't decompress to that size
+  bool decompress( compression_t codec, std::string_view in, std::span<char> out );
+}
+
+#endif // COMPRESSION_HPP_INCLUDED
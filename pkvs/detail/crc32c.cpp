@@ -0,0 +1,81 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "crc32c.hpp"
+
+#if defined( __x86_64__ )
+#include <nmmintrin.h>
+#elif defined( __aarch64__ ) && defined( __ARM_FEATURE_CRC32 )
+#include <arm_acle.h>
+#endif
+
+using namespace pkvs;
+
+namespace
+{
+#if defined( __x86_64__ )
+  // eight bytes per instruction, the rest is done byte by byte
+  __attribute__(( target( "sse4.2" ) ))
+  uint32_t crc32c_hardware( std::string_view data, uint32_t crc )
+  {
+    uint64_t state = ~crc;
+    char const* position = data.data();
+    size_t remaining = data.size();
+
+    for( ; remaining >= sizeof( uint64_t ); remaining -= sizeof( uint64_t ), position += sizeof( uint64_t ) )
+    {
+      uint64_t word;
+
+      std::memcpy( &word, position, sizeof( word ) );
+      state = _mm_crc32_u64( state, word );
+    }
+
+    for( ; remaining > 0; --remaining, ++position )
+      state = _mm_crc32_u8( static_cast<uint32_t>( state ), static_cast<uint8_t>( *position ) );
+
+    return ~static_cast<uint32_t>( state );
+  }
+
+  bool const has_hardware_crc32c = __builtin_cpu_supports( "sse4.2" );
+#elif defined( __aarch64__ ) && defined( __ARM_FEATURE_CRC32 )
+  uint32_t crc32c_hardware( std::string_view data, uint32_t crc )
+  {
+    crc = ~crc;
+    char const* position = data.data();
+    size_t remaining = data.size();
+
+    for( ; remaining >= sizeof( uint64_t ); remaining -= sizeof( uint64_t ), position += sizeof( uint64_t ) )
+    {
+      uint64_t word;
+
+      std::memcpy( &word, position, sizeof( word ) );
+      crc = __crc32cd( crc, word );
+    }
+
+    for( ; remaining > 0; --remaining, ++position )
+      crc = __crc32cb( crc, static_cast<uint8_t>( *position ) );
+
+    return ~crc;
+  }
+
+  // the instructions are part of the target that the code was built for
+  bool const has_hardware_crc32c = true;
+#else
+  uint32_t crc32c_hardware( std::string_view data, uint32_t crc )
+  {
+    return crc32c_portable( data, crc );
+  }
+
+  bool const has_hardware_crc32c = false;
+#endif
+}
+
+uint32_t pkvs::crc32c( std::string_view data, uint32_t crc )
+{
+  if( has_hardware_crc32c )
+    return crc32c_hardware( data, crc );
+
+  return crc32c_portable( data, crc );
+}
@@ -0,0 +1,97 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef CRC32C_HPP_INCLUDED
+#define CRC32C_HPP_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace pkvs
+{
+  namespace detail
+  {
+    // reflected castagnoli polynomial
+    inline constexpr uint32_t crc32c_polynomial = 0x82F63B78;
+
+    constexpr std::array<uint32_t, 256> make_crc32c_table()
+    {
+      std::array<uint32_t, 256> table{};
+
+      for( uint32_t i = 0; i < 256; ++i )
+      {
+        uint32_t crc = i;
+
+        for( int bit = 0; bit < 8; ++bit )
+          crc = ( crc >> 1 ) ^ ( ( crc & 1 ) ? crc32c_polynomial : 0 );
+
+        table[ i ] = crc;
+      }
+
+      return table;
+    }
+
+    inline constexpr auto crc32c_table = make_crc32c_table();
+  }
+
+  // byte at a time crc32c, used where the cpu has no crc32 instructions and
+  // to check the implementation at compile time
+  constexpr uint32_t crc32c_portable( std::string_view data, uint32_t crc = 0 )
+  {
+    crc = ~crc;
+
+    for( unsigned char c : data )
+      crc = detail::crc32c_table[ ( crc ^ c ) & 0xff ] ^ ( crc >> 8 );
+
+    return ~crc;
+  }
+
+  static_assert( crc32c_portable( "" ) == 0 );
+  static_assert( crc32c_portable( "123456789" ) == 0xE3069283 );
+  static_assert( crc32c_portable( "56789", crc32c_portable( "1234" ) ) == 0xE3069283 );
+
+  // crc32c of data continuing from the crc of the data before it - uses the
+  // sse4.2 (x86-64) or crc (aarch64) instructions if the cpu has them
+  uint32_t crc32c( std::string_view data, uint32_t crc = 0 );
+
+  // checksums are stored as little endian uint32_t after the data that they
+  // cover
+  inline constexpr size_t crc32c_size = sizeof( uint32_t );
+
+  inline void append_crc32c( std::string& out, uint32_t crc )
+  {
+    out.append( reinterpret_cast<char const*>( &crc ), sizeof( crc ) );
+  }
+
+  // contract: in.size() >= crc32c_size
+  inline uint32_t read_crc32c( std::string_view in )
+  {
+    uint32_t crc;
+
+    std::memcpy( &crc, in.data() + in.size() - sizeof( crc ), sizeof( crc ) );
+
+    return crc;
+  }
+
+  // data without its trailing checksum or std::nullopt if they don't match
+  inline std::optional<std::string_view> strip_crc32c( std::string_view in )
+  {
+    if( in.size() < crc32c_size )
+      return std::nullopt;
+
+    auto data = in.substr( 0, in.size() - crc32c_size );
+
+    if( crc32c( data ) != read_crc32c( in ) )
+      return std::nullopt;
+
+    return data;
+  }
+}
+
+#endif // CRC32C_HPP_INCLUDED
@@ -0,0 +1,125 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "file_cache.hpp"
+
+#include <seastar/core/coroutine.hh>
+#include <seastar/core/seastar.hh>
+
+using namespace pkvs;
+
+file_cache_t::file_cache_t( size_t capacity )
+  : capacity_{ capacity }
+{}
+
+seastar::future< seastar::lw_shared_ptr<seastar::file> > file_cache_t::get
+(
+  std::filesystem::path const& path
+)
+{
+  if( auto found = entries_.find( path.native() ); found != entries_.end() )
+  {
+    ++stats_.hits;
+    lru_.splice( lru_.begin(), lru_, found->second );
+
+    co_return found->second->file;
+  }
+
+  ++stats_.misses;
+
+  auto evictions = evictions_;
+  auto file =
+    seastar::make_lw_shared< seastar::file >(
+      co_await seastar::open_file_dma( path.native(), seastar::open_flags::ro ) );
+
+  // a concurrent get could open the same file in the meantime
+  if( auto found = entries_.find( path.native() ); found != entries_.end() )
+  {
+    co_await file->close();
+
+    co_return found->second->file;
+  }
+
+  if( capacity_ == 0 || evictions != evictions_ )
+  {
+    evicted_.push_back( file );
+  }
+  else
+  {
+    lru_.push_front( entry_t{ path.native(), file } );
+    entries_.emplace( path.native(), lru_.begin() );
+
+    if( lru_.size() > capacity_ )
+    {
+      entries_.erase( lru_.back().path );
+      evicted_.push_back( std::move( lru_.back().file ) );
+      lru_.pop_back();
+    }
+  }
+
+  co_await close_unused();
+
+  co_return file;
+}
+
+seastar::future<> file_cache_t::evict( std::filesystem::path const& path )
+{
+  ++evictions_;
+
+  if( auto found = entries_.find( path.native() ); found != entries_.end() )
+  {
+    evicted_.push_back( std::move( found->second->file ) );
+    lru_.erase( found->second );
+    entries_.erase( found );
+  }
+
+  co_await close_unused();
+}
+
+seastar::future<> file_cache_t::evict_directory( std::filesystem::path const& directory )
+{
+  std::string prefix = ( directory / "" ).native();
+
+  ++evictions_;
+
+  for( auto it = lru_.begin(); it != lru_.end(); )
+  {
+    if( it->path.starts_with( prefix ) )
+    {
+      entries_.erase( it->path );
+      evicted_.push_back( std::move( it->file ) );
+      it = lru_.erase( it );
+    }
+    else
+      ++it;
+  }
+
+  co_await close_unused();
+}
+
+seastar::future<> file_cache_t::close_unused()
+{
+  auto evicted = std::move( evicted_ );
+  evicted_.clear();
+
+  for( auto& current : evicted )
+  {
+    if( current.use_count() == 1 )
+      co_await current->close();
+    else
+      evicted_.push_back( std::move( current ) );
+  }
+}
+
+seastar::future<> file_cache_t::stop()
+{
+  for( auto& entry : lru_ )
+    evicted_.push_back( std::move( entry.file ) );
+
+  lru_.clear();
+  entries_.clear();
+
+  co_await close_unused();
+}
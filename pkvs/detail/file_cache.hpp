@@ -0,0 +1,76 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef FILE_CACHE_HPP_INCLUDED
+#define FILE_CACHE_HPP_INCLUDED
+
+#include <seastar/core/file.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pkvs
+{
+  struct file_cache_stats_t
+  {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  // shard local cache of read only file handles with least recently used
+  // eviction
+  //
+  // evicted handles are closed once the reads that still use them complete
+  class file_cache_t
+  {
+  public:
+    explicit file_cache_t( size_t capacity );
+
+    file_cache_t( file_cache_t const& ) = delete;
+    file_cache_t& operator=( file_cache_t const& ) = delete;
+
+    // a handle that was opened while the cache evicted files is only used by
+    // the caller and closed afterwards as it can belong to the replaced file
+    seastar::future< seastar::lw_shared_ptr<seastar::file> > get( std::filesystem::path const& path );
+
+    // drops the handle of a file that is about to be removed or replaced
+    seastar::future<> evict( std::filesystem::path const& path );
+    // drops handles of all files under the directory
+    seastar::future<> evict_directory( std::filesystem::path const& directory );
+
+    seastar::future<> stop();
+
+    file_cache_stats_t const& stats() const { return stats_; }
+    size_t open_files() const { return entries_.size() + evicted_.size(); }
+
+  private:
+    struct entry_t
+    {
+      std::string path;
+      seastar::lw_shared_ptr<seastar::file> file;
+    };
+
+    // closes evicted handles that are no longer used by any read
+    seastar::future<> close_unused();
+
+    size_t capacity_;
+    file_cache_stats_t stats_;
+    // changes with every eviction so that a handle which was opened while
+    // its file was replaced or removed isn't cached
+    uint64_t evictions_ = 0;
+    // most recently used first
+    std::list<entry_t> lru_;
+    std::unordered_map< std::string, std::list<entry_t>::iterator > entries_;
+    std::vector< seastar::lw_shared_ptr<seastar::file> > evicted_;
+  };
+}
+
+#endif // FILE_CACHE_HPP_INCLUDED
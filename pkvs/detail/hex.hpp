@@ -0,0 +1,55 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef HEX_HPP_INCLUDED
+#define HEX_HPP_INCLUDED
+
+#include <charconv>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace pkvs
+{
+  // used for cursors as keys can contain any byte
+  inline std::string to_hex( std::string_view data )
+  {
+    constexpr char digits[] = "0123456789abcdef";
+    std::string result;
+
+    result.reserve( data.size() * 2 );
+
+    for( unsigned char c : data )
+    {
+      result += digits[ c >> 4 ];
+      result += digits[ c & 0xf ];
+    }
+
+    return result;
+  }
+
+  inline std::optional<std::string> from_hex( std::string_view data )
+  {
+    if( data.size() % 2 != 0 )
+      return std::nullopt;
+
+    std::string result( data.size() / 2, '\0' );
+
+    for( size_t i = 0; i < result.size(); ++i )
+    {
+      unsigned value = 0;
+      auto [ end, error ] = std::from_chars( data.data() + i * 2, data.data() + i * 2 + 2, value, 16 );
+
+      if( error != std::errc{} || end != data.data() + i * 2 + 2 )
+        return std::nullopt;
+
+      result[ i ] = static_cast<char>( value );
+    }
+
+    return result;
+  }
+}
+
+#endif // HEX_HPP_INCLUDED
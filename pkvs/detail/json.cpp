@@ -0,0 +1,487 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "json.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+using namespace pkvs;
+
+namespace
+{
+  // bytes that can be copied as they are both when reading and writing json
+  // strings - printable ascii except for quote and backslash
+  constexpr auto plain_bytes =
+    []
+    {
+      std::array<bool, 256> table{};
+
+      for( size_t c = 0x20; c < 0x80; ++c )
+        table[ c ] = c != '"' && c != '\\';
+
+      return table;
+    }();
+
+  // end of the run of plain bytes starting at pos, eight bytes are checked at
+  // a time while possible
+  size_t plain_run_end( unsigned char const* data, size_t pos, size_t size )
+  {
+    constexpr uint64_t ones = 0x0101010101010101ull;
+    constexpr uint64_t high_bits = 0x8080808080808080ull;
+
+    auto has_zero_byte =
+      []( uint64_t word )
+      {
+        return ( word - ones ) & ~word & high_bits;
+      };
+
+    while( size - pos >= sizeof( uint64_t ) )
+    {
+      uint64_t word;
+      std::memcpy( &word, data + pos, sizeof( word ) );
+
+      uint64_t special =
+        ( word & high_bits ) | // non ascii
+        ( ( word - ones * 0x20 ) & ~word & high_bits ) | // control characters
+        has_zero_byte( word ^ ( ones * '"' ) ) |
+        has_zero_byte( word ^ ( ones * '\\' ) );
+
+      if( special != 0 )
+        break;
+
+      pos += sizeof( word );
+    }
+
+    while( pos < size && plain_bytes[ data[ pos ] ] )
+      ++pos;
+
+    return pos;
+  }
+
+  constexpr std::string_view replacement_character = "\xEF\xBF\xBD";
+
+  // length of the valid utf-8 sequence at the front of data or 0 if it is
+  // invalid (overlong encodings, surrogates and code points above U+10FFFF
+  // are rejected)
+  size_t utf8_sequence_length( unsigned char const* data, size_t available )
+  {
+    auto continuation =
+      [ & ]( size_t i )
+      {
+        return i < available && ( data[ i ] & 0xC0 ) == 0x80;
+      };
+
+    unsigned char lead = data[ 0 ];
+
+    if( lead < 0x80 )
+      return 1;
+    else if( lead >= 0xC2 && lead <= 0xDF )
+      return continuation( 1 ) ? 2 : 0;
+    else if( lead >= 0xE0 && lead <= 0xEF )
+    {
+      if( continuation( 1 ) == false || continuation( 2 ) == false )
+        return 0;
+      else if( lead == 0xE0 && data[ 1 ] < 0xA0 ) // overlong
+        return 0;
+      else if( lead == 0xED && data[ 1 ] >= 0xA0 ) // surrogates
+        return 0;
+
+      return 3;
+    }
+    else if( lead >= 0xF0 && lead <= 0xF4 )
+    {
+      if( continuation( 1 ) == false || continuation( 2 ) == false || continuation( 3 ) == false )
+        return 0;
+      else if( lead == 0xF0 && data[ 1 ] < 0x90 ) // overlong
+        return 0;
+      else if( lead == 0xF4 && data[ 1 ] >= 0x90 ) // above U+10FFFF
+        return 0;
+
+      return 4;
+    }
+
+    return 0;
+  }
+
+  size_t encode_utf8( uint32_t code_point, char* out )
+  {
+    if( code_point < 0x80 )
+    {
+      out[ 0 ] = static_cast<char>( code_point );
+
+      return 1;
+    }
+    else if( code_point < 0x800 )
+    {
+      out[ 0 ] = static_cast<char>( 0xC0 | ( code_point >> 6 ) );
+      out[ 1 ] = static_cast<char>( 0x80 | ( code_point & 0x3F ) );
+
+      return 2;
+    }
+    else if( code_point < 0x10000 )
+    {
+      out[ 0 ] = static_cast<char>( 0xE0 | ( code_point >> 12 ) );
+      out[ 1 ] = static_cast<char>( 0x80 | ( ( code_point >> 6 ) & 0x3F ) );
+      out[ 2 ] = static_cast<char>( 0x80 | ( code_point & 0x3F ) );
+
+      return 3;
+    }
+
+    out[ 0 ] = static_cast<char>( 0xF0 | ( code_point >> 18 ) );
+    out[ 1 ] = static_cast<char>( 0x80 | ( ( code_point >> 12 ) & 0x3F ) );
+    out[ 2 ] = static_cast<char>( 0x80 | ( ( code_point >> 6 ) & 0x3F ) );
+    out[ 3 ] = static_cast<char>( 0x80 | ( code_point & 0x3F ) );
+
+    return 4;
+  }
+
+  class parser_t
+  {
+  public:
+    explicit parser_t( std::span<char> input )
+      : data_{ input.data() }
+      , size_{ input.size() }
+    {}
+
+    void skip_whitespace()
+    {
+      while
+      (
+        pos_ < size_ &&
+        ( data_[ pos_ ] == ' ' || data_[ pos_ ] == '\t' || data_[ pos_ ] == '\n' || data_[ pos_ ] == '\r' )
+      )
+      {
+        ++pos_;
+      }
+    }
+
+    bool consume( char c )
+    {
+      skip_whitespace();
+
+      if( pos_ == size_ || data_[ pos_ ] != c )
+        return false;
+
+      ++pos_;
+
+      return true;
+    }
+
+    bool at_end()
+    {
+      skip_whitespace();
+
+      return pos_ == size_;
+    }
+
+    // unescapes the string in place, the result is written over the escaped
+    // string starting at its first character
+    bool string( std::string_view& out )
+    {
+      if( consume( '"' ) == false )
+        return false;
+
+      size_t write = pos_;
+      size_t start = pos_;
+
+      while( pos_ < size_ )
+      {
+        size_t run = plain_run_end( reinterpret_cast<unsigned char const*>( data_ ), pos_, size_ );
+
+        // nothing has to be moved until the first escape sequence
+        if( write != pos_ )
+          std::memmove( data_ + write, data_ + pos_, run - pos_ );
+
+        write += run - pos_;
+        pos_ = run;
+
+        if( pos_ == size_ )
+          break;
+
+        auto c = static_cast<unsigned char>( data_[ pos_ ] );
+
+        if( c == '"' )
+        {
+          out = { data_ + start, write - start };
+          ++pos_;
+
+          return true;
+        }
+        else if( c == '\\' )
+        {
+          if( escape( write ) == false )
+            return false;
+
+          continue;
+        }
+        else if( c < 0x20 )
+          return false;
+
+        auto length =
+          utf8_sequence_length( reinterpret_cast<unsigned char const*>( data_ + pos_ ), size_ - pos_ );
+
+        if( length == 0 )
+          return false;
+
+        for( size_t i = 0; i < length; ++i )
+          data_[ write++ ] = data_[ pos_++ ];
+      }
+
+      return false;
+    }
+
+  private:
+    bool hex4( uint32_t& value )
+    {
+      if( size_ - pos_ < 4 )
+        return false;
+
+      value = 0;
+
+      for( size_t i = 0; i < 4; ++i )
+      {
+        char c = data_[ pos_++ ];
+
+        value <<= 4;
+
+        if( c >= '0' && c <= '9' )
+          value |= c - '0';
+        else if( c >= 'a' && c <= 'f' )
+          value |= c - 'a' + 10;
+        else if( c >= 'A' && c <= 'F' )
+          value |= c - 'A' + 10;
+        else
+          return false;
+      }
+
+      return true;
+    }
+
+    bool escape( size_t& write )
+    {
+      if( size_ - pos_ < 2 )
+        return false;
+
+      char c = data_[ pos_ + 1 ];
+      pos_ += 2;
+
+      switch( c )
+      {
+      case '"': data_[ write++ ] = '"'; return true;
+      case '\\': data_[ write++ ] = '\\'; return true;
+      case '/': data_[ write++ ] = '/'; return true;
+      case 'b': data_[ write++ ] = '\b'; return true;
+      case 'f': data_[ write++ ] = '\f'; return true;
+      case 'n': data_[ write++ ] = '\n'; return true;
+      case 'r': data_[ write++ ] = '\r'; return true;
+      case 't': data_[ write++ ] = '\t'; return true;
+      case 'u': break;
+      default: return false;
+      }
+
+      uint32_t code_point;
+
+      if( hex4( code_point ) == false || ( code_point >= 0xDC00 && code_point <= 0xDFFF ) )
+        return false;
+
+      if( code_point >= 0xD800 && code_point <= 0xDBFF )
+      {
+        uint32_t low;
+
+        if
+        (
+          size_ - pos_ < 2 ||
+          data_[ pos_ ] != '\\' ||
+          data_[ pos_ + 1 ] != 'u' ||
+          ( pos_ += 2, hex4( low ) ) == false ||
+          low < 0xDC00 ||
+          low > 0xDFFF
+        )
+        {
+          return false;
+        }
+
+        code_point = 0x10000 + ( ( code_point - 0xD800 ) << 10 ) + ( low - 0xDC00 );
+      }
+
+      // at least 6 escaped bytes were consumed and at most 4 are written
+      write += encode_utf8( code_point, data_ + write );
+
+      return true;
+    }
+
+    char* data_;
+    size_t size_;
+    size_t pos_ = 0;
+  };
+}
+
+std::optional<json::parse_error_t> json::parse_object
+(
+  std::span<char> input,
+  std::span<std::string_view const> names,
+  std::span<std::string_view> values
+)
+{
+  // at most a handful of fields are expected
+  constexpr size_t max_fields = 8;
+
+  if( names.size() > max_fields || values.size() != names.size() )
+    return parse_error_t::syntax;
+
+  std::array<bool, max_fields> found{};
+  parser_t parser{ input };
+
+  if( parser.consume( '{' ) == false )
+    return parse_error_t::syntax;
+
+  if( parser.consume( '}' ) == false )
+  {
+    do
+    {
+      std::string_view name;
+      std::string_view value;
+
+      if( parser.string( name ) == false || parser.consume( ':' ) == false || parser.string( value ) == false )
+        return parse_error_t::syntax;
+
+      size_t i = 0;
+
+      while( i < names.size() && names[ i ] != name )
+        ++i;
+
+      if( i == names.size() )
+        return parse_error_t::unknown_field;
+      else if( found[ i ] )
+        return parse_error_t::duplicate_field;
+
+      found[ i ] = true;
+      values[ i ] = value;
+    }
+    while( parser.consume( ',' ) );
+
+    if( parser.consume( '}' ) == false )
+      return parse_error_t::syntax;
+  }
+
+  if( parser.at_end() == false )
+    return parse_error_t::syntax;
+
+  for( size_t i = 0; i < names.size(); ++i )
+  {
+    if( found[ i ] == false )
+      return parse_error_t::missing_field;
+  }
+
+  return std::nullopt;
+}
+
+size_t json::quoted_size( std::string_view value )
+{
+  auto const* data = reinterpret_cast<unsigned char const*>( value.data() );
+  size_t size = 2;
+  size_t pos = 0;
+
+  while( pos < value.size() )
+  {
+    size_t run = plain_run_end( data, pos, value.size() );
+
+    size += run - pos;
+    pos = run;
+
+    if( pos == value.size() )
+      break;
+
+    unsigned char c = data[ pos ];
+
+    if( c == '"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t' )
+    {
+      size += 2;
+      ++pos;
+    }
+    else if( c < 0x20 )
+    {
+      size += 6;
+      ++pos;
+    }
+    else if( auto length = utf8_sequence_length( data + pos, value.size() - pos ); length != 0 )
+    {
+      size += length;
+      pos += length;
+    }
+    else
+    {
+      size += replacement_character.size();
+      ++pos;
+    }
+  }
+
+  return size;
+}
+
+void json::write_quoted( char* out, std::string_view value )
+{
+  constexpr char digits[] = "0123456789abcdef";
+
+  auto const* data = reinterpret_cast<unsigned char const*>( value.data() );
+  size_t size = value.size();
+  size_t pos = 0;
+
+  auto put =
+    [ & ]( std::string_view part )
+    {
+      out = std::copy( part.begin(), part.end(), out );
+    };
+
+  *out++ = '"';
+
+  while( pos < size )
+  {
+    // runs of bytes that need no escaping are copied at once
+    size_t run = plain_run_end( data, pos, size );
+
+    put( value.substr( pos, run - pos ) );
+    pos = run;
+
+    if( pos == size )
+      break;
+
+    unsigned char c = data[ pos ];
+
+    switch( c )
+    {
+    case '"': put( "\\\"" ); break;
+    case '\\': put( "\\\\" ); break;
+    case '\b': put( "\\b" ); break;
+    case '\f': put( "\\f" ); break;
+    case '\n': put( "\\n" ); break;
+    case '\r': put( "\\r" ); break;
+    case '\t': put( "\\t" ); break;
+    default:
+      if( c < 0x20 )
+      {
+        put( "\\u00" );
+        *out++ = digits[ c >> 4 ];
+        *out++ = digits[ c & 0xf ];
+      }
+      else if( auto length = utf8_sequence_length( data + pos, size - pos ); length != 0 )
+      {
+        put( value.substr( pos, length ) );
+        pos += length;
+
+        continue;
+      }
+      else
+        put( replacement_character );
+    }
+
+    ++pos;
+  }
+
+  *out = '"';
+}
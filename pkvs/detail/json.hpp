@@ -0,0 +1,69 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef JSON_HPP_INCLUDED
+#define JSON_HPP_INCLUDED
+
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+// minimal json support for the request path - requests are flat objects with
+// string values and replies only need escaped strings so a general purpose
+// document model is not needed
+namespace pkvs::json
+{
+  enum class parse_error_t
+  {
+    syntax, // also invalid utf-8 and values that are not strings
+    unknown_field,
+    missing_field,
+    duplicate_field
+  };
+
+  // single pass parser of {"name":"value",...} objects
+  //
+  // every name of the object has to be in names and every name in names has
+  // to be present, values receives views of the values in the same order as
+  // names
+  //
+  // strings are unescaped in place (unescaped strings are never longer than
+  // escaped ones) so the views point into input and no memory is allocated
+  std::optional<parse_error_t> parse_object
+  (
+    std::span<char> input,
+    std::span<std::string_view const> names,
+    std::span<std::string_view> values
+  );
+
+  // size of value as a quoted json string, invalid utf-8 sequences are
+  // replaced with U+FFFD so that the output is always valid json
+  size_t quoted_size( std::string_view value );
+
+  // writes exactly quoted_size( value ) bytes to out
+  void write_quoted( char* out, std::string_view value );
+
+  // appends value as a quoted json string directly into the reply buffer,
+  // string_t is std::string or seastar::sstring
+  template< typename string_t >
+  void append_string( string_t& out, std::string_view value )
+  {
+    size_t offset = out.size();
+
+    out.resize( offset + quoted_size( value ) );
+    write_quoted( out.data() + offset, value );
+  }
+
+  inline std::string to_string( std::string_view value )
+  {
+    std::string out;
+    append_string( out, value );
+
+    return out;
+  }
+}
+
+#endif // JSON_HPP_INCLUDED
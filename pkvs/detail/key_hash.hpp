@@ -0,0 +1,144 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef KEY_HASH_HPP_INCLUDED
+#define KEY_HASH_HPP_INCLUDED
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+namespace pkvs
+{
+  // hash that decides in which segment and value file a key is stored, it is
+  // chosen when the store is created as changing it would orphan the data
+  enum class key_hash_t
+  {
+    // std::hash of the standard library that wrote the store - not stable
+    // across standard libraries or their versions, only kept for stores that
+    // were created before the hash was recorded
+    std_hash,
+    xxh64
+  };
+
+  namespace detail
+  {
+    inline constexpr uint64_t xxh64_prime_1 = 0x9E3779B185EBCA87ull;
+    inline constexpr uint64_t xxh64_prime_2 = 0xC2B2AE3D27D4EB4Full;
+    inline constexpr uint64_t xxh64_prime_3 = 0x165667B19E3779F9ull;
+    inline constexpr uint64_t xxh64_prime_4 = 0x85EBCA77C2B2AE63ull;
+    inline constexpr uint64_t xxh64_prime_5 = 0x27D4EB2F165667C5ull;
+
+    constexpr uint64_t rotate_left( uint64_t value, int bits )
+    {
+      return ( value << bits ) | ( value >> ( 64 - bits ) );
+    }
+
+    // little endian independently of the platform, compilers turn it into a
+    // single load
+    template< typename result_t >
+    constexpr result_t read_le( char const* data )
+    {
+      result_t result = 0;
+
+      for( size_t i = 0; i < sizeof( result_t ); ++i )
+        result |= result_t{ static_cast<unsigned char>( data[ i ] ) } << ( i * 8 );
+
+      return result;
+    }
+
+    constexpr uint64_t xxh64_round( uint64_t accumulator, uint64_t input )
+    {
+      accumulator += input * xxh64_prime_2;
+      accumulator = rotate_left( accumulator, 31 );
+
+      return accumulator * xxh64_prime_1;
+    }
+
+    constexpr uint64_t xxh64_merge_round( uint64_t accumulator, uint64_t value )
+    {
+      accumulator ^= xxh64_round( 0, value );
+
+      return accumulator * xxh64_prime_1 + xxh64_prime_4;
+    }
+  }
+
+  // XXH64 as specified by the xxHash project
+  constexpr uint64_t xxh64( std::string_view data, uint64_t seed = 0 )
+  {
+    using namespace detail;
+
+    char const* in = data.data();
+    char const* end = in + data.size();
+    uint64_t hash;
+
+    if( data.size() >= 32 )
+    {
+      uint64_t v1 = seed + xxh64_prime_1 + xxh64_prime_2;
+      uint64_t v2 = seed + xxh64_prime_2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - xxh64_prime_1;
+
+      for( ; end - in >= 32; in += 32 )
+      {
+        v1 = xxh64_round( v1, read_le<uint64_t>( in ) );
+        v2 = xxh64_round( v2, read_le<uint64_t>( in + 8 ) );
+        v3 = xxh64_round( v3, read_le<uint64_t>( in + 16 ) );
+        v4 = xxh64_round( v4, read_le<uint64_t>( in + 24 ) );
+      }
+
+      hash = rotate_left( v1, 1 ) + rotate_left( v2, 7 ) + rotate_left( v3, 12 ) + rotate_left( v4, 18 );
+      hash = xxh64_merge_round( hash, v1 );
+      hash = xxh64_merge_round( hash, v2 );
+      hash = xxh64_merge_round( hash, v3 );
+      hash = xxh64_merge_round( hash, v4 );
+    }
+    else
+      hash = seed + xxh64_prime_5;
+
+    hash += data.size();
+
+    for( ; end - in >= 8; in += 8 )
+    {
+      hash ^= xxh64_round( 0, read_le<uint64_t>( in ) );
+      hash = rotate_left( hash, 27 ) * xxh64_prime_1 + xxh64_prime_4;
+    }
+
+    if( end - in >= 4 )
+    {
+      hash ^= read_le<uint32_t>( in ) * xxh64_prime_1;
+      hash = rotate_left( hash, 23 ) * xxh64_prime_2 + xxh64_prime_3;
+      in += 4;
+    }
+
+    for( ; in != end; ++in )
+    {
+      hash ^= static_cast<unsigned char>( *in ) * xxh64_prime_5;
+      hash = rotate_left( hash, 11 ) * xxh64_prime_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= xxh64_prime_2;
+    hash ^= hash >> 29;
+    hash *= xxh64_prime_3;
+    hash ^= hash >> 32;
+
+    return hash;
+  }
+
+  // reference values of the xxHash project
+  static_assert( xxh64( "" ) == 0xEF46DB3751D8E999ull );
+  static_assert( xxh64( "abc" ) == 0x44BC2CF5AD770999ull );
+
+  inline uint64_t hash_key( key_hash_t algorithm, std::string_view key )
+  {
+    if( algorithm == key_hash_t::std_hash )
+      return std::hash<std::string_view>{}( key );
+
+    return xxh64( key );
+  }
+}
+
+#endif // KEY_HASH_HPP_INCLUDED
@@ -0,0 +1,238 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "memtable.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <utility>
+
+using namespace pkvs;
+
+void* arena_t::allocate( size_t size, size_t alignment )
+{
+  size_t padding =
+    position_ == nullptr ?
+      0 :
+      ( alignment - reinterpret_cast<uintptr_t>( position_ ) % alignment ) % alignment;
+
+  if( remaining_ < padding + size )
+  {
+    // large allocations get a chunk of their own so that the rest of the
+    // current chunk isn't wasted
+    size_t new_chunk_size = std::max( next_chunk_size_, size + alignment );
+
+    chunks_.push_back( std::make_unique_for_overwrite<std::byte[]>( new_chunk_size ) );
+    memory_footprint_ += new_chunk_size;
+
+    if( new_chunk_size > next_chunk_size_ )
+    {
+      auto* chunk = chunks_.back().get();
+      size_t chunk_padding =
+        ( alignment - reinterpret_cast<uintptr_t>( chunk ) % alignment ) % alignment;
+
+      return chunk + chunk_padding;
+    }
+
+    position_ = chunks_.back().get();
+    remaining_ = new_chunk_size;
+    next_chunk_size_ = std::min( next_chunk_size_ * 2, chunk_size );
+    padding = ( alignment - reinterpret_cast<uintptr_t>( position_ ) % alignment ) % alignment;
+  }
+
+  auto* result = position_ + padding;
+
+  position_ += padding + size;
+  remaining_ -= padding + size;
+
+  return result;
+}
+
+struct memtable_t::node_t
+{
+  entry_t entry;
+  size_t height;
+  // height elements are allocated together with the node
+  node_t* next[ 1 ];
+
+  static node_t* make( arena_t& arena, size_t height )
+  {
+    void* memory =
+      arena.allocate(
+        sizeof( node_t ) + ( height - 1 ) * sizeof( node_t* ),
+        alignof( node_t ) );
+    auto* node = new( memory ) node_t{};
+
+    node->height = height;
+    std::fill_n( node->next, height, nullptr );
+
+    return node;
+  }
+};
+
+memtable_t::entry_t& memtable_t::iterator::operator*() const
+{
+  return node_->entry;
+}
+
+memtable_t::iterator& memtable_t::iterator::operator++()
+{
+  node_ = node_->next[ 0 ];
+
+  return *this;
+}
+
+memtable_t::memtable_t()
+  : head_{ node_t::make( arena_, max_height ) }
+{}
+
+memtable_t::memtable_t( memtable_t&& other ) noexcept
+  : arena_{ std::move( other.arena_ ) }
+  , head_{ std::exchange( other.head_, nullptr ) }
+  , height_{ other.height_ }
+  , size_{ std::exchange( other.size_, 0 ) }
+  , random_state_{ other.random_state_ }
+{}
+
+memtable_t& memtable_t::operator=( memtable_t&& other ) noexcept
+{
+  arena_ = std::move( other.arena_ );
+  head_ = std::exchange( other.head_, nullptr );
+  height_ = other.height_;
+  size_ = std::exchange( other.size_, 0 );
+  random_state_ = other.random_state_;
+
+  return *this;
+}
+
+memtable_t::node_t* memtable_t::find_greater_or_equal
+(
+  std::string_view key,
+  node_t** update
+) const
+{
+  node_t* current = head_;
+
+  for( size_t level = height_; level-- > 0; )
+  {
+    while( current->next[ level ] != nullptr && current->next[ level ]->entry.key() < key )
+      current = current->next[ level ];
+
+    if( update != nullptr )
+      update[ level ] = current;
+  }
+
+  return current->next[ 0 ];
+}
+
+memtable_t::entry_t* memtable_t::find( std::string_view key )
+{
+  auto* node = find_greater_or_equal( key, nullptr );
+
+  return node != nullptr && node->entry.key() == key ? &node->entry : nullptr;
+}
+
+memtable_t::entry_t const* memtable_t::find( std::string_view key ) const
+{
+  return const_cast< memtable_t* >( this )->find( key );
+}
+
+memtable_t::iterator memtable_t::begin() const
+{
+  return iterator{ head_->next[ 0 ] };
+}
+
+memtable_t::iterator memtable_t::lower_bound( std::string_view key ) const
+{
+  return iterator{ find_greater_or_equal( key, nullptr ) };
+}
+
+memtable_t::entry_t& memtable_t::put( std::string_view key, std::string_view content )
+{
+  return upsert( key, content, entry_type_t::value );
+}
+
+memtable_t::entry_t& memtable_t::put_tombstone( std::string_view key )
+{
+  return upsert( key, {}, entry_type_t::tombstone );
+}
+
+memtable_t::entry_t& memtable_t::put_pointer( std::string_view key )
+{
+  return upsert( key, {}, entry_type_t::pointer );
+}
+
+memtable_t::entry_t& memtable_t::upsert
+(
+  std::string_view key,
+  std::string_view content,
+  entry_type_t type
+)
+{
+  node_t* update[ max_height ];
+  auto* node = find_greater_or_equal( key, update );
+
+  if( node == nullptr || node->entry.key() != key )
+  {
+    size_t height = random_height();
+
+    for( ; height_ < height; ++height_ )
+      update[ height_ ] = head_;
+
+    node = node_t::make( arena_, height );
+
+    auto* key_copy = static_cast<char*>( arena_.allocate( key.size(), 1 ) );
+    std::memcpy( key_copy, key.data(), key.size() );
+    node->entry.key_ = key_copy;
+    node->entry.key_size_ = key.size();
+
+    for( size_t level = 0; level < height; ++level )
+    {
+      node->next[ level ] = update[ level ]->next[ level ];
+      update[ level ]->next[ level ] = node;
+    }
+
+    ++size_;
+  }
+
+  auto& entry = node->entry;
+
+  // space of the old value is reused if possible and left to the arena
+  // otherwise
+  if( content.size() > entry.content_capacity_ )
+  {
+    entry.content_ = static_cast<char*>( arena_.allocate( content.size(), 1 ) );
+    entry.content_capacity_ = content.size();
+  }
+
+  if( content.empty() == false )
+    std::memcpy( entry.content_, content.data(), content.size() );
+
+  entry.content_size_ = content.size();
+  entry.type_ = type;
+
+  return entry;
+}
+
+size_t memtable_t::random_height()
+{
+  // xorshift64 - each level is reached with a probability of 1/4
+  random_state_ ^= random_state_ << 13;
+  random_state_ ^= random_state_ >> 7;
+  random_state_ ^= random_state_ << 17;
+
+  size_t height = 1;
+  uint64_t bits = random_state_;
+
+  while( height < max_height && ( bits & 3 ) == 0 )
+  {
+    ++height;
+    bits >>= 2;
+  }
+
+  return height;
+}
@@ -6,90 +6,144 @@
 #ifndef MEMTABLE_HPP_INCLUDED
 #define MEMTABLE_HPP_INCLUDED
 
-#include <boost/multi_index_container.hpp>
-#include <boost/multi_index/ordered_index.hpp>
-#include <boost/multi_index/identity.hpp>
-#include <boost/multi_index/member.hpp>
-
-#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <vector>
 
 namespace pkvs
 {
-  using time_point_t = std::chrono::time_point< std::chrono::steady_clock >;
-
-  enum class entry_type_t
+  enum class entry_type_t : uint8_t
   {
     tombstone,
     value,
-    pointer // TODO implement (key is in memory but value has to be loaded from external storage)
+    pointer // key is in memory but the value is in its value file
   };
 
-  struct entry_t
+  // bump allocator - memory is only released all at once when the arena is
+  // destroyed
+  class arena_t
   {
-    std::string key;
-    std::string content;
-    entry_type_t type;
-    bool dirty;
-    time_point_t last_accessed;
-
-    entry_t( std::string_view in_key, std::string_view in_content, bool in_dirty )
-      : key{ in_key }
-      , content{ in_content }
-      , type{ entry_type_t::value }
-      , dirty{ in_dirty }
-      , last_accessed{ std::chrono::steady_clock::now() }
-    {}
-
-    explicit entry_t( std::string_view in_key )
-      : key{ in_key }
-      , type{ entry_type_t::tombstone }
-      , dirty{ true }
-      , last_accessed{ std::chrono::steady_clock::now() }
-    {}
-
-    static entry_t make_tombstone( std::string_view key )
+  public:
+    arena_t() = default;
+    arena_t( arena_t&& ) noexcept = default;
+    arena_t& operator=( arena_t&& ) noexcept = default;
+
+    void* allocate( size_t size, size_t alignment );
+
+    // bytes of all chunks that were allocated from the system and of their
+    // bookkeeping - used chunk bytes include node, key and value overhead
+    size_t memory_footprint() const
     {
-      return entry_t{ key };
+      return memory_footprint_ + chunks_.capacity() * sizeof( decltype( chunks_ )::value_type );
     }
 
-    // copies are needed because boost multiindex doesn't support move...
+  private:
+    // chunks grow from the first to the max size so that the many small
+    // memtables of idle segments don't hold a whole chunk each
+    static constexpr size_t first_chunk_size = 4 * 1024;
+    static constexpr size_t chunk_size = 64 * 1024;
 
-    bool operator<( entry_t const& e ) const { return key < e.key; }
+    std::vector< std::unique_ptr<std::byte[]> > chunks_;
+    std::byte* position_ = nullptr;
+    size_t remaining_ = 0;
+    size_t next_chunk_size_ = first_chunk_size;
+    size_t memory_footprint_ = 0;
+  };
+
+  // sorted in memory write buffer - a skiplist with nodes, keys and values
+  // allocated from a single arena
+  //
+  // lookups take std::string_view and don't allocate, values are replaced in
+  // place when the new value fits into the space of the old one
+  class memtable_t
+  {
+  private:
+    static constexpr size_t max_height = 12;
 
-    void bump_last_access_time()
+    struct node_t;
+
+  public:
+    class entry_t
     {
-      last_accessed = std::chrono::steady_clock::now();
-    }
-  };
+    public:
+      std::string_view key() const { return { key_, key_size_ }; }
+      std::string_view content() const { return { content_, content_size_ }; }
+      entry_type_t type() const { return type_; }
+
+    private:
+      friend class memtable_t;
+
+      char const* key_ = nullptr;
+      char* content_ = nullptr;
+      uint32_t key_size_ = 0;
+      uint32_t content_size_ = 0;
+      uint32_t content_capacity_ = 0;
+      entry_type_t type_ = entry_type_t::tombstone;
+    };
+
+    class iterator
+    {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = entry_t;
+      using difference_type = std::ptrdiff_t;
+      using pointer = entry_t*;
+      using reference = entry_t&;
+
+      iterator() = default;
+
+      entry_t& operator*() const;
+      entry_t* operator->() const { return &**this; }
+      iterator& operator++();
+      iterator operator++( int ) { auto current = *this; ++*this; return current; }
+      bool operator==( iterator const& ) const = default;
+
+    private:
+      friend class memtable_t;
+
+      explicit iterator( node_t* node ) : node_{ node } {}
+
+      node_t* node_ = nullptr;
+    };
+
+    memtable_t();
+    memtable_t( memtable_t&& other ) noexcept;
+    memtable_t& operator=( memtable_t&& other ) noexcept;
 
-  struct key_index;
-  struct last_accessed_index;
-
-  using memtable_t =
-    boost::multi_index::multi_index_container
-    <
-      entry_t,
-      boost::multi_index::indexed_by
-      <
-        // sort by entry_t::operator<
-        boost::multi_index::ordered_unique
-        <
-          boost::multi_index::tag< key_index >,
-          boost::multi_index::identity< entry_t >
-        >,
-        // sort by less< time_point_t > on last_accessed
-        boost::multi_index::ordered_non_unique
-        <
-          boost::multi_index::tag< last_accessed_index >,
-          boost::multi_index::member
-          <
-            entry_t,
-            time_point_t,
-            &entry_t::last_accessed
-          >
-        >
-      >
-    >;
+    // nullptr if the key is not in the memtable
+    entry_t* find( std::string_view key );
+    entry_t const* find( std::string_view key ) const;
+
+    // inserts or replaces the entry
+    entry_t& put( std::string_view key, std::string_view content );
+    entry_t& put_tombstone( std::string_view key );
+    entry_t& put_pointer( std::string_view key );
+
+    iterator begin() const;
+    iterator end() const { return iterator{}; }
+    // first entry with key that is not less than the given one
+    iterator lower_bound( std::string_view key ) const;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t memory_footprint() const { return arena_.memory_footprint(); }
+
+  private:
+    // fills update with the last node before key on every level and returns
+    // the first node that is not less than key
+    node_t* find_greater_or_equal( std::string_view key, node_t** update ) const;
+    entry_t& upsert( std::string_view key, std::string_view content, entry_type_t type );
+    size_t random_height();
+
+    arena_t arena_;
+    node_t* head_;
+    size_t height_ = 1;
+    size_t size_ = 0;
+    uint64_t random_state_ = 0x9e3779b97f4a7c15ull;
+  };
 }
 
-#endif // MEMTABLE_HPP_INCLUDED
\ No newline at end of file
+#endif // MEMTABLE_HPP_INCLUDED
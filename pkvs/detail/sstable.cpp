@@ -0,0 +1,879 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "sstable.hpp"
+
+#include <seastar/core/coroutine.hh>
+#include <seastar/core/seastar.hh>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "crc32c.hpp"
+
+using namespace pkvs;
+
+namespace
+{
+  using sstable_format::v1_entry_size;
+
+  // amount of v1 records that are grouped into a single block of the index
+  constexpr size_t v1_records_per_block = 16;
+
+  [[noreturn]] void report_corruption( std::filesystem::path const& path )
+  {
+    throw corruption_error( path );
+  }
+
+  // v4 block (without its checksum) as it is kept in the block cache
+  //
+  // the uncompressed size is checked against the largest block of the
+  // sstable before anything is allocated for it as it is read from disk
+  seastar::temporary_buffer<char> decompress_block
+  (
+    seastar::temporary_buffer<char> block,
+    uint64_t max_block_size,
+    std::filesystem::path const& path
+  )
+  {
+    if( block.empty() || static_cast<uint8_t>( block[ 0 ] ) > static_cast<uint8_t>( max_compression ) )
+      report_corruption( path );
+
+    auto codec = static_cast<compression_t>( block[ 0 ] );
+
+    block.trim_front( 1 );
+
+    if( codec == compression_t::none )
+      return block;
+
+    if( compression_supported( codec ) == false )
+    {
+      throw std::runtime_error(
+        path.native() + " is compressed with " + std::string{ compression_name( codec ) } +
+        " which is not supported by this build" );
+    }
+
+    std::string_view in{ block.get(), block.size() };
+    uint64_t size;
+
+    if( sstable_format::take_varint( in, size ) == false || size > max_block_size )
+      report_corruption( path );
+
+    seastar::temporary_buffer<char> out( size );
+
+    if( decompress( codec, in, { out.get_write(), out.size() } ) == false )
+      report_corruption( path );
+
+    return out;
+  }
+
+  std::filesystem::path index_path( std::filesystem::path const& path )
+  {
+    return path.native() + ".index";
+  }
+
+  std::filesystem::path filter_path( std::filesystem::path const& path )
+  {
+    return path.native() + ".filter";
+  }
+
+  std::filesystem::path temporary_path( std::filesystem::path const& path )
+  {
+    return path.native() + ".tmp";
+  }
+
+  std::string_view v1_record_key( char const* record, std::filesystem::path const& path )
+  {
+    uint64_t size = *reinterpret_cast< uint64_t const* >( record );
+
+    if( size == 0 || size > 256 )
+      report_corruption( path );
+
+    return { record + sizeof( uint64_t ), size };
+  }
+
+  sstable_entry_type_t v1_record_type( char const* record )
+  {
+    return
+      static_cast<sstable_entry_type_t>(
+        *reinterpret_cast< uint32_t const* >( record + v1_entry_size - sizeof( uint32_t ) ) );
+  }
+
+  void v1_fill_block_sizes( std::vector<sstable_index_entry_t>& index, uint64_t records_count )
+  {
+    for( size_t i = 0; i < index.size(); ++i )
+    {
+      uint64_t records =
+        std::min< uint64_t >( v1_records_per_block, records_count - i * v1_records_per_block );
+
+      index[ i ].size = records * v1_entry_size;
+    }
+  }
+
+  // "PKVSIDX1" - index of a v1 sstable without the format field
+  constexpr uint64_t index_magic_v1 = 0x3158444953564b50;
+  // "PKVSIDX2"
+  constexpr uint64_t index_magic_v2 = 0x3258444953564b50;
+  // "PKVSIDX3" - same as v2 followed by the crc32c of the whole index
+  constexpr uint64_t index_magic_v3 = 0x3358444953564b50;
+
+  struct index_content_t
+  {
+    uint32_t format;
+    uint64_t order;
+    uint64_t records_count;
+    std::vector<sstable_index_entry_t> index;
+    // size of the largest uncompressed block (v4 only)
+    uint64_t max_block_size = 0;
+  };
+
+  // index file layout:
+  //   uint64_t magic
+  //   uint64_t sstable format version
+  //   uint64_t order
+  //   uint64_t records count
+  //   uint64_t size of the largest uncompressed block (v4 sstables only)
+  //   for every block: uint64_t offset, uint64_t size, uint64_t key size, key
+  //   uint32_t crc32c of everything before it (v3 magic only)
+  std::string encode_index( index_content_t const& content )
+  {
+    std::string out;
+
+    auto append =
+      [ &out ]( uint64_t value )
+      {
+        out.append( reinterpret_cast<char const*>( &value ), sizeof( value ) );
+      };
+
+    append( index_magic_v3 );
+    append( content.format );
+    append( content.order );
+    append( content.records_count );
+
+    if( sstable_format::has_compression( content.format ) )
+      append( content.max_block_size );
+
+    for( auto const& entry : content.index )
+    {
+      append( entry.offset );
+      append( entry.size );
+      append( entry.first_key.size() );
+      out += entry.first_key;
+    }
+
+    append_crc32c( out, crc32c( out ) );
+
+    return out;
+  }
+
+  // returns std::nullopt for index files of an unknown format
+  std::optional<index_content_t> decode_index
+  (
+    std::string_view in,
+    std::filesystem::path const& path
+  )
+  {
+    auto take =
+      [ & ]() -> uint64_t
+      {
+        if( in.size() < sizeof( uint64_t ) )
+          report_corruption( path );
+
+        uint64_t value;
+        std::memcpy( &value, in.data(), sizeof( value ) );
+        in.remove_prefix( sizeof( value ) );
+
+        return value;
+      };
+
+    if( in.size() < sizeof( uint64_t ) )
+      return std::nullopt;
+
+    if( in.starts_with( std::string_view{ reinterpret_cast<char const*>( &index_magic_v3 ), sizeof( uint64_t ) } ) )
+    {
+      auto checked = strip_crc32c( in );
+
+      if( checked == std::nullopt )
+        report_corruption( path );
+
+      in = *checked;
+    }
+
+    index_content_t content;
+
+    if( auto magic = take(); magic == index_magic_v1 )
+      content.format = 1;
+    else if( magic == index_magic_v2 || magic == index_magic_v3 )
+      content.format = static_cast<uint32_t>( take() );
+    else
+      return std::nullopt;
+
+    content.order = take();
+    content.records_count = take();
+
+    if( sstable_format::has_compression( content.format ) )
+      content.max_block_size = take();
+
+    while( in.empty() == false )
+    {
+      uint64_t offset = take();
+      uint64_t size = take();
+      uint64_t key_size = take();
+
+      if( key_size > in.size() )
+        report_corruption( path );
+
+      content.index.emplace_back( std::string{ in.substr( 0, key_size ) }, offset, size );
+      in.remove_prefix( key_size );
+    }
+
+    return content;
+  }
+
+  seastar::future<seastar::temporary_buffer<char>> read_range
+  (
+    std::filesystem::path const& path,
+    uint64_t offset,
+    std::optional<uint64_t> size // whole file from offset if not set
+  )
+  {
+    auto in_file = co_await seastar::open_file_dma( path.native(), seastar::open_flags::ro );
+    seastar::temporary_buffer<char> content;
+
+    co_await
+      [ & ] -> seastar::future<>
+      {
+        auto read_size = size ? *size : co_await in_file.size() - offset;
+
+        content = co_await in_file.dma_read_exactly<char>( offset, read_size );
+      }()
+      .finally( [ & ]{ return in_file.close(); } );
+
+    co_return content;
+  }
+
+  seastar::future<seastar::temporary_buffer<char>> read_file( std::filesystem::path const& path )
+  {
+    return read_range( path, 0, std::nullopt );
+  }
+
+  // content is written under a temporary name first so that a crash can't
+  // leave a partially written file behind
+  seastar::future<> write_file( std::filesystem::path const& path, std::string_view content )
+  {
+    auto out_file =
+      co_await seastar::open_file_dma
+      (
+        temporary_path( path ).native(),
+        seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate
+      );
+    auto out_stream = co_await seastar::make_file_output_stream( out_file );
+
+    co_await
+      [ & ] -> seastar::future<>
+      {
+        co_await out_stream.write( content.data(), content.size() );
+      }()
+      .finally(
+        seastar::coroutine::lambda(
+          [ & ] -> seastar::future<>
+          {
+            co_await out_stream.flush();
+            co_await out_stream.close();
+          }));
+
+    co_await seastar::rename_file( temporary_path( path ).native(), path.native() );
+  }
+
+  // rebuilds the index of a v1 sstable by scanning all of its records
+  seastar::future<index_content_t> scan_v1
+  (
+    std::filesystem::path const& path,
+    unsigned long id
+  )
+  {
+    index_content_t content{ 1, id, 0, {} };
+
+    auto in_file = co_await seastar::open_file_dma( path.native(), seastar::open_flags::ro );
+    auto in_stream = seastar::make_file_input_stream( in_file );
+
+    co_await
+      [ & ] -> seastar::future<>
+      {
+        while( true )
+        {
+          auto read = co_await in_stream.read_exactly( v1_entry_size );
+
+          if( read.size() == 0 )
+            co_return;
+          else if( read.size() != v1_entry_size )
+            report_corruption( path );
+
+          auto key = v1_record_key( read.get(), path );
+
+          if( content.records_count % v1_records_per_block == 0 )
+          {
+            content.index.emplace_back(
+              std::string{ key },
+              content.records_count * v1_entry_size,
+              0 );
+          }
+
+          ++content.records_count;
+        }
+      }()
+      .finally( [ & ]{ return in_stream.close(); } );
+
+    v1_fill_block_sizes( content.index, content.records_count );
+
+    co_return content;
+  }
+}
+
+sstable_t::sstable_t
+(
+  std::filesystem::path path,
+  unsigned long id,
+  uint32_t format,
+  uint64_t order,
+  uint64_t records_count,
+  std::vector<sstable_index_entry_t>&& index,
+  uint64_t max_block_size,
+  bloom_filter_t&& filter,
+  bool verify_checksums,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache
+)
+  : path_{ std::move( path ) }
+  , id_{ id }
+  , format_{ format }
+  , order_{ order }
+  , records_count_{ records_count }
+  , max_block_size_{ max_block_size }
+  , index_{ std::move( index ) }
+  , filter_{ std::move( filter ) }
+  , verify_checksums_{ verify_checksums }
+  , file_cache_{ &file_cache }
+  , block_cache_{ &block_cache }
+{
+  for( auto const& block : index_ )
+    data_size_ += block.size;
+}
+
+seastar::future<seastar::lw_shared_ptr<sstable_t>> sstable_t::open
+(
+  std::filesystem::path directory,
+  unsigned long id,
+  sstable_options_t options,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache
+)
+{
+  auto path = directory / std::to_string( id );
+  std::optional<index_content_t> content;
+
+  if( co_await seastar::file_exists( index_path( path ).native() ) )
+  {
+    auto index_content = co_await read_file( index_path( path ) );
+
+    content = decode_index( { index_content.get(), index_content.size() }, index_path( path ) );
+  }
+
+  if( content == std::nullopt )
+  {
+    // v1 sstables may predate index files while v2 sstables are always
+    // written together with them
+    auto size = co_await seastar::file_size( path.native() );
+    auto header =
+      co_await read_range( path, 0, std::min< uint64_t >( size, sstable_format::header_size ) );
+
+    if( sstable_format::decode_header( { header.get(), header.size() } ) != std::nullopt )
+      report_corruption( index_path( path ) );
+
+    content = co_await scan_v1( path, id );
+
+    co_await write_file( index_path( path ), encode_index( *content ) );
+  }
+
+  auto table =
+    seastar::make_lw_shared<sstable_t>(
+      path,
+      id,
+      content->format,
+      content->order,
+      content->records_count,
+      std::move( content->index ),
+      content->max_block_size,
+      bloom_filter_t{},
+      options.verify_checksums,
+      file_cache,
+      block_cache );
+
+  if( options.bloom_filter_bits_per_key == 0 )
+    co_return table;
+
+  bool filter_checksum = sstable_format::has_checksums( table->format_ );
+
+  if( co_await seastar::file_exists( filter_path( path ).native() ) )
+  {
+    auto filter_content = co_await read_file( filter_path( path ) );
+    std::string_view serialized{ filter_content.get(), filter_content.size() };
+
+    if( filter_checksum )
+    {
+      auto checked = strip_crc32c( serialized );
+
+      if( checked == std::nullopt )
+        report_corruption( filter_path( path ) );
+
+      serialized = *checked;
+    }
+
+    auto loaded = bloom_filter_t::deserialize( serialized );
+
+    if( loaded == std::nullopt )
+      report_corruption( filter_path( path ) );
+
+    table->filter_ = std::move( loaded.value() );
+  }
+  else
+  {
+    // sstables written by older versions or while filters were disabled
+    std::vector<uint64_t> key_hashes;
+    auto reader = make_reader( table );
+
+    while( auto record = co_await reader.next() )
+      key_hashes.push_back( bloom_filter_t::hash( record->key ) );
+
+    table->filter_ = bloom_filter_t{ key_hashes, options.bloom_filter_bits_per_key };
+
+    auto serialized = table->filter_.serialize();
+
+    if( filter_checksum )
+      append_crc32c( serialized, crc32c( serialized ) );
+
+    co_await write_file( filter_path( path ), serialized );
+  }
+
+  co_return table;
+}
+
+seastar::future<seastar::temporary_buffer<char>> sstable_t::read_block
+(
+  sstable_index_entry_t const& block,
+  bool fill_cache
+) const
+{
+  if( auto cached = block_cache_->get( path_, block.offset ) )
+    co_return std::move( *cached );
+
+  auto file = co_await file_cache_->get( path_ );
+  auto content = co_await file->dma_read_exactly<char>( block.offset, block.size );
+
+  if( content.size() != block.size || ( format_ == 1 && content.size() % v1_entry_size != 0 ) )
+    report_corruption( path_ );
+
+  // cached blocks were already verified and decompressed and don't include
+  // the checksum
+  if( sstable_format::has_checksums( format_ ) )
+  {
+    if
+    (
+      content.size() < crc32c_size ||
+      ( verify_checksums_ && strip_crc32c( { content.get(), content.size() } ) == std::nullopt )
+    )
+    {
+      report_corruption( path_ );
+    }
+
+    content.trim( content.size() - crc32c_size );
+  }
+
+  if( sstable_format::has_compression( format_ ) )
+    content = decompress_block( std::move( content ), max_block_size_, path_ );
+
+  if( fill_cache )
+    block_cache_->put( path_, block.offset, content.share() );
+
+  co_return content;
+}
+
+seastar::future<std::optional<sstable_record_t>> sstable_t::find( std::string_view key ) const
+{
+  if( index_.empty() || key < index_.front().first_key )
+    co_return std::nullopt;
+
+  // last block with first key that is not greater than the searched key
+  auto block =
+    std::upper_bound
+    (
+      index_.begin(),
+      index_.end(),
+      key,
+      []( std::string_view searched, sstable_index_entry_t const& entry )
+      {
+        return searched < entry.first_key;
+      }
+    ) - 1;
+
+  auto content = co_await read_block( *block, true );
+
+  if( format_ == 1 )
+  {
+    for( size_t offset = 0; offset < content.size(); offset += v1_entry_size )
+    {
+      auto found_key = v1_record_key( content.get() + offset, path_ );
+
+      if( found_key == key )
+        co_return sstable_record_t{ std::string{ key }, v1_record_type( content.get() + offset ), {} };
+      else if( found_key > key )
+        break;
+    }
+
+    co_return std::nullopt;
+  }
+
+  auto reader = sstable_format::block_reader_t::make( { content.get(), content.size() } );
+
+  if( reader == std::nullopt )
+    report_corruption( path_ );
+
+  reader->seek( key );
+
+  if( reader->corrupted() )
+    report_corruption( path_ );
+  else if( reader->valid() && reader->key() == key )
+    co_return sstable_record_t{ std::string{ key }, reader->type(), std::string{ reader->value() } };
+
+  co_return std::nullopt;
+}
+
+seastar::future<> sstable_t::verify() const
+{
+  auto file = co_await file_cache_->get( path_ );
+
+  for( auto const& block : index_ )
+  {
+    auto content = co_await file->dma_read_exactly<char>( block.offset, block.size );
+
+    if( content.size() != block.size )
+      report_corruption( path_ );
+
+    if( format_ == 1 )
+    {
+      if( content.size() % v1_entry_size != 0 )
+        report_corruption( path_ );
+
+      for( size_t offset = 0; offset < content.size(); offset += v1_entry_size )
+        v1_record_key( content.get() + offset, path_ );
+
+      continue;
+    }
+
+    if( sstable_format::has_checksums( format_ ) )
+    {
+      if( strip_crc32c( { content.get(), content.size() } ) == std::nullopt )
+        report_corruption( path_ );
+
+      content.trim( content.size() - crc32c_size );
+    }
+
+    if( sstable_format::has_compression( format_ ) )
+      content = decompress_block( std::move( content ), max_block_size_, path_ );
+
+    auto reader = sstable_format::block_reader_t::make( { content.get(), content.size() } );
+
+    if( reader == std::nullopt )
+      report_corruption( path_ );
+
+    while( reader->valid() )
+      reader->next();
+
+    if( reader->corrupted() )
+      report_corruption( path_ );
+  }
+}
+
+sstable_t::reader_t sstable_t::make_reader
+(
+  seastar::lw_shared_ptr<sstable_t> table,
+  std::string_view start
+)
+{
+  return reader_t{ std::move( table ), start };
+}
+
+seastar::future<> sstable_t::remove()
+{
+  block_cache_->evict( path_ );
+  co_await file_cache_->evict( path_ );
+
+  // data file goes first so that an interruption can only leave side files
+  // without data behind and those are ignored on startup
+  co_await seastar::remove_file( path_.native() );
+  co_await seastar::remove_file( index_path( path_ ).native() );
+
+  if( co_await seastar::file_exists( filter_path( path_ ).native() ) )
+    co_await seastar::remove_file( filter_path( path_ ).native() );
+}
+
+sstable_t::reader_t::reader_t( seastar::lw_shared_ptr<sstable_t> table, std::string_view start )
+  : table_{ std::move( table ) }
+  , start_{ start }
+{
+  auto const& index = table_->index_;
+
+  if( start_.empty() == false && index.empty() == false )
+  {
+    // last block with first key that is not greater than start
+    auto block =
+      std::upper_bound
+      (
+        index.begin(),
+        index.end(),
+        start_,
+        []( std::string_view searched, sstable_index_entry_t const& entry )
+        {
+          return searched < entry.first_key;
+        }
+      );
+
+    if( block != index.begin() )
+      next_block_ = block - index.begin() - 1;
+  }
+}
+
+seastar::future<std::optional<sstable_record_t>> sstable_t::reader_t::next()
+{
+  auto record = co_await read_next();
+
+  while( start_.empty() == false && record != std::nullopt && record->key < start_ )
+    record = co_await read_next();
+
+  start_.clear();
+
+  co_return record;
+}
+
+seastar::future<std::optional<sstable_record_t>> sstable_t::reader_t::read_next()
+{
+  bool exhausted =
+    table_->format_ == 1 ?
+      block_.empty() :
+      ( block_reader_ == std::nullopt || block_reader_->valid() == false );
+
+  if( exhausted )
+  {
+    if( block_reader_ != std::nullopt && block_reader_->corrupted() )
+      report_corruption( table_->path_ );
+
+    if( next_block_ == table_->index_.size() )
+      co_return std::nullopt;
+
+    block_reader_ = std::nullopt;
+    block_ = co_await table_->read_block( table_->index_[ next_block_++ ], false );
+    bytes_read_ += block_.size();
+
+    if( table_->format_ != 1 )
+    {
+      block_reader_ = sstable_format::block_reader_t::make( { block_.get(), block_.size() } );
+
+      if( block_reader_ == std::nullopt || block_reader_->valid() == false )
+        report_corruption( table_->path_ );
+    }
+  }
+
+  if( table_->format_ == 1 )
+  {
+    sstable_record_t record
+      {
+        std::string{ v1_record_key( block_.get(), table_->path_ ) },
+        v1_record_type( block_.get() ),
+        {}
+      };
+
+    block_.trim_front( v1_entry_size );
+
+    co_return record;
+  }
+
+  sstable_record_t record
+    {
+      std::string{ block_reader_->key() },
+      block_reader_->type(),
+      std::string{ block_reader_->value() }
+    };
+
+  block_reader_->next();
+
+  co_return record;
+}
+
+sstable_writer_t::sstable_writer_t
+(
+  std::filesystem::path directory,
+  unsigned long id,
+  uint64_t order,
+  sstable_options_t const& options,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache,
+  seastar::output_stream<char>&& out
+)
+  : directory_{ std::move( directory ) }
+  , id_{ id }
+  , order_{ order }
+  , options_{ options }
+  , file_cache_{ &file_cache }
+  , block_cache_{ &block_cache }
+  , out_{ std::move( out ) }
+{}
+
+seastar::future<sstable_writer_t> sstable_writer_t::make
+(
+  std::filesystem::path directory,
+  unsigned long id,
+  uint64_t order,
+  sstable_options_t options,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache
+)
+{
+  auto out_file =
+    co_await seastar::open_file_dma
+    (
+      temporary_path( directory / std::to_string( id ) ).native(),
+      seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate
+    );
+
+  sstable_writer_t writer
+    {
+      std::move( directory ),
+      id,
+      order,
+      options,
+      file_cache,
+      block_cache,
+      co_await seastar::make_file_output_stream( out_file )
+    };
+
+  auto header = sstable_format::encode_header( { sstable_format::current_version, 0 } );
+
+  co_await writer.out_.write( header.data(), header.size() );
+  writer.offset_ = header.size();
+
+  co_return writer;
+}
+
+seastar::future<> sstable_writer_t::add
+(
+  std::string_view key,
+  sstable_entry_type_t type,
+  std::string_view value
+)
+{
+  assert( key.empty() == false && key.size() <= 256 );
+  assert( index_.empty() || key > index_.back().first_key );
+
+  if( block_.empty() )
+    index_.emplace_back( std::string{ key }, offset_, 0 );
+
+  if( options_.bloom_filter_bits_per_key != 0 )
+    key_hashes_.push_back( bloom_filter_t::hash( key ) );
+
+  ++records_count_;
+  block_.add( key, type, value );
+
+  if( block_.size_estimate() >= sstable_format::block_target_size )
+    return flush_block();
+
+  return seastar::make_ready_future<>();
+}
+
+seastar::future<> sstable_writer_t::flush_block()
+{
+  auto records = block_.finish();
+  std::string block( 1, static_cast<char>( options_.compression ) );
+
+  max_block_size_ = std::max<uint64_t>( max_block_size_, records.size() );
+
+  if( options_.compression != compression_t::none )
+  {
+    sstable_format::append_varint( block, records.size() );
+
+    // compression that doesn't pay off only costs decompression time on
+    // every read
+    if
+    (
+      compress( options_.compression, records, block ) == false ||
+      block.size() > records.size() - records.size() / 8
+    )
+    {
+      block.assign( 1, static_cast<char>( compression_t::none ) );
+      block += records;
+    }
+  }
+  else
+    block += records;
+
+  append_crc32c( block, crc32c( block ) );
+  index_.back().size = block.size();
+  offset_ += block.size();
+
+  co_await out_.write( block.data(), block.size() );
+}
+
+seastar::future<seastar::lw_shared_ptr<sstable_t>> sstable_writer_t::finish()
+{
+  if( block_.empty() == false )
+    co_await flush_block();
+
+  co_await out_.flush();
+  co_await out_.close();
+
+  auto path = directory_ / std::to_string( id_ );
+
+  bloom_filter_t filter;
+
+  if( options_.bloom_filter_bits_per_key != 0 )
+  {
+    filter = bloom_filter_t{ key_hashes_, options_.bloom_filter_bits_per_key };
+
+    auto serialized = filter.serialize();
+
+    append_crc32c( serialized, crc32c( serialized ) );
+    co_await write_file( filter_path( path ), serialized );
+  }
+
+  // side files are written first so that a visible sstable always has them
+  co_await
+    write_file
+    (
+      index_path( path ),
+      encode_index( { sstable_format::current_version, order_, records_count_, index_, max_block_size_ } )
+    );
+  co_await seastar::rename_file( temporary_path( path ).native(), path.native() );
+  co_await seastar::sync_directory( directory_.native() );
+
+  co_return
+    seastar::make_lw_shared<sstable_t>(
+      path,
+      id_,
+      sstable_format::current_version,
+      order_,
+      records_count_,
+      std::move( index_ ),
+      max_block_size_,
+      std::move( filter ),
+      options_.verify_checksums,
+      *file_cache_,
+      *block_cache_ );
+}
+
+seastar::future<> sstable_writer_t::abort()
+{
+  co_await out_.close().handle_exception( []( std::exception_ptr ){} );
+  co_await seastar::remove_file( temporary_path( directory_ / std::to_string( id_ ) ).native() );
+}
@@ -0,0 +1,283 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef SSTABLE_HPP_INCLUDED
+#define SSTABLE_HPP_INCLUDED
+
+#include <seastar/core/fstream.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "block_cache.hpp"
+#include "bloom_filter.hpp"
+#include "compression.hpp"
+#include "file_cache.hpp"
+#include "key_hash.hpp"
+#include "sstable_format.hpp"
+
+namespace pkvs
+{
+  enum class compaction_strategy_t
+  {
+    // merges runs of similar size once enough of them pile up
+    size_tiered,
+    // keeps a single run per size level and merges new runs into it
+    leveled
+  };
+
+  struct sstable_options_t
+  {
+    // size of per sstable bloom filters (0 disables them)
+    size_t bloom_filter_bits_per_key = 10;
+    compaction_strategy_t compaction_strategy = compaction_strategy_t::size_tiered;
+    // amount of sstable bytes that a single compaction step may read
+    size_t compaction_io_budget = 4 * 1024 * 1024;
+    // values up to this size are stored in sstable blocks instead of
+    // separate value files
+    size_t inline_value_threshold = 1024;
+    // decides value file names so it must match the one of the store
+    key_hash_t key_hash = key_hash_t::xxh64;
+    // blocks and value files that are read from disk are checked against
+    // their checksums (index and filter files are always checked)
+    bool verify_checksums = true;
+    // value files end with a checksum trailer so a missing one is corruption,
+    // it must match the store (see store_metadata_t)
+    bool value_checksums = true;
+    // codec of blocks written by flushes and of blocks written by compaction
+    // which holds data that is read less often - blocks that don't shrink by
+    // at least an eighth are stored uncompressed
+    compression_t compression = default_compression;
+    compression_t compaction_compression = default_cold_compression;
+  };
+
+  // content of the file doesn't match its checksum or can't be decoded
+  class corruption_error : public std::runtime_error
+  {
+  public:
+    explicit corruption_error( std::filesystem::path path )
+      : std::runtime_error{ "file corruption detected in " + path.native() }
+      , path_{ std::move( path ) }
+    {}
+
+    std::filesystem::path const& path() const { return path_; }
+
+  private:
+    std::filesystem::path path_;
+  };
+
+  struct sstable_record_t
+  {
+    std::string key;
+    sstable_entry_type_t type;
+    std::string value; // only for inline values
+  };
+
+  // in memory part of the sstable - first key of every block so that a lookup
+  // can binary search for the only block that can contain the key
+  struct sstable_index_entry_t
+  {
+    std::string first_key;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // single immutable sorted sstable file together with its side files
+  //
+  // files in the sstables directory:
+  //   <id>        - records sorted by key and grouped into blocks (see
+  //                 sstable_format.hpp)
+  //   <id>.index  - age of the sstable and sparse index (first key and
+  //                 location of every block) followed by its crc32c
+  //   <id>.filter - bloom filter of all keys in the sstable, followed by its
+  //                 crc32c for v3 and later sstables
+  //   *.tmp       - files that are still being written (removed on startup)
+  //
+  // ids are unique and never reused while order defines the age of the
+  // content - flushed sstables have order equal to id and compacted sstables
+  // inherit the order of the newest merged sstable
+  class sstable_t
+  {
+  public:
+    class reader_t;
+
+    // loads the index and filter files or rebuilds them from the sstable
+    // content if they are missing (sstables written by older versions)
+    static seastar::future<seastar::lw_shared_ptr<sstable_t>> open
+    (
+      std::filesystem::path directory,
+      unsigned long id,
+      sstable_options_t options,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache
+    );
+
+    unsigned long id() const { return id_; }
+    uint32_t format() const { return format_; }
+    uint64_t order() const { return order_; }
+    std::filesystem::path const& path() const { return path_; }
+    uint64_t records_count() const { return records_count_; }
+    uint64_t data_size() const { return data_size_; }
+
+    // false if the key is definitely not in the sstable
+    bool may_contain( std::string_view key ) const { return filter_.may_contain( key ); }
+    bool has_bloom_filter() const { return filter_.empty() == false; }
+    size_t bloom_filter_memory_footprint() const { return filter_.memory_footprint(); }
+
+    // binary searches the in memory index and reads at most one block
+    // point reads are expected to check may_contain() before calling this
+    //
+    // reads of corrupted blocks fail with corruption_error
+    seastar::future<std::optional<sstable_record_t>> find( std::string_view key ) const;
+
+    // reads and decodes every block from disk, bypassing the block cache,
+    // and fails with corruption_error on the first one that doesn't match
+    // its checksum or can't be decoded - checksums are verified even if
+    // verification of reads is disabled
+    seastar::future<> verify() const;
+
+    // sequential reader over records in key order starting with the first
+    // key that is not less than start
+    static reader_t make_reader
+    (
+      seastar::lw_shared_ptr<sstable_t> table,
+      std::string_view start = {}
+    );
+
+    // drops cached file handle and blocks and removes the sstable and its
+    // side files from disk
+    seastar::future<> remove();
+
+    sstable_t
+    (
+      std::filesystem::path path,
+      unsigned long id,
+      uint32_t format,
+      uint64_t order,
+      uint64_t records_count,
+      std::vector<sstable_index_entry_t>&& index,
+      uint64_t max_block_size,
+      bloom_filter_t&& filter,
+      bool verify_checksums,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache
+    );
+
+  private:
+    // sequential scans don't fill the block cache so that they don't evict
+    // blocks of hot keys
+    seastar::future<seastar::temporary_buffer<char>> read_block
+    (
+      sstable_index_entry_t const& block,
+      bool fill_cache
+    ) const;
+
+    std::filesystem::path path_;
+    unsigned long id_;
+    uint32_t format_;
+    uint64_t order_;
+    uint64_t records_count_;
+    // bound for uncompressed sizes of v4 blocks
+    uint64_t max_block_size_;
+    uint64_t data_size_ = 0;
+    std::vector<sstable_index_entry_t> index_;
+    bloom_filter_t filter_;
+    bool verify_checksums_;
+    file_cache_t* file_cache_;
+    block_cache_t* block_cache_;
+  };
+
+  class sstable_t::reader_t
+  {
+  public:
+    explicit reader_t( seastar::lw_shared_ptr<sstable_t> table, std::string_view start = {} );
+
+    // returns std::nullopt once all records were read
+    seastar::future<std::optional<sstable_record_t>> next();
+
+    uint64_t bytes_read() const { return bytes_read_; }
+
+  private:
+    seastar::future<std::optional<sstable_record_t>> read_next();
+
+    seastar::lw_shared_ptr<sstable_t> table_;
+    // records before it are skipped, cleared once reached
+    std::string start_;
+    size_t next_block_ = 0;
+    seastar::temporary_buffer<char> block_;
+    // v2 iteration state over block_
+    std::optional<sstable_format::block_reader_t> block_reader_;
+    uint64_t bytes_read_ = 0;
+  };
+
+  // writes a new v4 sstable under a temporary name and makes it visible under
+  // its final name only once it's complete
+  class sstable_writer_t
+  {
+  public:
+    static seastar::future<sstable_writer_t> make
+    (
+      std::filesystem::path directory,
+      unsigned long id,
+      uint64_t order,
+      sstable_options_t options,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache
+    );
+
+    // contract: keys are added in strictly ascending order
+    seastar::future<> add
+    (
+      std::string_view key,
+      sstable_entry_type_t type,
+      std::string_view value = {}
+    );
+
+    uint64_t records_count() const { return records_count_; }
+
+    seastar::future<seastar::lw_shared_ptr<sstable_t>> finish();
+
+    // discards the partially written sstable
+    seastar::future<> abort();
+
+  private:
+    sstable_writer_t
+    (
+      std::filesystem::path directory,
+      unsigned long id,
+      uint64_t order,
+      sstable_options_t const& options,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache,
+      seastar::output_stream<char>&& out
+    );
+
+    seastar::future<> flush_block();
+
+    std::filesystem::path directory_;
+    unsigned long id_;
+    uint64_t order_;
+    sstable_options_t options_;
+    file_cache_t* file_cache_;
+    block_cache_t* block_cache_;
+    seastar::output_stream<char> out_;
+    uint64_t records_count_ = 0;
+    uint64_t offset_ = 0;
+    uint64_t max_block_size_ = 0;
+    sstable_format::block_builder_t block_;
+    std::vector<sstable_index_entry_t> index_;
+    std::vector<uint64_t> key_hashes_;
+  };
+}
+
+#endif // SSTABLE_HPP_INCLUDED
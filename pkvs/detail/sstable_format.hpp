@@ -0,0 +1,377 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef SSTABLE_FORMAT_HPP_INCLUDED
+#define SSTABLE_FORMAT_HPP_INCLUDED
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// on disk encoding of sstable data files
+//
+// format v1 (no header):
+//   fixed size records - uint64_t key size, key padded with spaces to 256
+//   bytes and uint32_t entry type
+//
+// format v2:
+//   header - uint64_t magic, uint32_t version, uint32_t flags
+//   blocks - records followed by a block trailer
+//     record  - varint shared key prefix size, varint unshared key size,
+//               uint8_t entry type, unshared key suffix and for inline values
+//               varint value size followed by the value
+//     trailer - uint32_t offsets of restart records, uint32_t restart count
+//
+//   every restart_interval-th record is a restart record that stores the
+//   full key so that a block can be binary searched
+//
+// format v3:
+//   same as v2 but every block is followed by the uint32_t crc32c of the
+//   block (records and trailer), index sizes include the checksum
+//
+// format v4:
+//   same as v3 but every block starts with an uint8_t codec
+//   (compression_t) - compressed blocks continue with the varint size of the
+//   uncompressed block followed by the compressed block, the checksum
+//   covers the block as it is stored
+namespace pkvs
+{
+  enum class sstable_entry_type_t : uint32_t
+  {
+    tombstone,
+    // value is stored in its own file in the values directory
+    value,
+    // value is stored in the sstable block (v2 only)
+    inline_value
+  };
+
+  namespace sstable_format
+  {
+    // "PKVSDAT2"
+    inline constexpr uint64_t magic = 0x3254414453564b50;
+    inline constexpr size_t header_size = sizeof( uint64_t ) + 2 * sizeof( uint32_t );
+    inline constexpr size_t restart_interval = 16;
+    inline constexpr size_t block_target_size = 4096;
+
+    inline constexpr size_t v1_entry_size = sizeof( uint64_t ) + 256 + sizeof( uint32_t );
+
+    // version of newly written sstables
+    inline constexpr uint32_t current_version = 4;
+
+    inline bool has_checksums( uint32_t version ) { return version >= 3; }
+    inline bool has_compression( uint32_t version ) { return version >= 4; }
+
+    struct header_t
+    {
+      uint32_t version;
+      uint32_t flags;
+    };
+
+    inline std::string encode_header( header_t header )
+    {
+      std::string out( header_size, '\0' );
+
+      std::memcpy( out.data(), &magic, sizeof( magic ) );
+      std::memcpy( out.data() + sizeof( magic ), &header.version, sizeof( uint32_t ) );
+      std::memcpy(
+        out.data() + sizeof( magic ) + sizeof( uint32_t ),
+        &header.flags,
+        sizeof( uint32_t ) );
+
+      return out;
+    }
+
+    // returns std::nullopt for headerless (v1) files
+    inline std::optional<header_t> decode_header( std::string_view in )
+    {
+      uint64_t found_magic;
+      header_t header;
+
+      if( in.size() < header_size )
+        return std::nullopt;
+
+      std::memcpy( &found_magic, in.data(), sizeof( found_magic ) );
+
+      if( found_magic != magic )
+        return std::nullopt;
+
+      std::memcpy( &header.version, in.data() + sizeof( magic ), sizeof( uint32_t ) );
+      std::memcpy(
+        &header.flags,
+        in.data() + sizeof( magic ) + sizeof( uint32_t ),
+        sizeof( uint32_t ) );
+
+      return header;
+    }
+
+    inline void append_varint( std::string& out, uint64_t value )
+    {
+      while( value >= 0x80 )
+      {
+        out += static_cast<char>( value | 0x80 );
+        value >>= 7;
+      }
+
+      out += static_cast<char>( value );
+    }
+
+    // returns false on malformed or truncated input
+    inline bool take_varint( std::string_view& in, uint64_t& value )
+    {
+      value = 0;
+
+      for( unsigned shift = 0; shift < 64 && in.empty() == false; shift += 7 )
+      {
+        uint8_t byte = static_cast<uint8_t>( in.front() );
+        in.remove_prefix( 1 );
+        value |= uint64_t{ byte & 0x7fu } << shift;
+
+        if( ( byte & 0x80 ) == 0 )
+          return true;
+      }
+
+      return false;
+    }
+
+    class block_builder_t
+    {
+    public:
+      bool empty() const { return counter_ == 0; }
+
+      size_t size_estimate() const
+      {
+        return buffer_.size() + ( restarts_.size() + 1 ) * sizeof( uint32_t );
+      }
+
+      // contract: keys are added in strictly ascending order
+      void add( std::string_view key, sstable_entry_type_t type, std::string_view value = {} )
+      {
+        size_t shared = 0;
+
+        if( counter_ % restart_interval == 0 )
+          restarts_.push_back( static_cast<uint32_t>( buffer_.size() ) );
+        else
+        {
+          auto limit = std::min( key.size(), last_key_.size() );
+
+          while( shared < limit && key[ shared ] == last_key_[ shared ] )
+            ++shared;
+        }
+
+        append_varint( buffer_, shared );
+        append_varint( buffer_, key.size() - shared );
+        buffer_ += static_cast<char>( type );
+        buffer_.append( key.substr( shared ) );
+
+        if( type == sstable_entry_type_t::inline_value )
+        {
+          append_varint( buffer_, value.size() );
+          buffer_.append( value );
+        }
+
+        last_key_.assign( key );
+        ++counter_;
+      }
+
+      // returns the encoded block and resets the builder
+      std::string finish()
+      {
+        auto append_u32 =
+          [ this ]( uint32_t value )
+          {
+            buffer_.append( reinterpret_cast<char const*>( &value ), sizeof( value ) );
+          };
+
+        for( auto restart : restarts_ )
+          append_u32( restart );
+
+        append_u32( static_cast<uint32_t>( restarts_.size() ) );
+
+        std::string block = std::move( buffer_ );
+
+        buffer_.clear();
+        restarts_.clear();
+        last_key_.clear();
+        counter_ = 0;
+
+        return block;
+      }
+
+    private:
+      std::string buffer_;
+      std::vector<uint32_t> restarts_;
+      std::string last_key_;
+      size_t counter_ = 0;
+    };
+
+    // iterates over records of a single v2 block - the block content must
+    // outlive the reader
+    class block_reader_t
+    {
+    public:
+      // returns std::nullopt if the block trailer is malformed
+      static std::optional<block_reader_t> make( std::string_view block )
+      {
+        uint32_t restarts_count;
+
+        if( block.size() < sizeof( uint32_t ) )
+          return std::nullopt;
+
+        std::memcpy(
+          &restarts_count,
+          block.data() + block.size() - sizeof( uint32_t ),
+          sizeof( uint32_t ) );
+
+        if( restarts_count == 0 || ( block.size() / sizeof( uint32_t ) ) - 1 < restarts_count )
+          return std::nullopt;
+
+        size_t records_size = block.size() - ( restarts_count + 1 ) * sizeof( uint32_t );
+
+        block_reader_t reader{ block.substr( 0, records_size ), block.data() + records_size, restarts_count };
+
+        for( uint32_t i = 0; i < restarts_count; ++i )
+        {
+          if( reader.restart( i ) >= records_size )
+            return std::nullopt;
+        }
+
+        reader.seek_to_first();
+
+        return reader;
+      }
+
+      bool valid() const { return valid_; }
+      bool corrupted() const { return corrupted_; }
+      std::string_view key() const { return key_; }
+      sstable_entry_type_t type() const { return type_; }
+      // empty unless type is inline_value
+      std::string_view value() const { return value_; }
+
+      void seek_to_first()
+      {
+        position_ = 0;
+        key_.clear();
+        next();
+      }
+
+      // positions to the first record with key that is not less than target
+      void seek( std::string_view target )
+      {
+        // last restart record with key less than target
+        uint32_t low = 0;
+        uint32_t high = restarts_count_;
+
+        while( high - low > 1 )
+        {
+          uint32_t middle = low + ( high - low ) / 2;
+
+          position_ = restart( middle );
+          key_.clear();
+          next();
+
+          if( corrupted_ )
+            return;
+
+          if( key_ < target )
+            low = middle;
+          else
+            high = middle;
+        }
+
+        position_ = restart( low );
+        key_.clear();
+        next();
+
+        while( valid_ && key_ < target )
+          next();
+      }
+
+      void next()
+      {
+        valid_ = false;
+
+        if( position_ >= records_.size() )
+          return;
+
+        std::string_view in = records_.substr( position_ );
+        uint64_t shared;
+        uint64_t unshared;
+
+        if
+        (
+          take_varint( in, shared ) == false ||
+          take_varint( in, unshared ) == false ||
+          shared > key_.size() ||
+          in.size() < 1 + unshared ||
+          static_cast<uint8_t>( in.front() ) >
+            static_cast<uint8_t>( sstable_entry_type_t::inline_value )
+        )
+        {
+          corrupted_ = true;
+
+          return;
+        }
+
+        type_ = static_cast<sstable_entry_type_t>( static_cast<uint8_t>( in.front() ) );
+        in.remove_prefix( 1 );
+
+        key_.resize( shared );
+        key_.append( in.substr( 0, unshared ) );
+        in.remove_prefix( unshared );
+        value_ = {};
+
+        if( type_ == sstable_entry_type_t::inline_value )
+        {
+          uint64_t value_size;
+
+          if( take_varint( in, value_size ) == false || in.size() < value_size )
+          {
+            corrupted_ = true;
+
+            return;
+          }
+
+          value_ = in.substr( 0, value_size );
+          in.remove_prefix( value_size );
+        }
+
+        position_ = records_.size() - in.size();
+        valid_ = true;
+      }
+
+    private:
+      block_reader_t( std::string_view records, char const* restarts, uint32_t restarts_count )
+        : records_{ records }
+        , restarts_{ restarts }
+        , restarts_count_{ restarts_count }
+      {}
+
+      uint32_t restart( uint32_t i ) const
+      {
+        uint32_t offset;
+
+        std::memcpy( &offset, restarts_ + i * sizeof( uint32_t ), sizeof( offset ) );
+
+        return offset;
+      }
+
+      std::string_view records_;
+      char const* restarts_;
+      uint32_t restarts_count_;
+      size_t position_ = 0;
+      std::string key_;
+      sstable_entry_type_t type_ = sstable_entry_type_t::tombstone;
+      std::string_view value_;
+      bool valid_ = false;
+      bool corrupted_ = false;
+    };
+  }
+}
+
+#endif // SSTABLE_FORMAT_HPP_INCLUDED
@@ -7,39 +7,100 @@
 
 #include <seastar/core/seastar.hh>
 #include <seastar/core/fstream.hh>
+#include <seastar/core/smp.hh>
+#include <seastar/coroutine/parallel_for_each.hh>
 
-#include <csignal>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
 #include <iostream>
-#include <map>
 #include <ranges>
 #include <span>
-#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <tuple>
+#include <utility>
+
+#include "crc32c.hpp"
+#include "value_file_format.hpp"
 
 using namespace pkvs;
 
 namespace
 {
-  std::string file_name_from_key( std::string_view key )
+  constexpr std::string_view manifest_name = "MANIFEST";
+
+  // checksum from the trailer of a value file of the given size or
+  // std::nullopt for files without one
+  seastar::future<std::optional<uint32_t>> read_value_trailer( seastar::file& in_file, uint64_t size )
   {
-    // two hashes to remove the risk of a hash collision
-    size_t hash = std::hash<std::string_view>{}( key );
-    auto reverse = key | std::views::reverse;
-    std::string reverse_key{ reverse.begin(), reverse.end() };
-    size_t reverse_hash = std::hash<std::string>{}( reverse_key );
+    if( size < value_file_format::trailer_size )
+      co_return std::nullopt;
+
+    auto tail =
+      co_await in_file.dma_read_exactly<char>( size - value_file_format::trailer_size, value_file_format::trailer_size );
 
-    return std::to_string( hash ) + '_' + std::to_string( reverse_hash );
+    co_return value_file_format::parse_trailer( { tail.get(), tail.size() } );
   }
 
-  enum class entry_type
+  // values staged by earlier runs are leftovers, the same on all shards so
+  // that a segment that moved to another shard keeps its staged values
+  uint64_t const run_id =
+    static_cast<uint64_t>( std::chrono::system_clock::now().time_since_epoch().count() );
+
+  // splits "<id><suffix>" names of sstable files
+  std::optional<std::pair<unsigned long, std::string_view>> parse_id( std::string_view name )
   {
-    tombstone,
-    value
-  };
+    unsigned long id;
+    auto [ last, error ] = std::from_chars( name.data(), name.data() + name.size(), id );
+
+    if( error != std::errc{} || last == name.data() )
+      return std::nullopt;
+
+    return std::pair{ id, name.substr( last - name.data() ) };
+  }
+
+  std::string file_name_from_key( key_hash_t key_hash, std::string_view key )
+  {
+    if( key_hash == key_hash_t::std_hash )
+    {
+      // two hashes to remove the risk of a hash collision
+      size_t hash = std::hash<std::string_view>{}( key );
+      auto reverse = key | std::views::reverse;
+      std::string reverse_key{ reverse.begin(), reverse.end() };
+      size_t reverse_hash = std::hash<std::string>{}( reverse_key );
+
+      return std::to_string( hash ) + '_' + std::to_string( reverse_hash );
+    }
+
+    // 128 bits from two seeds to remove the risk of a hash collision, the
+    // name is written in place so that no temporaries are allocated
+    std::string name( 2 * 16 + 1, '0' );
+    auto write_hex =
+      [ &name ]( size_t offset, uint64_t hash )
+      {
+        char buffer[ 16 ];
+        auto [ last, error ] = std::to_chars( buffer, buffer + sizeof( buffer ), hash, 16 );
 
-  constexpr size_t entry_size = sizeof( uint64_t ) + 256 + sizeof( uint32_t );
+        std::copy( buffer, last, name.data() + offset + ( sizeof( buffer ) - ( last - buffer ) ) );
+      };
+
+    write_hex( 0, xxh64( key ) );
+    name[ 16 ] = '_';
+    write_hex( 17, xxh64( key, 1 ) );
+
+    return name;
+  }
 }
 
-seastar::future<sstables_t> sstables_t::make( std::filesystem::path base_path )
+seastar::future<sstables_t> sstables_t::make
+(
+  std::filesystem::path base_path,
+  sstable_options_t options,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache,
+  bool remove_leftovers
+)
 {
   auto path = base_path / "sstables";
   auto values_dir = path / "values";
@@ -55,10 +116,22 @@ seastar::future<sstables_t> sstables_t::make( std::filesystem::path base_path )
   if( co_await seastar::file_exists( values_dir.native() ) == false )
     co_await seastar::make_directory( values_dir.native() );
 
-  std::vector<unsigned long> sstables;
+  std::optional<manifest_t> manifest;
 
   if( sstables_dir_existed_before )
+    manifest = co_await read_manifest( path );
+
+  // leftovers are only looked for once the segment is running unless the
+  // directory has to be listed anyway
+  bool leftovers_removed = remove_leftovers == false;
+
+  if( sstables_dir_existed_before && manifest == std::nullopt )
   {
+    // sstables directories of older versions don't have a manifest
+    manifest = manifest_t{};
+
+    std::vector<std::string> unfinished;
+
     auto dir = co_await seastar::open_directory( path.native() );
     auto lister = dir.experimental_list_directory();
 
@@ -67,188 +140,641 @@ seastar::future<sstables_t> sstables_t::make( std::filesystem::path base_path )
       {
         while( auto de = co_await lister() )
         {
-          if( de->name != "values")
-            sstables.push_back( std::stoul( de->name ) ); // assuming directory is not poluted by an external entity
+          std::string_view name = de->name;
+
+          if( name.ends_with( ".tmp" ) )
+          {
+            if( remove_leftovers )
+              unfinished.emplace_back( name );
+          }
+          else if( auto id = parse_id( name ); id && id->second.empty() )
+          {
+            manifest->sstables.push_back( id->first );
+            manifest->next_id = std::max( manifest->next_id, id->first + 1 );
+          }
+          // else values directory or sstable side file
         }
       }()
       .finally( [&]{ return dir.close(); } );
 
-    std::ranges::sort( sstables );
+    // leftovers of writes that were interrupted by app termination
+    for( auto const& name : unfinished )
+      co_await seastar::remove_file( ( path / name ).native() );
+
+    leftovers_removed = true;
+  }
+
+  std::vector< seastar::lw_shared_ptr<sstable_t> > sstables;
+
+  if( manifest )
+  {
+    sstables.resize( manifest->sstables.size() );
+
+    co_await seastar::coroutine::parallel_for_each(
+      std::views::iota( size_t{ 0 }, sstables.size() ),
+      [ & ]( size_t i ) -> seastar::future<>
+      {
+        sstables[ i ] = co_await sstable_t::open( path, manifest->sstables[ i ], options, file_cache, block_cache );
+      });
+
+    std::ranges::sort(
+      sstables,
+      []( auto const& a, auto const& b )
+      {
+        return std::tuple{ a->order(), a->id() } < std::tuple{ b->order(), b->id() };
+      });
   }
 
-  co_return sstables_t{ path, std::move( sstables ) };
+  sstables_t result{ path, options, file_cache, block_cache, std::move( sstables ) };
+
+  if( manifest )
+    result.next_id_ = std::max( result.next_id_, manifest->next_id );
+
+  result.first_run_id_ = result.next_id_;
+  result.leftovers_removed_ = leftovers_removed;
+
+  if( manifest && manifest->version == 0 && result.sstables_.empty() == false )
+    co_await result.write_manifest( result.sstables_ );
+
+  co_return result;
+}
+
+seastar::future<std::optional<sstables_t::manifest_t>> sstables_t::read_manifest( std::filesystem::path const& path )
+{
+  auto manifest_path = path / manifest_name;
+
+  if( co_await seastar::file_exists( manifest_path.native() ) == false )
+    co_return std::nullopt;
+
+  auto in_file = co_await seastar::open_file_dma( manifest_path.native(), seastar::open_flags::ro );
+  seastar::temporary_buffer<char> content;
+
+  co_await
+    [ & ] -> seastar::future<>
+    {
+      if( auto size = co_await in_file.size(); size > 0 )
+        content = co_await in_file.dma_read_exactly<char>( 0, size );
+    }()
+    .finally( [ & ]{ return in_file.close(); } );
+
+  std::string_view in{ content.get(), content.size() };
+  manifest_t manifest;
+
+  auto invalid =
+    [ & ]
+    {
+      return std::runtime_error( "invalid sstables manifest " + manifest_path.native() );
+    };
+
+  // lines of "<name> <number>"
+  while( in.empty() == false )
+  {
+    auto line_end = in.find( '\n' );
+
+    if( line_end == std::string_view::npos )
+      throw invalid();
+
+    auto line = in.substr( 0, line_end );
+    auto separator = line.find( ' ' );
+    uint64_t number = 0;
+
+    in.remove_prefix( line_end + 1 );
+
+    if( separator == std::string_view::npos )
+      throw invalid();
+
+    auto name = line.substr( 0, separator );
+    auto value = line.substr( separator + 1 );
+    auto [ last, error ] = std::from_chars( value.data(), value.data() + value.size(), number );
+
+    if( error != std::errc{} || last != value.data() + value.size() )
+      throw invalid();
+
+    if( name == "version" )
+      manifest.version = number;
+    else if( name == "next_id" )
+      manifest.next_id = number;
+    else if( name == "sstable" )
+      manifest.sstables.push_back( number );
+    else
+      throw invalid();
+  }
+
+  if( manifest.version != 1 )
+    throw invalid();
+
+  co_return manifest;
+}
+
+seastar::future<> sstables_t::write_manifest( std::vector< seastar::lw_shared_ptr<sstable_t> > const& sstables )
+{
+  std::string content = "version 1\nnext_id " + std::to_string( next_id_ ) + '\n';
+
+  for( auto const& current : sstables )
+    content += "sstable " + std::to_string( current->id() ) + '\n';
+
+  auto manifest_path = base_path_ / manifest_name;
+  auto temporary = manifest_path;
+  temporary += ".tmp";
+
+  auto out_file =
+    co_await seastar::open_file_dma
+    (
+      temporary.native(),
+      seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate
+    );
+  auto out_stream = co_await seastar::make_file_output_stream( out_file );
+
+  co_await
+    [ & ] -> seastar::future<>
+    {
+      co_await out_stream.write( content.data(), content.size() );
+      co_await out_stream.flush();
+      co_await out_file.flush();
+    }()
+    .finally(
+      seastar::coroutine::lambda(
+        [ & ] -> seastar::future<>
+        {
+          co_await out_stream.close();
+        }));
+
+  co_await seastar::rename_file( temporary.native(), manifest_path.native() );
+  co_await seastar::sync_directory( base_path_.native() );
+}
+
+seastar::future<> sstables_t::remove_leftovers()
+{
+  if( std::exchange( leftovers_removed_, true ) )
+    co_return;
+
+  // files of sstables that were compacted away or that were never added to
+  // the manifest before the previous run ended and files that earlier runs
+  // didn't finish writing
+  auto is_leftover =
+    [ this ]( std::string_view name )
+    {
+      if( name.starts_with( "value_" ) && name.ends_with( ".tmp" ) )
+        return name.starts_with( "value_" + std::to_string( run_id ) + '_' ) == false;
+
+      auto id = parse_id( name );
+
+      if( id == std::nullopt || id->first >= first_run_id_ )
+        return false;
+
+      if( id->second == ".tmp" || id->second == ".index.tmp" || id->second == ".filter.tmp" )
+        return true;
+
+      if( id->second.empty() == false && id->second != ".index" && id->second != ".filter" )
+        return false;
+
+      auto is_live = [ id ]( auto const& current ){ return current->id() == id->first; };
+
+      return std::ranges::none_of( sstables_, is_live ) && std::ranges::none_of( retired_, is_live );
+    };
+
+  std::vector<std::string> leftovers;
+
+  auto dir = co_await seastar::open_directory( base_path_.native() );
+  auto lister = dir.experimental_list_directory();
+
+  co_await
+    [&] -> seastar::future<>
+    {
+      while( auto de = co_await lister() )
+      {
+        if( is_leftover( de->name ) )
+          leftovers.emplace_back( de->name );
+      }
+    }()
+    .finally( [&]{ return dir.close(); } );
+
+  for( auto const& name : leftovers )
+  {
+    auto path = base_path_ / name;
+
+    block_cache_->evict( path );
+    co_await file_cache_->evict( path );
+    co_await seastar::remove_file( path.native() );
+  }
 }
 
 sstables_t::sstables_t
 (
   std::filesystem::path base_path,
-  std::vector<unsigned long>&& sstables
+  sstable_options_t options,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache,
+  std::vector< seastar::lw_shared_ptr<sstable_t> >&& sstables
 )
   : base_path_{ base_path }
-  , sstables_{ std::forward< std::vector<unsigned long> >( sstables) }
-{}
+  , options_{ options }
+  , file_cache_{ &file_cache }
+  , block_cache_{ &block_cache }
+  , sstables_{ std::move( sstables ) }
+  , next_id_{ 0 }
+  , value_files_lock_{ std::make_unique< seastar::semaphore >( 1 ) }
+  , manifest_lock_{ std::make_unique< seastar::semaphore >( 1 ) }
+{
+  for( auto const& current : sstables_ )
+    next_id_ = std::max( next_id_, current->id() + 1 );
+}
 
-seastar::future<std::optional<std::string>> sstables_t::get_item( std::string_view key )
+seastar::future<std::optional<sstable_record_t>> sstables_t::find
+(
+  sstable_t const& sstable,
+  std::string_view key
+)
 {
-  for( bool found = false; auto current : sstables_ | std::views::reverse )
+  if( sstable.may_contain( key ) == false )
   {
-    auto in_ss_table_file =
-      co_await seastar::open_file_dma
-      (
-        ( base_path_ / std::to_string( current ) ).native(),
-        seastar::open_flags::ro
-      );
-    auto in_sstable_stream = seastar::make_file_input_stream( in_ss_table_file );
+    ++stats_.bloom_filter_hits;
 
-    uint32_t type;
+    co_return std::nullopt;
+  }
 
-    co_await
-      [ & ] -> seastar::future<>
-      {
-        while( true )
-        {
-          auto read = co_await in_sstable_stream.read_up_to( entry_size );
+  auto record = co_await sstable.find( key );
 
-          if( read.size() == 0 )
-            co_return;
-          else if( read.size() != entry_size )
-          {
-            std::raise( SIGKILL );
-
-            throw
-              std::runtime_error
-              (
-                "sstables file corruption detected in " +
-                ( base_path_ / std::to_string( current ) ).native()
-              );
-          }
+  if( record == std::nullopt && sstable.has_bloom_filter() )
+    ++stats_.bloom_filter_false_positives;
 
-          uint64_t size = *reinterpret_cast< uint64_t const* >( read.get() );
-          std::string_view found_key{ read.get() + sizeof( uint64_t ), size };
+  co_return record;
+}
 
-          if( found_key == key )
-          {
-            type =
-              *reinterpret_cast< uint32_t const* >
-              (
-                read.get() + read.size() - sizeof( uint32_t )
-              );
-            found = true;
-
-            co_return;
-          }
-        }
-      }()
-      .finally( [ & ]{ return in_sstable_stream.close(); } );
+size_t sstables_t::bloom_filters_memory_footprint() const
+{
+  size_t size = 0;
 
-    if( found )
-    {
-      if( static_cast<entry_type>( type ) == entry_type::tombstone )
-        break;
+  for( auto const& current : sstables_ )
+    size += current->bloom_filter_memory_footprint();
 
-      auto in_file =
-        co_await seastar::open_file_dma
-        (
-          ( base_path_ / "values" / file_name_from_key( key ) ).native(),
-          seastar::open_flags::ro
-        );
-      auto in_stream = seastar::make_file_input_stream( in_file );
+  return size;
+}
 
-      std::stringstream input;
+seastar::future<std::optional<std::string>> sstables_t::get_item( std::string_view key )
+{
+  // copy so that a store that finishes in the meantime doesn't invalidate
+  // the iteration
+  auto sstables = sstables_;
 
+  for( auto const& current : sstables | std::views::reverse )
+  {
+    auto record = co_await find( *current, key );
 
-      co_await
-        [ & ] -> seastar::future<>
-        {
-          while( true )
-          {
-            auto read = co_await in_stream.read();
+    if( record == std::nullopt )
+      continue;
+    else if( record->type == sstable_entry_type_t::tombstone )
+      break;
+    else if( record->type == sstable_entry_type_t::inline_value )
+      co_return std::move( record->value );
 
-            if( read.size() == 0 )
-              co_return;
+    co_return co_await read_value_file( key );
+  }
 
-            input.write( read.get(), read.size() );
-          }
-        }()
-        .finally( [ & ]{ return in_stream.close(); } );
+  co_return std::nullopt;
+}
 
-      co_return input.str();
-    }
+seastar::future<std::optional<stored_value_t>> sstables_t::get_value( std::string_view key )
+{
+  auto sstables = sstables_;
+
+  for( auto const& current : sstables | std::views::reverse )
+  {
+    auto record = co_await find( *current, key );
+
+    if( record == std::nullopt )
+      continue;
+    else if( record->type == sstable_entry_type_t::tombstone )
+      break;
+    else if( record->type == sstable_entry_type_t::inline_value )
+      co_return stored_value_t{ std::move( record->value ), std::nullopt };
+
+    co_return co_await open_value_file( key );
   }
 
   co_return std::nullopt;
 }
 
-seastar::future<std::set<std::string>> sstables_t::sorted_keys()
+std::filesystem::path sstables_t::value_path( std::string_view key ) const
+{
+  return base_path_ / "values" / file_name_from_key( options_.key_hash, key );
+}
+
+seastar::future<std::string> sstables_t::read_value_file( std::string_view key )
 {
-  std::map< std::string, entry_type > keys;
+  auto path = value_path( key );
 
-  for( auto current : sstables_ )
+  if( auto cached = block_cache_->get( path, 0 ) )
+    co_return std::string{ cached->get(), cached->size() };
+
+  auto generation = value_files_generation_;
+  auto in_file = co_await file_cache_->get( path );
+  auto size = co_await in_file->size();
+
+  if( size == 0 )
   {
-    auto in_ss_table_file =
-      co_await seastar::open_file_dma
-      (
-        ( base_path_ / std::to_string( current ) ).native(),
-        seastar::open_flags::ro
-      );
-    auto in_sstable_stream = seastar::make_file_input_stream( in_ss_table_file );
+    if( options_.value_checksums )
+      throw corruption_error( path );
+
+    co_return std::string{};
+  }
+
+  auto content = co_await in_file->dma_read_exactly<char>( 0, size );
+
+  if( auto checksum = value_file_format::parse_trailer( { content.get(), content.size() } ) )
+  {
+    content.trim( content.size() - value_file_format::trailer_size );
+
+    if( options_.verify_checksums && crc32c( { content.get(), content.size() } ) != *checksum )
+      throw corruption_error( path );
+  }
+  else if( options_.value_checksums )
+    throw corruption_error( path );
+
+  if( generation == value_files_generation_ )
+    block_cache_->put( path, 0, content.share() );
+
+  co_return std::string{ content.get(), content.size() };
+}
+
+seastar::future<stored_value_t> sstables_t::open_value_file( std::string_view key )
+{
+  auto path = value_path( key );
+  // not taken from the file cache as the handle is passed to other shards
+  auto in_file = co_await seastar::open_file_dma( path.native(), seastar::open_flags::ro );
+  stored_value_t value{ {}, in_file.dup(), co_await in_file.size() };
+
+  if( auto checksum = co_await read_value_trailer( in_file, value.size ) )
+  {
+    value.size -= value_file_format::trailer_size;
+
+    if( options_.verify_checksums )
+      value.checksum = checksum;
+  }
+  else if( options_.value_checksums )
+    throw corruption_error( path );
+
+  co_return value;
+}
+
+std::filesystem::path sstables_t::staging_path()
+{
+  static thread_local uint64_t next_staging_id = 0;
+
+  return
+    base_path_ /
+    (
+      "value_" + std::to_string( run_id ) + '_' + std::to_string( seastar::this_shard_id() ) + '_' +
+      std::to_string( next_staging_id++ ) + ".tmp"
+    );
+}
+
+seastar::future<> sstables_t::install_value_file
+(
+  std::string key,
+  std::filesystem::path staged,
+  std::function< void () > on_installed
+)
+{
+  return replace_value_file( std::move( key ), std::move( staged ), {}, std::move( on_installed ) );
+}
+
+seastar::future<> sstables_t::replace_value_file
+(
+  std::string key,
+  std::filesystem::path staged,
+  std::function< bool () > obsolete,
+  std::function< void () > on_installed
+)
+{
+  auto path = value_path( key );
+  auto units = co_await seastar::get_units( *value_files_lock_, 1 );
+
+  if( obsolete && obsolete() )
+  {
+    units.return_all();
+
+    co_await seastar::remove_file( staged.native() );
+    co_return;
+  }
+
+  co_await seastar::rename_file( staged.native(), path.native() );
+
+  // handles and blocks of the replaced file are stale
+  ++value_files_generation_;
+  block_cache_->evict( path );
+  co_await file_cache_->evict( path );
+
+  if( on_installed )
+    on_installed();
+
+  units.return_all();
+
+  co_await seastar::sync_directory( path.parent_path().native() );
+}
+
+seastar::future<scrub_result_t> sstables_t::scrub()
+{
+  scrub_result_t result;
+  // copy keeps the sstables from being removed by compaction while they are
+  // verified
+  auto sstables = sstables_;
+
+  for( auto const& current : sstables )
+  {
+    ++result.files;
+
+    try
+    {
+      co_await current->verify();
+    }
+    catch( corruption_error const& e )
+    {
+      std::cerr << "scrub: " << e.what() << '\n';
+      ++result.corrupted;
+    }
+  }
+
+  auto values_dir = base_path_ / "values";
+  std::vector<std::string> names;
+
+  auto dir = co_await seastar::open_directory( values_dir.native() );
+  auto lister = dir.experimental_list_directory();
+
+  co_await
+    [&] -> seastar::future<>
+    {
+      while( auto de = co_await lister() )
+        names.push_back( std::move( de->name ) );
+    }()
+    .finally( [&]{ return dir.close(); } );
+
+  for( auto const& name : names )
+  {
+    auto path = values_dir / name;
+    seastar::file in_file;
+
+    // value files are removed once their key is overwritten or deleted
+    try
+    {
+      in_file = co_await seastar::open_file_dma( path.native(), seastar::open_flags::ro );
+    }
+    catch( std::system_error const& )
+    {
+      continue;
+    }
+
+    ++result.files;
+
+    bool corrupted = false;
 
     co_await
-      [ & ] -> seastar::future<>
+      [&] -> seastar::future<>
       {
-        while( true )
+        auto size = co_await in_file.size();
+        auto checksum = co_await read_value_trailer( in_file, size );
+
+        // only stores from before checksums can have files without them
+        if( checksum == std::nullopt )
         {
-          auto read = co_await in_sstable_stream.read_up_to( entry_size );
+          corrupted = options_.value_checksums;
+
+          co_return;
+        }
+
+        uint32_t crc = 0;
+        auto in = seastar::make_file_input_stream( in_file, 0, size - value_file_format::trailer_size );
 
-          if( read.size() == 0 )
-            co_return;
-          else if( read.size() != entry_size )
+        co_await
+          [&] -> seastar::future<>
           {
-            std::raise( SIGKILL );
-
-            throw
-              std::runtime_error
-              (
-                "sstables file corruption detected in " +
-                ( base_path_ / std::to_string( current ) ).native()
-              );
-          }
+            while( true )
+            {
+              auto buffer = co_await in.read();
 
-          uint64_t size = *reinterpret_cast< uint64_t const* >( read.get() );
-          std::string found_key{ read.get() + sizeof( uint64_t ), size };
-          uint32_t type =
-            *reinterpret_cast< uint32_t const* >
-            (
-              read.get() + read.size() - sizeof( uint32_t )
-            );
+              if( buffer.empty() )
+                break;
 
-          keys[ found_key ] = static_cast<entry_type>( type );
-        }
+              crc = crc32c( { buffer.get(), buffer.size() }, crc );
+            }
+          }()
+          .finally( [&]{ return in.close(); } );
+
+        corrupted = crc != *checksum;
       }()
-      .finally( [ & ]{ return in_sstable_stream.close(); } );
+      .finally( [&]{ return in_file.close(); } );
+
+    if( corrupted )
+    {
+      std::cerr << "scrub: " << corruption_error( path ).what() << '\n';
+      ++result.corrupted;
+    }
   }
 
-  std::set< std::string > return_keys;
+  co_return result;
+}
+
+sstables_t::range_reader_t sstables_t::make_range_reader( std::string_view start ) const
+{
+  return range_reader_t{ sstables_, start };
+}
 
-  for( auto const& item : keys )
+sstables_t::range_reader_t::range_reader_t
+(
+  std::vector< seastar::lw_shared_ptr<sstable_t> > const& sstables,
+  std::string_view start
+)
+{
+  cursors_.reserve( sstables.size() );
+
+  for( size_t i = 0; i < sstables.size(); ++i )
+    cursors_.emplace_back( sstable_t::make_reader( sstables[ i ], start ), std::nullopt, i );
+}
+
+bool sstables_t::range_reader_t::lower_priority( cursor_t const& a, cursor_t const& b )
+{
+  return
+    a.current->key > b.current->key ||
+    ( a.current->key == b.current->key && a.age < b.age );
+}
+
+seastar::future<> sstables_t::range_reader_t::advance_back()
+{
+  auto& cursor = cursors_.back();
+
+  cursor.current = co_await cursor.reader.next();
+
+  if( cursor.current != std::nullopt )
+    std::push_heap( cursors_.begin(), cursors_.end(), lower_priority );
+  else
+    cursors_.pop_back();
+}
+
+seastar::future<std::optional<std::string>> sstables_t::range_reader_t::next()
+{
+  if( primed_ == false )
   {
-    if( item.second == entry_type::value )
-      return_keys.insert( item.first );
+    primed_ = true;
+
+    auto pending = std::move( cursors_ );
+    cursors_.clear();
+
+    for( auto& cursor : pending )
+    {
+      cursor.current = co_await cursor.reader.next();
+
+      if( cursor.current != std::nullopt )
+        cursors_.push_back( std::move( cursor ) );
+    }
+
+    std::make_heap( cursors_.begin(), cursors_.end(), lower_priority );
   }
 
-  co_return return_keys;
+  while( cursors_.empty() == false )
+  {
+    std::pop_heap( cursors_.begin(), cursors_.end(), lower_priority );
+
+    auto record = std::move( cursors_.back().current.value() );
+
+    co_await advance_back();
+
+    // older versions of the same key are shadowed by the newest one
+    while( cursors_.empty() == false && cursors_.front().current->key == record.key )
+    {
+      std::pop_heap( cursors_.begin(), cursors_.end(), lower_priority );
+      co_await advance_back();
+    }
+
+    if( record.type != sstable_entry_type_t::tombstone )
+      co_return std::move( record.key );
+  }
+
+  co_return std::nullopt;
 }
 
-seastar::future<> sstables_t::store( std::span< sstable_item_t > items )
+seastar::future<> sstables_t::store( std::span< sstable_item_t > items, key_predicate_t superseded )
 {
+  auto is_inline =
+    [ this ]( sstable_item_t const& item )
+    {
+      return item.in_value_file == false && item.value->size() <= options_.inline_value_threshold;
+    };
+
   for( auto const& item : items )
   {
-    if( item.value != std::nullopt )
+    if
+    (
+      item.value != std::nullopt &&
+      item.in_value_file == false &&
+      is_inline( item ) == false &&
+      ( superseded == nullptr || superseded( item.key ) == false )
+    )
     {
+      auto staged = staging_path();
       auto out_file =
         co_await seastar::open_file_dma
         (
-          ( base_path_ / "values" / file_name_from_key( item.key ) ).native(),
+          staged.native(),
           seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate
         );
       auto out_stream = co_await seastar::make_file_output_stream( out_file );
@@ -257,63 +783,205 @@ seastar::future<> sstables_t::store( std::span< sstable_item_t > items )
         [&] -> seastar::future<>
         {
           auto const& value = item.value.value();
+          std::string trailer;
+
+          value_file_format::append_trailer( trailer, crc32c( value ) );
 
           co_await out_stream.write( value.data(), value.size() );
+          co_await out_stream.write( trailer );
+          co_await out_stream.flush();
+          // the commit log that holds the value is discarded after the flush
+          co_await out_file.flush();
         }()
         .finally(
           seastar::coroutine::lambda(
             [ & ] -> seastar::future<>
             {
-              co_await out_stream.flush();
               co_await out_stream.close();
             }));
+
+      // a newer write could have replaced the value file in the meantime
+      co_await
+        replace_value_file(
+          item.key,
+          staged,
+          [ & ]{ return superseded != nullptr && superseded( item.key ); },
+          {} );
     }
   }
 
-  unsigned long next = sstables_.empty() ? 0 : sstables_.back() + 1;
+  unsigned long next = next_id_++;
 
-  auto out_ss_table_file =
-    co_await seastar::open_file_dma
-    (
-      ( base_path_ / std::to_string( next ) ).native(),
-      seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate
-    );
-  auto out_sstable_stream = co_await seastar::make_file_output_stream( out_ss_table_file );
+  auto writer =
+    co_await sstable_writer_t::make( base_path_, next, next, options_, *file_cache_, *block_cache_ );
+  std::exception_ptr failure;
 
-  co_await
-    [&] -> seastar::future<>
+  try
+  {
+    for( auto const& item : items )
     {
-      for( auto const& item : items )
-      {
-        std::string fill( 256 - item.key.size(), ' ' );
+      if( item.value == std::nullopt )
+        co_await writer.add( item.key, sstable_entry_type_t::tombstone );
+      else if( is_inline( item ) )
+        co_await writer.add( item.key, sstable_entry_type_t::inline_value, item.value.value() );
+      else
+        co_await writer.add( item.key, sstable_entry_type_t::value );
+    }
+  }
+  catch( ... )
+  {
+    failure = std::current_exception();
+  }
+
+  if( failure )
+  {
+    co_await writer.abort();
+    std::rethrow_exception( failure );
+  }
+
+  // the manifest and the list of sstables change together
+  auto units = co_await seastar::get_units( *manifest_lock_, 1 );
+  auto sstables = sstables_;
+
+  sstables.push_back( co_await writer.finish() );
+  co_await write_manifest( sstables );
+  sstables_ = std::move( sstables );
+}
+
+seastar::future<> sstables_t::try_merge_oldest( key_predicate_t value_file_in_use )
+{
+  co_await remove_retired();
+
+  if( compaction_ == nullptr )
+  {
+    auto plan = pick_compaction( options_.compaction_strategy, sstables_ );
+
+    if( plan == std::nullopt )
+      co_return;
+
+    compaction_ =
+      std::make_unique< compaction_t >(
+        co_await compaction_t::make(
+          base_path_,
+          next_id_++,
+          options_,
+          *file_cache_,
+          *block_cache_,
+          { sstables_.begin() + plan->first, sstables_.begin() + plan->last + 1 },
+          plan->first == 0 ) );
+  }
+
+  std::exception_ptr failure;
+  bool done = false;
+
+  try
+  {
+    done = co_await compaction_->step( options_.compaction_io_budget );
+
+    if( done )
+      co_await finish_compaction( std::move( value_file_in_use ) );
+  }
+  catch( ... )
+  {
+    failure = std::current_exception();
+  }
+
+  if( failure )
+  {
+    std::cerr << "compaction in " << base_path_ << " failed: " << failure << '\n';
+
+    if( auto compaction = std::move( compaction_ ) )
+      co_await compaction->abort();
+  }
+}
+
+seastar::future<> sstables_t::finish_compaction( key_predicate_t value_file_in_use )
+{
+  auto output = co_await compaction_->finish();
+  auto compaction = std::move( compaction_ );
+  auto const& inputs = compaction->inputs();
+  auto manifest_units = co_await seastar::get_units( *manifest_lock_, 1 );
+  auto sstables = sstables_;
+
+  // inputs are still contiguous as new sstables are only appended
+  auto first = std::ranges::find( sstables, inputs.front() );
+  auto position = sstables.erase( first, first + inputs.size() );
 
-        uint32_t type =
-          static_cast<uint32_t>(
-            item.value == std::nullopt ?
-            entry_type::tombstone :
-            entry_type::value );
+  if( output != nullptr )
+    position = sstables.insert( position, output ) + 1;
 
-        uint64_t size = item.key.size();
+  std::vector< seastar::lw_shared_ptr<sstable_t> > newer{ position, sstables.end() };
 
-        co_await out_sstable_stream.write( reinterpret_cast<const char*>(&size), sizeof( size ) );
-        co_await out_sstable_stream.write( item.key.c_str(), size );
-        co_await out_sstable_stream.write( fill.c_str(), 256 - item.key.size() );
-        co_await out_sstable_stream.write( reinterpret_cast<const char*>(&type), sizeof( type ) );
+  // inputs are only removed once the manifest no longer lists them
+  co_await write_manifest( sstables );
+  sstables_ = std::move( sstables );
+  manifest_units.return_all();
+
+  ++stats_.compactions;
+  stats_.compaction_bytes_read += compaction->bytes_read();
+  retired_.insert( retired_.end(), inputs.begin(), inputs.end() );
+
+  // value files of keys that were deleted or overwritten with an inline
+  // value are no longer needed unless a newer sstable or a write that wasn't
+  // flushed yet points to a value file again (newer value files reuse the
+  // same file name)
+  auto units = co_await seastar::get_units( *value_files_lock_, 1 );
+
+  for( auto const& key : compaction->orphaned_value_keys() )
+  {
+    bool referenced = false;
+
+    for( auto const& current : newer | std::views::reverse )
+    {
+      if( current->may_contain( key ) == false )
+        continue;
+
+      if( auto record = co_await current->find( key ) )
+      {
+        referenced = record->type == sstable_entry_type_t::value;
+
+        break;
       }
-    }()
-    .finally(
-      seastar::coroutine::lambda(
-        [ & ] -> seastar::future<>
-        {
-          co_await out_sstable_stream.flush();
-          co_await out_sstable_stream.close();
-        }));
+    }
 
-  sstables_.push_back( next );
+    if( referenced == false && value_file_in_use != nullptr )
+      referenced = value_file_in_use( key );
+
+    auto path = value_path( key );
+
+    if( referenced == false && co_await seastar::file_exists( path.native() ) )
+    {
+      ++value_files_generation_;
+      block_cache_->evict( path );
+      co_await file_cache_->evict( path );
+      co_await seastar::remove_file( path.native() );
+    }
+  }
+
+  units.return_all();
+  compaction.reset();
+
+  co_await remove_retired();
+}
+
+seastar::future<> sstables_t::remove_retired()
+{
+  auto retired = std::move( retired_ );
+  retired_.clear();
+
+  for( auto& current : retired )
+  {
+    if( current.use_count() == 1 )
+      co_await current->remove();
+    else
+      retired_.push_back( std::move( current ) );
+  }
 }
 
-seastar::future<> sstables_t::try_merge_oldest()
+seastar::future<> sstables_t::stop()
 {
-  // TODO implement
-  return seastar::make_ready_future<>();
-}
\ No newline at end of file
+  if( auto compaction = std::move( compaction_ ) )
+    co_await compaction->abort();
+
+  co_await remove_retired();
+}
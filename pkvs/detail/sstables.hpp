@@ -6,42 +6,245 @@
 #ifndef SSTABLES_HPP_INCLUDED
 #define SSTABLES_HPP_INCLUDED
 
+#include <seastar/core/file.hh>
 #include <seastar/core/future.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_ptr.hh>
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <optional>
-#include <set>
 #include <string>
 #include <vector>
 
+#include "compaction.hpp"
+#include "sstable.hpp"
+
 namespace pkvs
 {
   struct sstable_item_t
   {
     std::string key;
     std::optional<std::string> value;
+    // value was already written to its value file (value is empty)
+    bool in_value_file = false;
   };
 
+  // value of a key for replies that are streamed - values that are kept in
+  // memory anyway are returned directly while value files are opened so that
+  // they can be read in chunks on any shard
+  struct stored_value_t
+  {
+    std::string value;
+    std::optional<seastar::file_handle> file;
+    // size of the value in the file (without the trailer) and its checksum
+    // if it has one and reads are verified
+    uint64_t size = 0;
+    std::optional<uint32_t> checksum;
+  };
+
+  // returns true for keys that a newer write (not yet in sstables) already
+  // replaced or which reference their value file
+  using key_predicate_t = std::function< bool ( std::string_view key ) >;
+
+  struct sstables_stats_t
+  {
+    // point reads that skipped an sstable because of its bloom filter
+    uint64_t bloom_filter_hits = 0;
+    // point reads that read an sstable block and didn't find the key
+    uint64_t bloom_filter_false_positives = 0;
+    uint64_t compactions = 0;
+    uint64_t compaction_bytes_read = 0;
+  };
+
+  struct scrub_result_t
+  {
+    uint64_t files = 0;
+    uint64_t corrupted = 0;
+  };
+
+  // sstables of a single segment
+  //
+  // the MANIFEST file of the sstables directory lists the live sstables so
+  // that the directory doesn't have to be listed on startup, it is replaced
+  // atomically whenever sstables are added or compacted away
+  //
+  // manifest layout: lines of "<name> <number>" - "version 1", "next_id <id>"
+  //                  and "sstable <id>" for every live sstable
   class sstables_t
   {
   public:
-    static seastar::future<sstables_t> make( std::filesystem::path base_path );
+    // lazy k-way merge of sstables that yields keys of live records in
+    // ascending order, holds on to the sstables so compaction can't remove
+    // them while they are read
+    class range_reader_t
+    {
+    public:
+      range_reader_t
+      (
+        std::vector< seastar::lw_shared_ptr<sstable_t> > const& sstables,
+        std::string_view start
+      );
+
+      // returns std::nullopt once all sstables were read
+      seastar::future<std::optional<std::string>> next();
+
+    private:
+      struct cursor_t
+      {
+        sstable_t::reader_t reader;
+        std::optional<sstable_record_t> current;
+        size_t age; // higher is newer
+      };
+
+      // heap order - smallest key first and newest first for equal keys
+      static bool lower_priority( cursor_t const& a, cursor_t const& b );
+
+      // moves the cursor at the back of cursors_ to its next record
+      seastar::future<> advance_back();
+
+      // heap of cursors that still have records once primed
+      std::vector<cursor_t> cursors_;
+      bool primed_ = false;
+    };
+
+    // sstables are opened concurrently, directories without a manifest
+    // (older versions) are listed instead and get one
+    //
+    // leftovers of interrupted writes are removed by remove_leftovers()
+    // unless they can still be in use - a segment that moved from another
+    // shard can have value uploads in progress that were staged by the
+    // previous owner
+    static seastar::future<sstables_t> make
+    (
+      std::filesystem::path base_path,
+      sstable_options_t options,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache,
+      bool remove_leftovers = true
+    );
 
     // contract: assert( key.empty() == false && key.size() < 256 );
     seastar::future<std::optional<std::string>> get_item( std::string_view key );
-    seastar::future<std::set<std::string>> sorted_keys();
+    // same as get_item but value files are opened instead of read
+    // contract: assert( key.empty() == false && key.size() < 256 );
+    seastar::future<std::optional<stored_value_t>> get_value( std::string_view key );
+    // reader over keys that are not less than start of the current sstables
+    range_reader_t make_range_reader( std::string_view start ) const;
+
+    // value files are replaced atomically so readers that already opened
+    // one keep seeing a complete value
+    //
+    // read_value_file fails with corruption_error if the value doesn't match
+    // its checksum, streamed values are verified by the reader as the value
+    // isn't read here
+    seastar::future<std::string> read_value_file( std::string_view key );
+    seastar::future<stored_value_t> open_value_file( std::string_view key );
+    // unique path in the same filesystem into which a value can be written
+    // before it's installed, leftovers of earlier runs are removed by
+    // remove_leftovers()
+    //
+    // unique within the process even if the instance is opened on multiple
+    // shards one after another
+    std::filesystem::path staging_path();
+    // moves the staged file into place as the value file of the key,
+    // on_installed is called right after the file was replaced before any
+    // other value file of this instance can be modified
+    seastar::future<> install_value_file
+    (
+      std::string key,
+      std::filesystem::path staged,
+      std::function< void () > on_installed
+    );
+
+    // value files of superseded keys are not written as a newer write will
+    // replace them anyway (and may have done so already)
+    seastar::future<> store( std::span< sstable_item_t > items, key_predicate_t superseded = {} );
+    // advances background compaction by at most compaction_io_budget bytes
+    // of input and starts a new compaction if none is in progress
+    //
+    // value files that are no longer referenced by sstables are only removed
+    // if value_file_in_use returns false for their key
+    seastar::future<> try_merge_oldest( key_predicate_t value_file_in_use = {} );
+    // verifies checksums of the live sstables and value files, corrupted
+    // files are reported to std::cerr and counted but left in place - value
+    // files written before checksums were added can't be verified
+    seastar::future<scrub_result_t> scrub();
+    // removes files that earlier runs didn't finish or didn't get to remove,
+    // only the first call lists the directory so it can run in the background
+    // after startup
+    seastar::future<> remove_leftovers();
+    // waits for compaction to stop and removes sstables that were compacted
+    // away, no reads may be in progress
+    seastar::future<> stop();
 
-    seastar::future<> store( std::span< sstable_item_t > items );
-    seastar::future<> try_merge_oldest();
+    sstables_stats_t const& stats() const { return stats_; }
+    size_t bloom_filters_memory_footprint() const;
 
   private:
+    struct manifest_t
+    {
+      // 0 for manifests that were built by listing the directory
+      uint64_t version = 0;
+      unsigned long next_id = 0;
+      std::vector<unsigned long> sstables;
+    };
+
     sstables_t
     (
       std::filesystem::path base_path,
-      std::vector<unsigned long>&& sstables
+      sstable_options_t options,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache,
+      std::vector< seastar::lw_shared_ptr<sstable_t> >&& sstables
+    );
+
+    // bloom filter checked lookup of a single sstable
+    seastar::future<std::optional<sstable_record_t>> find
+    (
+      sstable_t const& sstable,
+      std::string_view key
+    );
+
+    // std::nullopt if the directory has no manifest
+    static seastar::future<std::optional<manifest_t>> read_manifest( std::filesystem::path const& path );
+    seastar::future<> write_manifest( std::vector< seastar::lw_shared_ptr<sstable_t> > const& sstables );
+
+    std::filesystem::path value_path( std::string_view key ) const;
+    // staged file is removed instead if obsolete returns true once no other
+    // value file change is in progress
+    seastar::future<> replace_value_file
+    (
+      std::string key,
+      std::filesystem::path staged,
+      std::function< bool () > obsolete,
+      std::function< void () > on_installed
     );
+    seastar::future<> finish_compaction( key_predicate_t value_file_in_use );
+    // removes retired sstables that are no longer referenced by reads
+    seastar::future<> remove_retired();
 
     std::filesystem::path base_path_;
-    std::vector<unsigned long> sstables_;
+    sstable_options_t options_;
+    file_cache_t* file_cache_;
+    block_cache_t* block_cache_;
+    sstables_stats_t stats_;
+    // ordered from oldest to newest
+    std::vector< seastar::lw_shared_ptr<sstable_t> > sstables_;
+    unsigned long next_id_;
+    // sstables with lower ids were created by earlier runs
+    unsigned long first_run_id_ = 0;
+    bool leftovers_removed_ = false;
+    // changes whenever a value file is replaced so that reads which raced
+    // with the replacement don't put the old content into the block cache
+    uint64_t value_files_generation_ = 0;
+    // serializes replacing and removing of value files
+    std::unique_ptr< seastar::semaphore > value_files_lock_;
+    // serializes manifest updates together with the sstables_ changes
+    std::unique_ptr< seastar::semaphore > manifest_lock_;
+    std::unique_ptr< compaction_t > compaction_;
+    // compacted sstables that are waiting for in flight reads to complete
+    std::vector< seastar::lw_shared_ptr<sstable_t> > retired_;
   };
 }
 
@@ -0,0 +1,303 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "store_metadata.hpp"
+
+#include <seastar/core/coroutine.hh>
+#include <seastar/core/file.hh>
+#include <seastar/core/fstream.hh>
+#include <seastar/core/seastar.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+#include <charconv>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+using namespace pkvs;
+
+namespace
+{
+  std::filesystem::path metadata_path( std::filesystem::path const& directory )
+  {
+    return directory / "metadata";
+  }
+
+  // marker file names differ so that the commit log can share a directory
+  // with the data
+  std::filesystem::path data_marker_path( std::filesystem::path const& directory )
+  {
+    return directory / "data_directory";
+  }
+
+  std::filesystem::path commitlog_marker_path( std::filesystem::path const& directory )
+  {
+    return directory / "commitlog_directory";
+  }
+
+  // std::nullopt if the file doesn't exist
+  seastar::future<std::optional<std::string>> read_file( std::filesystem::path path )
+  {
+    if( co_await seastar::file_exists( path.native() ) == false )
+      co_return std::nullopt;
+
+    auto in_file = co_await seastar::open_file_dma( path.native(), seastar::open_flags::ro );
+    seastar::temporary_buffer<char> content;
+
+    co_await
+      [ & ] -> seastar::future<>
+      {
+        if( auto size = co_await in_file.size(); size > 0 )
+          content = co_await in_file.dma_read_exactly<char>( 0, size );
+      }()
+      .finally( [ & ]{ return in_file.close(); } );
+
+    co_return std::string{ content.get(), content.size() };
+  }
+
+  // replaces the file atomically
+  seastar::future<> write_file( std::filesystem::path path, std::string content )
+  {
+    auto temporary = path;
+    temporary += ".tmp";
+
+    auto out_file =
+      co_await seastar::open_file_dma
+      (
+        temporary.native(),
+        seastar::open_flags::wo | seastar::open_flags::create | seastar::open_flags::truncate
+      );
+    auto out_stream = co_await seastar::make_file_output_stream( out_file );
+
+    co_await
+      [ & ] -> seastar::future<>
+      {
+        co_await out_stream.write( content.data(), content.size() );
+      }()
+      .finally(
+        seastar::coroutine::lambda(
+          [ & ] -> seastar::future<>
+          {
+            co_await out_stream.flush();
+            co_await out_stream.close();
+          }));
+
+    co_await seastar::rename_file( temporary.native(), path.native() );
+    co_await seastar::sync_directory( path.parent_path().native() );
+  }
+
+  std::string data_marker( std::string_view store_id, size_t index )
+  {
+    return std::string{ store_id } + ' ' + std::to_string( index ) + '\n';
+  }
+
+  std::string commitlog_marker( std::string_view store_id )
+  {
+    return std::string{ store_id } + '\n';
+  }
+
+  size_t parse_number( std::string_view name, std::string_view value )
+  {
+    size_t number;
+    auto [ last, error ] = std::from_chars( value.data(), value.data() + value.size(), number );
+
+    if( error != std::errc{} || last != value.data() + value.size() )
+      throw std::runtime_error( "invalid store metadata value of " + std::string{ name } );
+
+    return number;
+  }
+
+  std::string_view to_string( key_hash_t key_hash )
+  {
+    switch( key_hash )
+    {
+    case key_hash_t::std_hash:
+      return "std_hash";
+    case key_hash_t::xxh64:
+      return "xxh64";
+    }
+
+    throw std::logic_error( "unknown key hash" );
+  }
+
+  key_hash_t parse_key_hash( std::string_view value )
+  {
+    if( value == "std_hash" )
+      return key_hash_t::std_hash;
+    else if( value == "xxh64" )
+      return key_hash_t::xxh64;
+
+    throw std::runtime_error( "unknown key hash in store metadata: " + std::string{ value } );
+  }
+
+  // stores that were created before the metadata file existed
+  store_metadata_t legacy_metadata()
+  {
+    return
+      {
+        .segments_count = default_segments_count,
+        .key_hash = key_hash_t::std_hash,
+        .data_directories_count = 1,
+        .value_checksums = false
+      };
+  }
+
+  store_metadata_t parse( std::string_view content )
+  {
+    auto metadata = legacy_metadata();
+
+    while( content.empty() == false )
+    {
+      auto line_end = content.find( '\n' );
+      auto line = content.substr( 0, line_end );
+
+      content.remove_prefix( line_end == std::string_view::npos ? content.size() : line_end + 1 );
+
+      if( line.empty() )
+        continue;
+
+      auto separator = line.find( ' ' );
+
+      if( separator == std::string_view::npos )
+        throw std::runtime_error( "invalid store metadata line: " + std::string{ line } );
+
+      auto name = line.substr( 0, separator );
+      auto value = line.substr( separator + 1 );
+
+      // unknown properties were written by a newer version that may store
+      // data in a way that this one doesn't understand
+      if( name == "segments_count" )
+        metadata.segments_count = parse_number( name, value );
+      else if( name == "key_hash" )
+        metadata.key_hash = parse_key_hash( value );
+      else if( name == "data_directories_count" )
+        metadata.data_directories_count = parse_number( name, value );
+      else if( name == "value_checksums" )
+        metadata.value_checksums = parse_number( name, value ) != 0;
+      else if( name == "store_id" )
+        metadata.store_id = value;
+      else if( name == "commitlog_directory" )
+        metadata.commitlog_directory = value;
+      else
+        throw std::runtime_error( "unknown store metadata property: " + std::string{ name } );
+    }
+
+    if( metadata.segments_count == 0 )
+      throw std::runtime_error( "invalid store metadata value of segments_count" );
+
+    if( metadata.data_directories_count == 0 )
+      throw std::runtime_error( "invalid store metadata value of data_directories_count" );
+
+    return metadata;
+  }
+}
+
+seastar::future<std::optional<store_metadata_t>> store_metadata_t::load( std::filesystem::path directory )
+{
+  auto content = co_await read_file( metadata_path( directory ) );
+
+  if( content == std::nullopt )
+  {
+    // segment directories are only created by stores that already exist
+    if( co_await seastar::file_exists( ( directory / "0" ).native() ) )
+      co_return legacy_metadata();
+
+    co_return std::nullopt;
+  }
+
+  co_return parse( *content );
+}
+
+seastar::future<> store_metadata_t::save( std::filesystem::path directory ) const
+{
+  std::string content =
+    "segments_count " + std::to_string( segments_count ) + "\n"
+    "key_hash " + std::string{ to_string( key_hash ) } + "\n"
+    "data_directories_count " + std::to_string( data_directories_count ) + "\n"
+    "value_checksums " + std::to_string( value_checksums ) + '\n';
+
+  if( store_id.empty() == false )
+    content += "store_id " + store_id + '\n';
+
+  if( commitlog_directory )
+    content += "commitlog_directory " + commitlog_directory->native() + '\n';
+
+  co_await write_file( metadata_path( directory ), std::move( content ) );
+}
+
+std::string pkvs::make_store_id()
+{
+  std::random_device random;
+  std::string id;
+
+  for( size_t i = 0; i < 4; ++i )
+  {
+    char part[ 9 ];
+    std::snprintf( part, sizeof( part ), "%08x", static_cast<unsigned>( random() ) );
+    id += part;
+  }
+
+  return id;
+}
+
+seastar::future<> pkvs::mark_store_directories
+(
+  std::string store_id,
+  std::vector<std::filesystem::path> data,
+  std::filesystem::path commitlog
+)
+{
+  for( size_t i = 0; i < data.size(); ++i )
+    co_await write_file( data_marker_path( data[ i ] ), data_marker( store_id, i ) );
+
+  co_await write_file( commitlog_marker_path( commitlog ), commitlog_marker( store_id ) );
+}
+
+seastar::future<> pkvs::check_store_directories
+(
+  std::string store_id,
+  std::vector<std::filesystem::path> data,
+  std::filesystem::path commitlog,
+  bool allow_unmarked
+)
+{
+  for( size_t i = 0; i < data.size(); ++i )
+  {
+    auto marker = co_await read_file( data_marker_path( data[ i ] ) );
+
+    // segments would be looked for in the wrong directories
+    if( marker ? *marker != data_marker( store_id, i ) : allow_unmarked == false )
+    {
+      throw
+        std::invalid_argument(
+          data[ i ].native() + " is not data directory " + std::to_string( i ) + " of store " + store_id );
+    }
+  }
+
+  auto marker = co_await read_file( commitlog_marker_path( commitlog ) );
+
+  // writes that were not flushed yet would not be replayed
+  if( marker ? *marker != commitlog_marker( store_id ) : allow_unmarked == false )
+    throw std::invalid_argument( commitlog.native() + " is not the commit log directory of store " + store_id );
+}
+
+seastar::future<std::optional<std::string>> pkvs::unfinished_store_id( std::filesystem::path first_data_directory )
+{
+  auto marker = co_await read_file( data_marker_path( first_data_directory ) );
+
+  if( marker == std::nullopt )
+    co_return std::nullopt;
+
+  // the first directory is the one with the metadata so any other position
+  // means that directories were passed in a different order
+  auto store_id = marker->substr( 0, marker->find( ' ' ) );
+
+  if( *marker == data_marker( store_id, 0 ) )
+    co_return store_id;
+
+  throw std::invalid_argument( first_data_directory.native() + " is a data directory of another store or not the first one" );
+}
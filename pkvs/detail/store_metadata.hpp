@@ -0,0 +1,83 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef STORE_METADATA_HPP_INCLUDED
+#define STORE_METADATA_HPP_INCLUDED
+
+#include <seastar/core/future.hh>
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "key_hash.hpp"
+
+namespace pkvs
+{
+  // amount of segments into which the key hash space of a new store is split
+  inline constexpr size_t default_segments_count = 256;
+
+  // properties of a store that are chosen when it is created and can't change
+  // afterwards as data on disk depends on them
+  //
+  // stored in the metadata file of the data directory as lines of
+  // "<name> <value>"
+  struct store_metadata_t
+  {
+    size_t segments_count = default_segments_count;
+    key_hash_t key_hash = key_hash_t::xxh64;
+    // amount of directories over which the segments are spread
+    size_t data_directories_count = 1;
+    // value files end with a checksum trailer, a value file without one is
+    // corrupted unless the store was created before trailers existed
+    bool value_checksums = true;
+    // random id with which the data and commit log directories are marked,
+    // empty for stores that were created before directories were marked
+    std::string store_id;
+    // only recorded by stores from before directories were marked, std::nullopt
+    // for the ones that kept it in the first data directory
+    std::optional<std::filesystem::path> commitlog_directory;
+
+    // std::nullopt for a new store, properties that a store was created
+    // without get the values that were used before they were recorded
+    static seastar::future<std::optional<store_metadata_t>> load( std::filesystem::path directory );
+
+    // replaces the metadata file atomically
+    seastar::future<> save( std::filesystem::path directory ) const;
+  };
+
+  std::string make_store_id();
+
+  // every data directory is marked with the store id and its position and
+  // the commit log directory with the store id so that directories which are
+  // passed in a different order or belong to another store are detected by
+  // content instead of by path and the store can be moved or restored from a
+  // backup into other paths
+  seastar::future<> mark_store_directories
+  (
+    std::string store_id,
+    std::vector<std::filesystem::path> data,
+    std::filesystem::path commitlog
+  );
+
+  // throws std::invalid_argument if a directory isn't marked as the one at
+  // the same position of the store, unmarked directories are only accepted
+  // when allow_unmarked is set
+  seastar::future<> check_store_directories
+  (
+    std::string store_id,
+    std::vector<std::filesystem::path> data,
+    std::filesystem::path commitlog,
+    bool allow_unmarked = false
+  );
+
+  // id of a store whose creation was interrupted after some of the
+  // directories were marked but before its metadata was saved, std::nullopt
+  // if the first data directory isn't marked
+  seastar::future<std::optional<std::string>> unfinished_store_id( std::filesystem::path first_data_directory );
+}
+
+#endif // STORE_METADATA_HPP_INCLUDED
@@ -0,0 +1,61 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef VALUE_FILE_FORMAT_HPP_INCLUDED
+#define VALUE_FILE_FORMAT_HPP_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "crc32c.hpp"
+
+// on disk encoding of value files
+//
+// the value followed by a trailer - uint32_t crc32c of the value and
+// uint64_t magic
+//
+// files written before checksums were added contain only the value - the
+// store metadata records whether such files can exist as a missing magic can
+// also be a corrupted tail
+namespace pkvs
+{
+  namespace value_file_format
+  {
+    // "PKVSVAL1"
+    inline constexpr uint64_t trailer_magic = 0x314C415653564b50;
+    inline constexpr size_t trailer_size = crc32c_size + sizeof( trailer_magic );
+
+    inline void append_trailer( std::string& out, uint32_t crc )
+    {
+      append_crc32c( out, crc );
+      out.append( reinterpret_cast<char const*>( &trailer_magic ), sizeof( trailer_magic ) );
+    }
+
+    // crc32c of the value or std::nullopt for files without a trailer
+    //
+    // contract: in holds the last min( trailer_size, file size ) bytes of
+    //           the file
+    inline std::optional<uint32_t> parse_trailer( std::string_view in )
+    {
+      uint64_t found_magic;
+
+      if( in.size() < trailer_size )
+        return std::nullopt;
+
+      in = in.substr( in.size() - trailer_size );
+      std::memcpy( &found_magic, in.data() + crc32c_size, sizeof( found_magic ) );
+
+      if( found_magic != trailer_magic )
+        return std::nullopt;
+
+      return read_crc32c( in.substr( 0, crc32c_size ) );
+    }
+  }
+}
+
+#endif // VALUE_FILE_FORMAT_HPP_INCLUDED
@@ -9,27 +9,71 @@
 
 #include <cassert>
 #include <filesystem>
+#include <map>
+#include <random>
+#include <ranges>
+#include <utility>
 
 using namespace pkvs;
 
+namespace
+{
+  // memtables are flushed at the latest once their oldest write is this old
+  constexpr std::chrono::milliseconds memtable_max_age{ 20000 };
+
+  // deadlines are spread over the last quarter of the max age so that
+  // instances which were written at the same time don't all flush at once
+  std::chrono::steady_clock::time_point next_flush_deadline()
+  {
+    thread_local std::minstd_rand random{ std::random_device{}() };
+    std::uniform_int_distribution< std::chrono::milliseconds::rep > jitter{ 0, memtable_max_age.count() / 4 };
+
+    return std::chrono::steady_clock::now() + memtable_max_age - std::chrono::milliseconds{ jitter( random ) };
+  }
+}
+
 seastar::future< pkvs_t > pkvs_t::make
 (
+  std::filesystem::path directory,
   size_t instance_no,
-  size_t memtable_memory_footprint_eviction_threshold
+  size_t memtable_memory_footprint_eviction_threshold,
+  sstable_options_t sstable_options,
+  file_cache_t& file_cache,
+  block_cache_t& block_cache,
+  commitlog_t& commitlog,
+  std::vector< commitlog_record_t > replayed,
+  bool remove_leftovers
 )
 {
-  auto root_pksv_data_dir = std::filesystem::current_path() / "pkvs_data";
-  auto root_instance_dir = root_pksv_data_dir / std::to_string( instance_no );
+  if( co_await seastar::file_exists( directory.native() ) == false )
+    co_await seastar::make_directory( directory.native() );
 
-  if( co_await seastar::file_exists( root_instance_dir.native() ) == false )
-    co_await seastar::make_directory( root_instance_dir.native() );
+  auto sstables =
+    co_await sstables_t::make( directory, sstable_options, file_cache, block_cache, remove_leftovers );
+
+  if( replayed.empty() == false )
+  {
+    // later records of the same key override the earlier ones
+    std::map< std::string, commitlog_record_t > latest;
+
+    for( auto& record : replayed )
+      latest.insert_or_assign( record.key, std::move( record ) );
+
+    std::vector<sstable_item_t> items;
+
+    for( auto& [ key, record ] : latest )
+      items.emplace_back( key, std::move( record.value ), record.in_value_file );
+
+    co_await sstables.store( items );
+  }
 
   co_return
     pkvs_t
     {
       instance_no,
       memtable_memory_footprint_eviction_threshold,
-      co_await sstables_t::make( root_instance_dir )
+      commitlog,
+      std::move( sstables )
     };
 }
 
@@ -37,155 +81,390 @@ pkvs_t::pkvs_t
 (
   size_t instance_no,
   size_t memtable_memory_footprint_eviction_threshold,
+  commitlog_t& commitlog,
   sstables_t&& sstables_
 )
-  : memtable_{ std::make_unique< memtable_t >() }
-  , memtable_memory_footprint_eviction_threshold_{ memtable_memory_footprint_eviction_threshold }
-  , last_persist_time_{ std::chrono::system_clock::now() }
+  : memtable_memory_footprint_eviction_threshold_{ memtable_memory_footprint_eviction_threshold }
+  , instance_no_{ instance_no }
+  , commitlog_{ &commitlog }
   , sstables_{ std::forward< sstables_t >( sstables_ ) }
 {}
 
+void pkvs_t::log_written( uint64_t log_file_no )
+{
+  if( first_log_file_ == std::nullopt )
+  {
+    first_log_file_ = log_file_no;
+    flush_deadline_ = next_flush_deadline();
+  }
+}
+
+std::optional<uint64_t> pkvs_t::oldest_unflushed_log_file() const
+{
+  // log file numbers only grow so the oldest memtable pins the oldest file
+  for( auto const& immutable : immutable_memtables_ )
+  {
+    if( immutable->first_log_file )
+      return immutable->first_log_file;
+  }
+
+  return first_log_file_;
+}
+
+memtable_t::entry_t const* pkvs_t::find_in_memtables( std::string_view key ) const
+{
+  if( auto const* found = memtable_.find( key ) )
+    return found;
+
+  for( auto const& immutable : immutable_memtables_ | std::views::reverse )
+  {
+    if( auto const* found = immutable->memtable.find( key ) )
+      return found;
+  }
+
+  return nullptr;
+}
+
 seastar::future<std::optional<std::string>> pkvs_t::get_item( std::string_view key )
 {
   assert( key.empty() == false && key.size() < 256 );
 
-  auto& index = memtable_->get< key_index >();
+  ++load_stats_.reads;
 
-  if
-  (
-    auto found = index.find( entry_t{ key } );
-    found != index.end() && found->type != entry_type_t::tombstone
-  )
+  if( auto const* found = find_in_memtables( key ) )
   {
-    index.modify( found, []( auto& item ){ item.bump_last_access_time(); });
+    if( found->type() == entry_type_t::tombstone )
+      co_return std::nullopt;
+    else if( found->type() == entry_type_t::value )
+      co_return std::string{ found->content() };
 
-    co_return found->content;
+    co_return co_await sstables_.read_value_file( key );
   }
-  else
-  {
-    auto item = co_await sstables_.get_item( key );
 
-    if( item != std::nullopt )
-    {
-      auto& index = memtable_->get< key_index >();
+  // sstable reads are cached by the shard block cache so the memtable only
+  // holds writes
+  co_return co_await sstables_.get_item( key );
+}
+
+seastar::future<std::optional<stored_value_t>> pkvs_t::get_value( std::string_view key )
+{
+  assert( key.empty() == false && key.size() < 256 );
 
-      index.insert( entry_t{ key, item.value(), false } );
-      approximate_memtable_memory_footprint_ += key.size() + item.value().size();
+  ++load_stats_.reads;
 
-      co_return item;
-    }
+  if( auto const* found = find_in_memtables( key ) )
+  {
+    if( found->type() == entry_type_t::tombstone )
+      co_return std::nullopt;
+    else if( found->type() == entry_type_t::value )
+      co_return stored_value_t{ std::string{ found->content() }, std::nullopt };
+
+    co_return co_await sstables_.open_value_file( key );
   }
 
-  co_return std::nullopt;
+  co_return co_await sstables_.get_value( key );
+}
+
+std::filesystem::path pkvs_t::value_staging_path()
+{
+  return sstables_.staging_path();
 }
 
-void pkvs_t::insert_item( std::string_view key, std::string_view value )
+seastar::future<> pkvs_t::insert_value_file( std::string key, std::filesystem::path staged )
 {
   assert( key.empty() == false && key.size() < 256 );
 
-  has_dirty_ = true;
+  ++load_stats_.writes;
+  load_stats_.bytes_written += key.size();
 
-  auto& index = memtable_->get< key_index >();
+  // the pointer is added while no other value file change can happen so
+  // that a flush of an older value for the same key can't overwrite it
+  co_await
+    sstables_.install_value_file(
+      key,
+      std::move( staged ),
+      [ this, &key ]
+      {
+        memtable_.put_pointer( key );
 
-  if( auto found = index.find( entry_t{ key } ); found != index.end() )
-  {
-    approximate_memtable_memory_footprint_ -= found->content.size();
-    index.replace( found, entry_t{ key, value, true } );
-  }
-  else
-  {
-    index.insert( entry_t{ key, value, true } );
-    approximate_memtable_memory_footprint_ += key.size();
-  }
+        log_written( commitlog_->add_value_file( instance_no_, key ) );
+      });
 
-  approximate_memtable_memory_footprint_ += value.size();
+  co_await commitlog_->wait_durable();
 }
 
-void pkvs_t::delete_item( std::string_view key )
+seastar::future<> pkvs_t::insert_item( std::string_view key, std::string_view value )
 {
   assert( key.empty() == false && key.size() < 256 );
 
-  has_dirty_ = true;
+  ++load_stats_.writes;
+  load_stats_.bytes_written += key.size() + value.size();
 
-  auto& index = memtable_->get< key_index >();
+  memtable_.put( key, value );
 
-  if( auto found = index.find( entry_t{ key } ); found != index.end() )
-  {
-    approximate_memtable_memory_footprint_ -= found->content.size();
-    index.replace( found, entry_t::make_tombstone( key ) );
-  }
-  else
-  {
-    index.insert( entry_t::make_tombstone( key ) );
-    approximate_memtable_memory_footprint_ += key.size();
-  }
+  log_written( commitlog_->add( instance_no_, key, value ) );
+
+  return commitlog_->wait_durable();
 }
 
-seastar::future<std::set<std::string>> pkvs_t::sorted_keys()
+seastar::future<> pkvs_t::delete_item( std::string_view key )
 {
-  // FIXME race condition because of co_await (housekeeping can already evict
-  //       some keys while we're reading and then they are missing in memtable_)
-  //       prevent the race... introduce semaphor or something
-  std::set<std::string> keys = co_await sstables_.sorted_keys();
+  assert( key.empty() == false && key.size() < 256 );
 
-  for( auto const& item : memtable_->get< key_index >() )
-  {
-    if( item.type == entry_type_t::tombstone )
-      keys.erase( item.key );
-    else
-      keys.insert( item.key );
-  }
+  ++load_stats_.writes;
+  load_stats_.bytes_written += key.size();
 
-  co_return keys;
+  memtable_.put_tombstone( key );
+
+  log_written( commitlog_->add( instance_no_, key, std::nullopt ) );
+
+  return commitlog_->wait_durable();
 }
 
-seastar::future<> pkvs_t::housekeeping()
+seastar::future<std::vector<std::string>> pkvs_t::range( range_cursor_t& cursor, size_t limit )
 {
-  using namespace std::literals;
+  assert( limit > 0 );
+
+  auto in_range =
+    [ &cursor ]( std::string_view key )
+    {
+      return cursor.end_.empty() || key < cursor.end_;
+    };
 
-  if
-  (
-    approximate_memtable_memory_footprint_ > memtable_memory_footprint_eviction_threshold_ ||
-    std::chrono::system_clock::now() > last_persist_time_ + 20s
-  )
+  std::vector<std::string> keys;
+
+  while( keys.size() < limit && cursor.exhausted_ == false )
   {
-    if( has_dirty_ )
+    bool fresh_reader = false;
+
+    // made before memtables are copied and without a suspension point in
+    // between so that the two agree on which writes were flushed
+    if( cursor.reader_ == std::nullopt || cursor.flushes_ != flushes_ )
     {
-      std::vector<sstable_item_t> items;
+      cursor.reader_.emplace( sstables_.make_range_reader( cursor.start_ ) );
+      cursor.flushes_ = flushes_;
+      fresh_reader = true;
+    }
 
-      auto& index = memtable_->get< key_index >();
+    // memtable entries are copied before the first suspension point as the
+    // active memtable can be frozen and flushed while sstables are read, later
+    // memtables override the earlier ones and all of them override sstables
+    std::map< std::string, bool, std::less<> > overlay; // key -> live
+    // keys above it were not copied from every memtable
+    std::optional<std::string> boundary;
+    size_t wanted = limit - keys.size();
 
-      for( auto it = index.begin(); it != index.end(); ++it )
+    auto collect =
+      [ & ]( memtable_t const& memtable )
       {
-        auto const& item = *it;
+        size_t live = 0;
+        size_t total = 0;
+        std::string_view last;
 
-        if( item.dirty )
+        for( auto it = memtable.lower_bound( cursor.start_ ); it != memtable.end(); ++it )
         {
-          if( item.type == entry_type_t::tombstone )
-            items.emplace_back( item.key, std::nullopt );
-          else
-            items.emplace_back( item.key, item.content );
+          if( in_range( it->key() ) == false )
+            break;
+
+          // tombstones are bounded as well so that a mass delete can't make
+          // a single batch copy the whole memtable
+          if( live == wanted || total == wanted * 4 )
+          {
+            if( boundary == std::nullopt || last < *boundary )
+              boundary = std::string{ last };
+
+            break;
+          }
 
-          index.modify( it, []( auto& item ){ item.dirty = false; } );
+          bool is_live = it->type() != entry_type_t::tombstone;
+
+          overlay.insert_or_assign( std::string{ it->key() }, is_live );
+          last = it->key();
+          live += is_live;
+          ++total;
         }
+      };
+
+    for( auto const& immutable : immutable_memtables_ )
+      collect( immutable->memtable );
+
+    collect( memtable_ );
+
+    if( fresh_reader )
+      cursor.from_sstables_ = co_await cursor.reader_->next();
+
+    auto from_overlay = overlay.begin();
+
+    while( keys.size() < limit )
+    {
+      bool overlay_first =
+        from_overlay != overlay.end() &&
+        ( cursor.from_sstables_ == std::nullopt || from_overlay->first <= *cursor.from_sstables_ );
+      std::optional<std::string_view> key;
+
+      if( overlay_first )
+        key = from_overlay->first;
+      else if( cursor.from_sstables_ != std::nullopt )
+        key = *cursor.from_sstables_;
+
+      // memtable keys above the boundary are copied by the next round
+      if( key == std::nullopt || ( boundary != std::nullopt && *key > *boundary ) )
+      {
+        if( boundary == std::nullopt )
+          cursor.exhausted_ = true;
+        else
+          cursor.start_ = *boundary + '\0';
+
+        break;
       }
 
-      has_dirty_ = false;
+      if( in_range( *key ) == false )
+      {
+        cursor.exhausted_ = true;
+
+        break;
+      }
 
-      co_await sstables_.store( items );
+      std::string consumed;
+      bool live = true;
+
+      if( overlay_first )
+      {
+        if( cursor.from_sstables_ != std::nullopt && *cursor.from_sstables_ == from_overlay->first )
+          cursor.from_sstables_ = co_await cursor.reader_->next();
+
+        consumed = from_overlay->first;
+        live = from_overlay->second;
+        ++from_overlay;
+      }
+      else
+      {
+        consumed = std::move( *cursor.from_sstables_ );
+        cursor.from_sstables_ = co_await cursor.reader_->next();
+      }
+
+      // smallest key that is greater than the consumed one
+      cursor.start_ = consumed + '\0';
+
+      if( live )
+        keys.push_back( std::move( consumed ) );
     }
+  }
 
-    while( approximate_memtable_memory_footprint_ > memtable_memory_footprint_eviction_threshold_ )
-    {
-      auto& index = memtable_->get< last_accessed_index >();
+  // sstables are released once the cursor is exhausted
+  if( cursor.exhausted_ )
+    cursor.reader_.reset();
 
-      assert( index.begin() != index.end() );
+  co_return keys;
+}
 
-      auto first = index.begin();
+void pkvs_t::freeze_memtable()
+{
+  immutable_memtables_.push_back(
+    seastar::make_lw_shared< immutable_memtable_t >(
+      immutable_memtable_t
+      {
+        std::exchange( memtable_, memtable_t{} ),
+        std::exchange( first_log_file_, std::nullopt ),
+        next_immutable_seq_++
+      } ) );
+}
 
-      approximate_memtable_memory_footprint_ -= first->key.size() + first->content.size();
+seastar::future<> pkvs_t::flush_immutable_memtables()
+{
+  while( immutable_memtables_.empty() == false )
+  {
+    // only the oldest memtable is flushed at a time so that sstables keep
+    // the age order of memtables
+    auto immutable = immutable_memtables_.front();
+    std::vector<sstable_item_t> items;
+
+    items.reserve( immutable->memtable.size() );
 
-      memtable_->erase( memtable_->iterator_to( *first ) );
+    for( auto const& item : immutable->memtable )
+    {
+      if( item.type() == entry_type_t::tombstone )
+        items.emplace_back( std::string{ item.key() }, std::nullopt );
+      else if( item.type() == entry_type_t::pointer )
+        items.emplace_back( std::string{ item.key() }, std::string{}, true );
+      else
+        items.emplace_back( std::string{ item.key() }, std::string{ item.content() } );
     }
+
+    // value files of keys that were written again since are left alone as
+    // they belong to the newer write
+    auto superseded =
+      [ this, seq = immutable->seq ]( std::string_view key )
+      {
+        if( memtable_.find( key ) != nullptr )
+          return true;
+
+        for( auto const& newer : immutable_memtables_ )
+        {
+          if( newer->seq > seq && newer->memtable.find( key ) != nullptr )
+            return true;
+        }
+
+        return false;
+      };
+
+    // on failure the memtable stays frozen and the flush is retried by the
+    // next housekeeping pass
+    co_await sstables_.store( items, superseded );
+
+    immutable_memtables_.pop_front();
+    ++flushes_;
   }
+}
+
+seastar::future<> pkvs_t::housekeeping()
+{
+  // not done on startup so that opening the segment doesn't have to list its
+  // directory
+  co_await sstables_.remove_leftovers();
+  co_await sstables_.try_merge_oldest(
+    [ this ]( std::string_view key )
+    {
+      // values of writes that were not flushed yet may still need the file
+      auto const* found = find_in_memtables( key );
+
+      return found != nullptr && found->type() != entry_type_t::tombstone;
+    } );
+}
+
+bool pkvs_t::flush_due( std::chrono::steady_clock::time_point now ) const
+{
+  if( immutable_memtables_.empty() == false )
+    return true;
+
+  return
+    memtable_.empty() == false &&
+    (
+      memtable_.memory_footprint() > memtable_memory_footprint_eviction_threshold_ ||
+      now >= flush_deadline_
+    );
+}
+
+size_t pkvs_t::dirty_memory_footprint() const
+{
+  // an empty memtable can't be flushed to release its first chunk
+  size_t footprint = memtable_.empty() ? 0 : memtable_.memory_footprint();
+
+  for( auto const& immutable : immutable_memtables_ )
+    footprint += immutable->memtable.memory_footprint();
+
+  return footprint;
+}
+
+seastar::future<> pkvs_t::flush()
+{
+  if( memtable_.empty() == false )
+    freeze_memtable();
+
+  co_await flush_immutable_memtables();
+}
+
+seastar::future<> pkvs_t::stop()
+{
+  return sstables_.stop();
 }
\ No newline at end of file
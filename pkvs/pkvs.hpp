@@ -8,39 +8,156 @@
 
 #include <seastar/core/coroutine.hh>
 #include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
 #include <chrono>
+#include <deque>
+#include <filesystem>
 #include <memory>
 #include <optional>
-#include <set>
 #include <string>
 #include <string_view>
+#include <vector>
+#include "detail/commitlog.hpp"
 #include "detail/memtable.hpp"
 #include "detail/sstables.hpp"
 
 namespace pkvs
 {
+  // page of keys in ascending order
+  struct key_range_t
+  {
+    std::vector<std::string> keys;
+    // first key of the next page, std::nullopt once the range is exhausted
+    std::optional<std::string> next;
+  };
+
+  // position of a lazy scan over [start, end) of an instance (see
+  // pkvs_t::range) where an empty end is unbounded
+  //
+  // the sstable reader is kept between batches while memtables are copied a
+  // batch at a time, the cursor holds no references to the instance so it
+  // stays valid if the instance object is moved
+  class range_cursor_t
+  {
+  public:
+    range_cursor_t( std::string start, std::string end )
+      : start_{ std::move( start ) }
+      , end_{ std::move( end ) }
+    {}
+
+    bool exhausted() const { return exhausted_; }
+
+  private:
+    friend class pkvs_t;
+
+    // smallest key that was not returned yet
+    std::string start_;
+    std::string end_;
+    std::optional<sstables_t::range_reader_t> reader_;
+    // next key of reader_ which can't be put back
+    std::optional<std::string> from_sstables_;
+    // flushes of the instance when reader_ was made, a flush moves memtable
+    // entries into an sstable that reader_ doesn't know about
+    uint64_t flushes_ = 0;
+    bool exhausted_ = false;
+  };
+
+  // requests served by an instance, used to find segments worth moving to a
+  // less loaded shard
+  struct load_stats_t
+  {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t bytes_written = 0;
+  };
+
   class pkvs_t
   {
   public:
+    // replayed commit log records of this instance are flushed to sstables
+    // before the instance is returned
+    //
+    // instances that are moved from another shard are opened with
+    // remove_leftovers set to false (see sstables_t::make)
     static seastar::future< pkvs_t > make
     (
+      std::filesystem::path directory,
       size_t instance_no,
-      size_t memtable_memory_footprint_eviction_threshold
+      size_t memtable_memory_footprint_eviction_threshold,
+      sstable_options_t sstable_options,
+      file_cache_t& file_cache,
+      block_cache_t& block_cache,
+      commitlog_t& commitlog,
+      std::vector< commitlog_record_t > replayed,
+      bool remove_leftovers = true
     );
 
     // contract: assert( key.empty() == false && key.size() < 256 );
     seastar::future<std::optional<std::string>> get_item( std::string_view key );
+    // resolves once the write is durable according to the commit log sync mode
     // contract: assert( key.empty() == false && key.size() < 256 );
-    void insert_item( std::string_view key, std::string_view value );
+    seastar::future<> insert_item( std::string_view key, std::string_view value );
     // contract: assert( key.empty() == false && key.size() < 256 );
-    void delete_item( std::string_view key );
-    seastar::future<std::set<std::string>> sorted_keys();
+    seastar::future<> delete_item( std::string_view key );
 
-    // takes care of writes of data to disk etc. and should be called periodically
+    // same as get_item but values that are stored in value files are opened
+    // instead of read so that they can be streamed
+    // contract: assert( key.empty() == false && key.size() < 256 );
+    seastar::future<std::optional<stored_value_t>> get_value( std::string_view key );
+    // path to which a large value can be written before it is inserted with
+    // insert_value_file - the file has to be durable before it is inserted
+    std::filesystem::path value_staging_path();
+    // makes the staged file the value of the key without copying it
+    // contract: assert( key.empty() == false && key.size() < 256 );
+    seastar::future<> insert_value_file( std::string key, std::filesystem::path staged );
+    // next at most limit keys of the cursor in ascending order, fewer only
+    // once the cursor is exhausted
+    //
+    // memory use is bounded by limit as memtables and sstables are merged
+    // lazily, calls for the same cursor must not overlap
+    seastar::future<std::vector<std::string>> range( range_cursor_t& cursor, size_t limit );
+
+    // takes care of sstable maintenance (compaction, removal of leftover
+    // files) and should be called periodically
     seastar::future<> housekeeping();
+    // verifies checksums of the sstables and value files on disk (see
+    // sstables_t::scrub) - should be called periodically and rarely as it
+    // reads everything
+    seastar::future<scrub_result_t> scrub() { return sstables_.scrub(); }
+    // true once the active memtable grew over the threshold or got old
+    // enough or if an earlier flush failed - flushes are scheduled by the
+    // owner of the instance so that not all instances flush at once
+    bool flush_due( std::chrono::steady_clock::time_point now ) const;
+    // freezes the active memtable and flushes all memtables to sstables,
+    // writes continue in the new active memtable in the meantime
+    seastar::future<> flush();
+    seastar::future<> stop();
     size_t approximate_memtable_memory_footprint() const
     {
-      return approximate_memtable_memory_footprint_;
+      return memtable_.memory_footprint();
+    }
+    // memory of the active and frozen memtables that a flush would free
+    size_t dirty_memory_footprint() const;
+    // the owner splits its memory budget between instances
+    void set_memtable_memory_footprint_eviction_threshold( size_t threshold )
+    {
+      memtable_memory_footprint_eviction_threshold_ = threshold;
+    }
+    size_t memtable_memory_footprint_eviction_threshold() const
+    {
+      return memtable_memory_footprint_eviction_threshold_;
+    }
+
+    // number of the oldest commit log file that still contains writes which
+    // were not flushed to sstables yet
+    std::optional<uint64_t> oldest_unflushed_log_file() const;
+
+    size_t instance_no() const { return instance_no_; }
+    load_stats_t const& load_stats() const { return load_stats_; }
+    sstables_stats_t const& sstables_stats() const { return sstables_.stats(); }
+    size_t bloom_filters_memory_footprint() const
+    {
+      return sstables_.bloom_filters_memory_footprint();
     }
 
   private:
@@ -48,16 +165,44 @@ namespace pkvs
     (
       size_t instance_no,
       size_t memtable_memory_footprint_eviction_threshold,
+      commitlog_t& commitlog,
       sstables_t&& sstables_
     );
 
-    // FIXME std::unique_ptr is a ugly quick workaround to make pkvs_t nothrow move constructible
-    std::unique_ptr< memtable_t > memtable_;
+    struct immutable_memtable_t
+    {
+      memtable_t memtable;
+      // oldest commit log file with writes of this memtable
+      std::optional<uint64_t> first_log_file;
+      // increases with every frozen memtable
+      uint64_t seq;
+    };
+
+    using immutable_memtable_ptr_t = seastar::lw_shared_ptr< immutable_memtable_t >;
+
+    // newest memtable entry of the key or nullptr
+    memtable_t::entry_t const* find_in_memtables( std::string_view key ) const;
+    void log_written( uint64_t log_file_no );
+    void freeze_memtable();
+    seastar::future<> flush_immutable_memtables();
+
+    memtable_t memtable_;
+    // frozen memtables waiting to be flushed ordered from oldest to newest,
+    // shared with reads that are iterating over them
+    std::deque< immutable_memtable_ptr_t > immutable_memtables_;
+    uint64_t next_immutable_seq_ = 0;
+    // frozen memtables that were flushed to sstables, see range_cursor_t
+    uint64_t flushes_ = 0;
     size_t memtable_memory_footprint_eviction_threshold_;
-    size_t approximate_memtable_memory_footprint_ = 0; // in bytes
-    std::chrono::time_point<std::chrono::system_clock> last_persist_time_;
-    bool has_dirty_ = false;
+    // the active memtable is flushed once this passes, it is set by the
+    // first write into an empty memtable
+    std::chrono::steady_clock::time_point flush_deadline_;
+    size_t instance_no_;
+    commitlog_t* commitlog_;
+    // oldest commit log file with writes of the active memtable
+    std::optional<uint64_t> first_log_file_;
     sstables_t sstables_;
+    load_stats_t load_stats_;
   };
 }
 
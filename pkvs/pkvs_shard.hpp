@@ -6,108 +6,1898 @@
 #ifndef PKVS_SHARD_HPP_INCLUDED
 #define PKVS_SHARD_HPP_INCLUDED
 
+#include <seastar/core/condition-variable.hh>
 #include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/loop.hh>
+#include <seastar/core/memory.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/sharded.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/when_all.hh>
 #include <seastar/coroutine/parallel_for_each.hh>
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <type_traits>
 #include <vector>
 
 #include "pkvs.hpp"
+#include "detail/store_metadata.hpp"
 
 namespace pkvs
 {
-  // amount of pkvs instances into which the key hash space should be split
-  inline constexpr size_t pkvs_segments_count = 256;
-
-  size_t key_to_segment_no( std::string_view key )
+  inline size_t key_to_segment_no( key_hash_t key_hash, std::string_view key, size_t segments_count )
   {
-    size_t hash = std::hash<std::string_view>{}( key );
+    uint64_t hash = hash_key( key_hash, key );
 
-    return (hash % pkvs_segments_count);
+    return (hash % segments_count);
   }
 
-  size_t key_to_shard_no( std::string_view key )
+  // directories in which the store keeps its data, segments are spread over
+  // the data directories so that every one of them can be on its own disk
+  struct store_directories_t
+  {
+    // the first one also contains the store metadata, the order must not
+    // change once the store is created
+    std::vector<std::filesystem::path> data;
+    std::filesystem::path commitlog;
+
+    std::filesystem::path segment( size_t segment_no ) const
+    {
+      return data[ segment_no % data.size() ] / std::to_string( segment_no );
+    }
+  };
+
+  enum class batch_operation_type_t
+  {
+    get,
+    insert,
+    remove
+  };
+
+  struct batch_operation_t
+  {
+    batch_operation_type_t type;
+    std::string key;
+    std::string value; // only used by insert
+  };
+
+  // requests are counted on the shard that received them
+  struct request_stats_t
+  {
+    uint64_t local = 0; // served without leaving the receiving shard
+    uint64_t cross_shard_hops = 0; // forwarded to the owning shard
+  };
+
+  // operations that a segment served since the previous sample
+  struct segment_load_t
+  {
+    size_t segment_no;
+    uint64_t operations;
+  };
+
+  // duration of pkvs_shard::run phases
+  struct startup_timings_t
+  {
+    std::chrono::milliseconds commitlog_replay{ 0 };
+    std::chrono::milliseconds segments_open{ 0 };
+  };
+
+  // amount of segments that a shard opens concurrently on startup
+  inline constexpr size_t segments_open_concurrency = 8;
+
+  // keys that a range scan reads ahead per segment and asks a shard for at
+  // once
+  inline constexpr size_t range_prefetch = 16;
+  inline constexpr size_t range_shard_batch = 128;
+
+  // memtable flushes are scheduled by every shard for its own segments
+  struct flush_scheduler_options_t
+  {
+    // how often the shard looks for segments that need to be flushed
+    std::chrono::milliseconds period{ 100 };
+    // flushes that a shard runs at once
+    size_t concurrency = 2;
+    // active and frozen memtables of the shard may hold this much memory
+    // before the largest ones are flushed early (0 uses twice the memtable
+    // budget)
+    size_t dirty_memory_limit = 0;
+  };
+
+  // memtables are also flushed early while less than this part of the shard
+  // memory is free
+  inline constexpr double min_free_memory_ratio = 0.1;
+
+  // writes are throttled once the dirty memory of a shard goes over the
+  // flush scheduler limit - they are delayed more and more up to twice the
+  // limit, stalled until flushes catch up above it and rejected with
+  // overloaded_error if too many of them are stalled or the stall is too long
+  struct write_admission_options_t
+  {
+    // delay of writes just below twice the limit
+    std::chrono::milliseconds max_delay{ 10 };
+    std::chrono::milliseconds stall_timeout{ 1000 };
+    // stalled writes above which further writes are rejected
+    size_t max_stalled_writes = 1024;
+  };
+
+  // the write was not executed and can be retried later
+  class overloaded_error : public std::runtime_error
+  {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+  struct write_admission_stats_t
+  {
+    uint64_t delayed = 0;
+    uint64_t stalled = 0;
+    uint64_t rejected = 0;
+    std::chrono::microseconds delay_time{ 0 };
+    std::chrono::microseconds stall_time{ 0 };
+  };
+
+  struct flush_stats_t
+  {
+    uint64_t due = 0; // memtable over its threshold, too old or a retry
+    uint64_t memory_pressure = 0; // flushed early to stay within the limit
+    uint64_t failures = 0;
+  };
+
+  struct scrub_stats_t
+  {
+    uint64_t passes = 0;
+    uint64_t files = 0;
+    uint64_t corrupted_files = 0;
+  };
+
+  class pkvs_shard;
+
+  namespace detail
   {
-    return key_to_segment_no( key ) % seastar::smp::count;
+    template< typename func_t >
+    using owner_result_t =
+      typename seastar::futurize< std::invoke_result_t< func_t&, pkvs_shard&, std::string_view > >::type;
   }
 
-  // class for taking care of pkvs instances that are assigned to a single shard
-  // shard handles every n-th pkvs instance where n is mod of seastar::smp::count
-  // offset by current shard id all the way to pkvs_segments_count
-  class pkvs_shard
+  // class for taking care of pkvs instances (segments) that are assigned to a
+  // single shard
+  //
+  // segment i starts on shard i % seastar::smp::count and can be moved to
+  // another shard while the store is running, every shard keeps its own copy
+  // of the segment placement which is updated by the moves
+  class pkvs_shard : public seastar::peering_sharded_service< pkvs_shard >
   {
   public:
-    seastar::future<> run( size_t memtable_memory_footprint_eviction_threshold )
+    // lazy scan over the segments of the shard that lives on the shard
+    // between batches (see store_range_t), every segment keeps its own
+    // cursor and a few keys that were read ahead
+    struct shard_scan_t
+    {
+      struct segment_cursor_t
+      {
+        size_t segment_no;
+        range_cursor_t cursor;
+        std::vector<std::string> prefetched;
+        size_t position = 0;
+      };
+
+      std::vector<segment_cursor_t> segments;
+      // segments with prefetched keys, smallest next key first
+      std::vector<size_t> heap;
+      bool primed = false;
+      // placement version of the shard when the scan started
+      uint64_t placement_version;
+    };
+
+    // scan of the shard and the segments that it covers
+    struct shard_range_t
+    {
+      seastar::foreign_ptr< std::unique_ptr< shard_scan_t > > scan;
+      std::vector<size_t> segments;
+    };
+
+    // commit logs of generations before the given one are replayed into the
+    // instances of this shard, they can be removed once all shards are running
+    seastar::future<> run
+    (
+      store_directories_t directories,
+      store_metadata_t metadata,
+      size_t memtable_memory_budget,
+      sstable_options_t sstable_options,
+      commitlog_options_t commitlog_options,
+      uint64_t commitlog_generation,
+      size_t file_cache_capacity,
+      size_t block_cache_capacity,
+      flush_scheduler_options_t flush_scheduler_options,
+      write_admission_options_t write_admission_options,
+      std::chrono::seconds scrub_period
+    )
     {
-      for
-      (
-        size_t i = seastar::this_shard_id();
-        i < pkvs_segments_count;
-        i += seastar::smp::count
-      )
+      assert( metadata.segments_count > 0 && directories.data.empty() == false );
+      assert( flush_scheduler_options.concurrency > 0 );
+
+      directories_ = std::move( directories );
+      segments_count_ = metadata.segments_count;
+      key_hash_ = metadata.key_hash;
+      memtable_memory_budget_ = memtable_memory_budget;
+      sstable_options_ = sstable_options;
+      sstable_options_.key_hash = key_hash_;
+      sstable_options_.value_checksums = metadata.value_checksums;
+      flush_scheduler_options_ = flush_scheduler_options;
+      write_admission_options_ = write_admission_options;
+
+      if( flush_scheduler_options_.dirty_memory_limit == 0 )
+        flush_scheduler_options_.dirty_memory_limit = 2 * memtable_memory_budget_;
+
+      file_cache_ = std::make_unique< file_cache_t >( file_cache_capacity );
+      block_cache_ = std::make_unique< block_cache_t >( block_cache_capacity );
+      segments_.resize( segments_count_ );
+      placement_.resize( segments_count_ );
+
+      for( size_t i = 0; i < segments_count_; ++i )
+        placement_[ i ] = i % seastar::smp::count;
+
+      auto const& commitlog_dir = directories_.commitlog;
+      auto phase_start = std::chrono::steady_clock::now();
+      std::vector< std::vector< commitlog_record_t > > replayed( segments_count_ );
+
+      // previous runs could have a different shard count or placement so all
+      // logs are read and only records of local segments are kept
+      co_await commitlog_t::replay(
+        commitlog_dir,
+        commitlog_generation,
+        [ this ]( size_t segment_no )
+        {
+          return segment_no < segments_count_ && placement_[ segment_no ] == seastar::this_shard_id();
+        },
+        [ &replayed ]( commitlog_record_t&& record )
+        {
+          replayed[ record.segment_no ].push_back( std::move( record ) );
+        });
+
+      commitlog_ =
+        co_await commitlog_t::make(
+          commitlog_dir,
+          commitlog_generation,
+          seastar::this_shard_id(),
+          commitlog_options );
+
+      startup_timings_.commitlog_replay = elapsed_since( phase_start );
+      phase_start = std::chrono::steady_clock::now();
+
+      auto local_segments =
+        std::views::iota( size_t{ 0 }, segments_count_ ) |
+        std::views::filter( [ this ]( size_t i ){ return placement_[ i ] == seastar::this_shard_id(); } );
+      // the budget is split evenly until write rates are known
+      size_t memtable_threshold =
+        memtable_memory_budget_ / std::max< size_t >( std::ranges::distance( local_segments ), 1 );
+
+      // opening a segment mostly waits for the disk so a few are opened at
+      // once without flooding the disk queue
+      co_await seastar::max_concurrent_for_each(
+        local_segments,
+        segments_open_concurrency,
+        [ this, &replayed, memtable_threshold ]( size_t i ) -> seastar::future<>
+        {
+          segments_[ i ] =
+            std::make_unique< segment_t >(
+              co_await pkvs_t::make(
+                directories_.segment( i ),
+                i,
+                memtable_threshold,
+                sstable_options_,
+                *file_cache_,
+                *block_cache_,
+                *commitlog_,
+                std::move( replayed[ i ] ) ) );
+        });
+
+      startup_timings_.segments_open = elapsed_since( phase_start );
+
+      register_metrics();
+
+      housekeeping_timer_.set_callback( [ this ]{ on_housekeeping_timer(); } );
+      housekeeping_timer_.arm_periodic( flush_scheduler_options_.period );
+
+      if( scrub_period.count() > 0 )
       {
-        instances_.push_back( co_await pkvs_t::make( i, memtable_memory_footprint_eviction_threshold ) );
+        scrub_timer_.set_callback( [ this ]{ on_scrub_timer(); } );
+        scrub_timer_.arm_periodic( scrub_period );
       }
     }
 
     seastar::future<> stop()
     {
-      return seastar::make_ready_future<>();
+      housekeeping_timer_.cancel();
+      scrub_timer_.cancel();
+      co_await housekeeping_gate_.close();
+      co_await scrub_gate_.close();
+
+      placement_changed_.broken();
+      dirty_memory_released_.broken();
+
+      co_await seastar::coroutine::parallel_for_each(
+        segments_,
+        []( std::unique_ptr< segment_t >& segment ) -> seastar::future<>
+        {
+          if( segment == nullptr )
+            co_return;
+
+          co_await segment->gate.close();
+          co_await segment->pkvs.stop();
+        });
+
+      if( commitlog_ )
+        co_await commitlog_->stop();
+
+      if( file_cache_ )
+        co_await file_cache_->stop();
+    }
+
+    // runs func( owning_shard, key ) on the shard that owns the segment of
+    // the key, directly if it is this one and through the smp queue otherwise
+    //
+    // requests for a segment that is being moved wait for the move to finish
+    // and are then served by the new owner
+    //
+    // key and everything that func references have to outlive the returned
+    // future
+    template< typename func_t >
+    detail::owner_result_t< func_t > invoke_on_owner( std::string_view key, func_t func )
+    {
+      co_return co_await route( key, func, true );
+    }
+
+    // shard that currently owns the segment of the key
+    unsigned key_to_shard_no( std::string_view key ) const
+    {
+      return placement_[ key_to_segment_no( key_hash_, key, segments_count_ ) ];
     }
 
+    size_t segments_count() const { return segments_count_; }
+
+    startup_timings_t const& startup_timings() const { return startup_timings_; }
+
+    // operations below may only be called through invoke_on_owner, writes
+    // can fail with overloaded_error (see write_admission_options_t)
+
     seastar::future<std::optional<std::string>> get_item( std::string_view key )
     {
-      co_return co_await instances_[ key_to_index( key ) ].get_item( key );
+      return owned_segment( key ).get_item( key );
+    }
+
+    seastar::future<> insert_item( std::string_view key, std::string_view value )
+    {
+      co_await admit_write( key.size() + value.size() );
+      co_await owned_segment( key ).insert_item( key, value );
     }
 
-    void insert_item( std::string_view key, std::string_view value )
+    seastar::future<> delete_item( std::string_view key )
     {
-      instances_[ key_to_index( key ) ].insert_item( key, value );
+      co_await admit_write( key.size() );
+      co_await owned_segment( key ).delete_item( key );
     }
 
-    void delete_item( std::string_view key )
+    seastar::future<std::optional<stored_value_t>> get_value( std::string_view key )
     {
-      instances_[ key_to_index( key ) ].delete_item( key );
+      return owned_segment( key ).get_value( key );
     }
 
-    seastar::future<std::set<std::string>> sorted_keys()
+    std::filesystem::path value_staging_path( std::string_view key )
     {
-      std::set<std::string> keys;
+      return owned_segment( key ).value_staging_path();
+    }
 
-      co_await seastar::coroutine::parallel_for_each(
-        instances_,
-        [ &keys ]( pkvs_t& pkvs ) -> seastar::future<>
+    seastar::future<> insert_value_file( std::string key, std::filesystem::path staged )
+    {
+      // only the key is kept in memory
+      co_await admit_write( key.size() );
+      co_await owned_segment( key ).insert_value_file( std::move( key ), std::move( staged ) );
+    }
+
+    // operations are executed in the given order and results are returned in
+    // the same order - value or std::nullopt if missing for gets and
+    // std::nullopt for writes
+    //
+    // writes don't wait for each other to become durable so that the whole
+    // batch is made durable by as few commit log syncs as possible
+    //
+    // operations stay owned by the shard that parsed them and are released
+    // there once the batch is done
+    //
+    // operations of segments that moved away after the batch was split are
+    // forwarded to their new owner one by one
+    //
+    // writes of the batch are admitted together before any operation runs
+    seastar::future<std::vector<std::optional<std::string>>> batch
+    (
+      seastar::foreign_ptr< std::unique_ptr< std::vector<batch_operation_t> const > > operations_ptr
+    )
+    {
+      auto const& operations = *operations_ptr;
+      std::vector<std::optional<std::string>> results( operations.size() );
+      std::vector<seastar::future<>> durable;
+      std::exception_ptr failure;
+      size_t written = 0;
+
+      for( auto const& operation : operations )
+      {
+        if( operation.type != batch_operation_type_t::get )
+          written += operation.key.size() + operation.value.size();
+      }
+
+      if( written > 0 )
+        co_await admit_write( written );
+
+      try
+      {
+        for( size_t i = 0; i < operations.size(); ++i )
         {
-          keys.merge( co_await pkvs.sorted_keys() );
-        });
+          auto const& operation = operations[ i ];
+          auto* segment = segments_[ key_to_segment_no( key_hash_, operation.key, segments_count_ ) ].get();
+
+          if( segment == nullptr || segment->moving )
+          {
+            auto forwarded =
+              [ &operation ]( pkvs_shard& owner, std::string_view key )
+              {
+                return owner.execute( operation.type, key, operation.value );
+              };
+
+            results[ i ] = co_await route( operation.key, forwarded, false );
+
+            continue;
+          }
+
+          switch( operation.type )
+          {
+          case batch_operation_type_t::get:
+          {
+            auto holder = segment->gate.hold();
+
+            results[ i ] = co_await segment->pkvs.get_item( operation.key );
+            break;
+          }
+          case batch_operation_type_t::insert:
+            durable.push_back(
+              seastar::with_gate(
+                segment->gate,
+                [ segment, &operation ]
+                {
+                  return segment->pkvs.insert_item( operation.key, operation.value );
+                }));
+            break;
+          case batch_operation_type_t::remove:
+            durable.push_back(
+              seastar::with_gate(
+                segment->gate,
+                [ segment, &operation ]
+                {
+                  return segment->pkvs.delete_item( operation.key );
+                }));
+            break;
+          }
+        }
+      }
+      catch( ... )
+      {
+        failure = std::current_exception();
+      }
+
+      // writes that were already started must be waited for in any case
+      co_await seastar::when_all_succeed( durable.begin(), durable.end() );
+
+      if( failure )
+        std::rethrow_exception( failure );
+
+      co_return results;
+    }
+
+    // starts a scan of [start, end) over the segments of this shard that are
+    // not being moved, nothing is read until the first batch
+    shard_range_t start_range( std::string start, std::string end )
+    {
+      auto scan = std::make_unique< shard_scan_t >();
+      std::vector<size_t> segments;
+
+      scan->placement_version = placement_version_;
+
+      for( size_t i = 0; i < segments_count_; ++i )
+      {
+        if( segments_[ i ] != nullptr && segments_[ i ]->moving == false )
+        {
+          scan->segments.push_back( { i, range_cursor_t{ start, end } } );
+          segments.push_back( i );
+        }
+      }
+
+      return { seastar::make_foreign( std::move( scan ) ), std::move( segments ) };
+    }
+
+    // next at most limit keys of the scan in ascending order, fewer only once
+    // it is exhausted - std::nullopt if a segment moved since the scan started
+    // so that it has to be started again
+    //
+    // segments are merged with a heap and only read a few keys ahead of the
+    // merge so that a batch reads about limit keys no matter how many
+    // segments the shard has
+    seastar::future<std::optional<std::vector<std::string>>> range( shard_scan_t& scan, size_t limit )
+    {
+      if( scan.placement_version != placement_version_ )
+        co_return std::nullopt;
+
+      // segments can't be released while they are read
+      std::vector<seastar::gate::holder> holders;
+
+      for( auto const& segment : scan.segments )
+        holders.push_back( segments_[ segment.segment_no ]->gate.hold() );
+
+      size_t prefetch = std::min( limit, range_prefetch );
+      auto refill =
+        [ this, prefetch ]( shard_scan_t::segment_cursor_t& segment ) -> seastar::future<>
+        {
+          segment.position = 0;
+          segment.prefetched.clear();
+
+          if( segment.cursor.exhausted() == false )
+            segment.prefetched = co_await segments_[ segment.segment_no ]->pkvs.range( segment.cursor, prefetch );
+        };
+      auto greater =
+        [ &scan ]( size_t a, size_t b )
+        {
+          auto const& first = scan.segments[ a ];
+          auto const& second = scan.segments[ b ];
+
+          return first.prefetched[ first.position ] > second.prefetched[ second.position ];
+        };
+
+      if( scan.primed == false )
+      {
+        co_await seastar::coroutine::parallel_for_each(
+          scan.segments,
+          [ &refill ]( auto& segment ){ return refill( segment ); } );
+
+        for( size_t i = 0; i < scan.segments.size(); ++i )
+        {
+          if( scan.segments[ i ].prefetched.empty() == false )
+            scan.heap.push_back( i );
+        }
+
+        std::ranges::make_heap( scan.heap, greater );
+        scan.primed = true;
+      }
+
+      std::vector<std::string> keys;
+
+      while( keys.size() < limit && scan.heap.empty() == false )
+      {
+        std::ranges::pop_heap( scan.heap, greater );
+
+        auto& segment = scan.segments[ scan.heap.back() ];
+
+        keys.push_back( std::move( segment.prefetched[ segment.position++ ] ) );
+
+        if( segment.position == segment.prefetched.size() )
+          co_await refill( segment );
+
+        if( segment.prefetched.empty() )
+          scan.heap.pop_back();
+        else
+          std::ranges::push_heap( scan.heap, greater );
+      }
 
       co_return keys;
     }
 
+    // flushes segments that are due and, once a second, runs their sstable
+    // maintenance - called by the housekeeping timer so that the shard
+    // doesn't wait for the other ones
+    //
+    // flushes are bounded by the scheduler concurrency and segments with the
+    // most dirty memory go first, the flush deadlines of segments are
+    // jittered so that they don't all come due together
     seastar::future<> housekeeping()
     {
-      return
-        seastar::parallel_for_each(
-          instances_,
-          []( pkvs_t& pkvs ) -> seastar::future<>
+      auto now = std::chrono::steady_clock::now();
+
+      co_await flush_segments( now );
+
+      if( now >= next_maintenance_ )
+      {
+        next_maintenance_ = now + std::chrono::seconds( 1 );
+
+        co_await seastar::coroutine::parallel_for_each(
+          segments_,
+          []( std::unique_ptr< segment_t >& segment ) -> seastar::future<>
+          {
+            // segments that are being moved were already flushed
+            if( segment == nullptr || segment->moving )
+              co_return;
+
+            auto holder = segment->gate.hold();
+
+            co_await segment->pkvs.housekeeping();
+          });
+      }
+
+      // commit log files are no longer needed once every instance flushed
+      // the writes they contain
+      auto keep = commitlog_->file_no();
+
+      for( auto const& segment : segments_ )
+      {
+        if( segment == nullptr )
+          continue;
+
+        if( auto file_no = segment->pkvs.oldest_unflushed_log_file() )
+          keep = std::min( keep, *file_no );
+      }
+
+      co_await commitlog_->discard_before( keep );
+    }
+
+    // verifies checksums of the files of all segments of the shard, one
+    // segment at a time so that the disk isn't flooded - corrupted files are
+    // reported and counted, reads of them keep failing until they are
+    // repaired from a backup
+    seastar::future<> scrub()
+    {
+      for( size_t i = 0; i < segments_.size(); ++i )
+      {
+        auto* segment = segments_[ i ].get();
+
+        // segments that are being moved are scrubbed by their new owner
+        if( segment == nullptr || segment->moving )
+          continue;
+
+        auto holder = segment->gate.hold();
+        auto result = co_await segment->pkvs.scrub();
+
+        scrub_stats_.files += result.files;
+        scrub_stats_.corrupted_files += result.corrupted;
+
+        if( result.corrupted > 0 )
+        {
+          std::cerr
+            << "shard " << seastar::this_shard_id() << " segment " << i << " has "
+            << result.corrupted << " corrupted files\n";
+        }
+      }
+
+      ++scrub_stats_.passes;
+    }
+
+    // moves the segment to the given shard - the segment is flushed on its
+    // current shard and opened from its directory on the new one, requests
+    // for it wait in the meantime
+    //
+    // moves are coordinated by shard 0 one at a time
+    seastar::future<> move_segment( size_t segment_no, unsigned shard_no )
+    {
+      if( segment_no >= segments_count_ || shard_no >= seastar::smp::count )
+        throw std::invalid_argument( "invalid segment or shard number" );
+
+      if( seastar::this_shard_id() != 0 )
+      {
+        co_return
+          co_await
+            container().invoke_on(
+              0,
+              [ segment_no, shard_no ]( pkvs_shard& coordinator )
+              {
+                return coordinator.move_segment( segment_no, shard_no );
+              });
+      }
+
+      auto units = co_await seastar::get_units( moves_lock_, 1 );
+      unsigned previous_shard_no = placement_[ segment_no ];
+
+      if( previous_shard_no == shard_no )
+        co_return;
+
+      std::exception_ptr failure;
+
+      try
+      {
+        co_await
+          container().invoke_on(
+            previous_shard_no,
+            [ segment_no ]( pkvs_shard& previous )
+            {
+              return previous.release_segment( segment_no );
+            });
+        co_await
+          container().invoke_on(
+            shard_no,
+            [ segment_no ]( pkvs_shard& next )
+            {
+              return next.adopt_segment( segment_no );
+            });
+      }
+      catch( ... )
+      {
+        failure = std::current_exception();
+      }
+
+      if( failure )
+      {
+        // the segment stays where it was and is opened again if it was
+        // already released
+        co_await
+          container().invoke_on(
+            previous_shard_no,
+            [ segment_no ]( pkvs_shard& previous )
+            {
+              return previous.adopt_segment( segment_no );
+            });
+
+        std::rethrow_exception( failure );
+      }
+
+      co_await
+        container().invoke_on_all(
+          [ segment_no, shard_no ]( pkvs_shard& local_shard )
           {
-            return pkvs.housekeeping();
+            local_shard.placement_[ segment_no ] = shard_no;
+            local_shard.placement_changed_.broadcast();
           });
+
+      ++segment_moves_;
+    }
+
+    // returns the load of every segment of this shard since the previous
+    // call
+    std::vector<segment_load_t> sample_load()
+    {
+      std::vector<segment_load_t> loads;
+
+      hottest_segment_operations_ = 0;
+
+      for( size_t i = 0; i < segments_count_; ++i )
+      {
+        auto* segment = segments_[ i ].get();
+
+        if( segment == nullptr || segment->moving )
+          continue;
+
+        auto const& stats = segment->pkvs.load_stats();
+        uint64_t operations = stats.reads + stats.writes;
+
+        loads.push_back( { i, operations - segment->sampled_operations } );
+        hottest_segment_operations_ = std::max( hottest_segment_operations_, loads.back().operations );
+        segment->sampled_operations = operations;
+      }
+
+      return loads;
     }
 
+    request_stats_t& request_stats() { return request_stats_; }
+
   private:
-    size_t key_to_index( std::string_view key ) const
+    struct segment_t
     {
-      size_t index = key_to_segment_no( key ) / seastar::smp::count;
+      explicit segment_t( pkvs_t&& pkvs_ )
+        : pkvs{ std::move( pkvs_ ) }
+      {}
 
-      assert( index < instances_.size() );
+      pkvs_t pkvs;
+      // held by every operation on the segment so that a move can wait for
+      // them to finish
+      seastar::gate gate;
+      // requests that arrive in the meantime wait for the move to finish
+      bool moving = false;
+      // reads and writes at the time of the previous load sample
+      uint64_t sampled_operations = 0;
+      // bytes written at the time of the previous memtable budget split and
+      // their average per flush scheduler period
+      uint64_t split_bytes_written = 0;
+      double write_rate = 0;
+    };
 
-      return index;
+    void on_housekeeping_timer()
+    {
+      // a pass that takes longer than the period delays the next one
+      if( housekeeping_running_ || housekeeping_gate_.is_closed() )
+        return;
+
+      housekeeping_running_ = true;
+
+      (void)seastar::with_gate(
+        housekeeping_gate_,
+        [ this ]
+        {
+          return housekeeping().finally( [ this ]{ housekeeping_running_ = false; } );
+        })
+        .handle_exception(
+          []( std::exception_ptr e )
+          {
+            std::cerr << "shard " << seastar::this_shard_id() << " housekeeping failed: " << e << '\n';
+          });
     }
 
-    std::vector< pkvs_t > instances_;
-  };
+    void on_scrub_timer()
+    {
+      if( scrub_running_ || scrub_gate_.is_closed() )
+        return;
+
+      scrub_running_ = true;
+
+      (void)seastar::with_gate(
+        scrub_gate_,
+        [ this ]
+        {
+          return scrub().finally( [ this ]{ scrub_running_ = false; } );
+        })
+        .handle_exception(
+          []( std::exception_ptr e )
+          {
+            std::cerr << "shard " << seastar::this_shard_id() << " scrub failed: " << e << '\n';
+          });
+    }
+
+    // fast path for writes while the shard is below its dirty memory limit
+    seastar::future<> admit_write( size_t bytes )
+    {
+      if( dirty_memory_ <= flush_scheduler_options_.dirty_memory_limit )
+      {
+        dirty_memory_ += bytes;
+
+        return seastar::make_ready_future<>();
+      }
+
+      return throttle_write( bytes );
+    }
+
+    seastar::future<> throttle_write( size_t bytes )
+    {
+      auto limit = flush_scheduler_options_.dirty_memory_limit;
+      auto start = std::chrono::steady_clock::now();
+
+      // flushes start right away instead of on the next timer tick
+      on_housekeeping_timer();
+
+      if( dirty_memory_ < 2 * limit )
+      {
+        auto delay =
+          std::chrono::microseconds( write_admission_options_.max_delay ) * ( dirty_memory_ - limit ) / limit;
+
+        ++write_admission_stats_.delayed;
+        co_await seastar::sleep( delay );
+        write_admission_stats_.delay_time += elapsed_since<std::chrono::microseconds>( start );
+      }
+      else
+      {
+        if( stalled_writes_ >= write_admission_options_.max_stalled_writes )
+        {
+          ++write_admission_stats_.rejected;
+
+          throw overloaded_error( "too many writes are waiting for memtable flushes" );
+        }
+
+        ++write_admission_stats_.stalled;
+        ++stalled_writes_;
+
+        std::exception_ptr failure;
+
+        try
+        {
+          co_await
+            dirty_memory_released_.wait(
+              write_admission_options_.stall_timeout,
+              [ this, limit ]{ return dirty_memory_ < 2 * limit; } );
+        }
+        catch( seastar::condition_variable_timed_out const& )
+        {
+          ++write_admission_stats_.rejected;
+          failure = std::make_exception_ptr( overloaded_error( "timed out waiting for memtable flushes" ) );
+        }
+        catch( ... )
+        {
+          failure = std::current_exception();
+        }
+
+        --stalled_writes_;
+        write_admission_stats_.stall_time += elapsed_since<std::chrono::microseconds>( start );
+
+        if( failure )
+          std::rethrow_exception( failure );
+      }
+
+      dirty_memory_ += bytes;
+    }
+
+    // dirty memory is tracked per write in between so that it doesn't have
+    // to be summed up for every one of them
+    void update_dirty_memory()
+    {
+      dirty_memory_ = sum( []( pkvs_t const& pkvs ){ return pkvs.dirty_memory_footprint(); } );
+      dirty_memory_released_.broadcast();
+    }
+
+    // active memtables of the segments share the memtable budget of the
+    // shard - a quarter of it is split evenly and the rest by recent write
+    // rate so that busy segments flush fewer and larger sstables
+    void split_memtable_budget()
+    {
+      // weight of the latest period in the write rate average
+      constexpr double rate_weight = 0.25;
+
+      std::vector< segment_t* > local;
+      double total_rate = 0;
+
+      for( auto const& segment : segments_ )
+      {
+        if( segment == nullptr || segment->moving )
+          continue;
+
+        uint64_t written = segment->pkvs.load_stats().bytes_written;
+
+        segment->write_rate =
+          segment->write_rate * ( 1 - rate_weight ) + ( written - segment->split_bytes_written ) * rate_weight;
+        segment->split_bytes_written = written;
+        total_rate += segment->write_rate;
+        local.push_back( segment.get() );
+      }
+
+      if( local.empty() )
+        return;
+
+      size_t even = memtable_memory_budget_ / 4 / local.size();
+      double by_rate = memtable_memory_budget_ - even * local.size();
+
+      for( auto* segment : local )
+      {
+        double share = total_rate > 0 ? segment->write_rate / total_rate : 1.0 / local.size();
+
+        segment->pkvs.set_memtable_memory_footprint_eviction_threshold(
+          even + static_cast<size_t>( by_rate * share ) );
+      }
+    }
+
+    seastar::future<> flush_segments( std::chrono::steady_clock::time_point now )
+    {
+      update_dirty_memory();
+      split_memtable_budget();
+
+      std::vector<size_t> due;
+      std::vector<size_t> others;
+      size_t dirty = 0;
+
+      for( size_t i = 0; i < segments_count_; ++i )
+      {
+        auto* segment = segments_[ i ].get();
+
+        if( segment == nullptr || segment->moving )
+          continue;
+
+        dirty += segment->pkvs.dirty_memory_footprint();
+
+        if( segment->pkvs.flush_due( now ) )
+          due.push_back( i );
+        else if( segment->pkvs.dirty_memory_footprint() > 0 )
+          others.push_back( i );
+      }
+
+      auto by_dirty_memory =
+        [ this ]( size_t left, size_t right )
+        {
+          return segments_[ left ]->pkvs.dirty_memory_footprint() > segments_[ right ]->pkvs.dirty_memory_footprint();
+        };
+
+      flush_stats_.due += due.size();
+
+      for( size_t i : due )
+        dirty -= segments_[ i ]->pkvs.dirty_memory_footprint();
+
+      // under memory pressure the largest memtables are flushed before they
+      // come due, the allocator is asked as well so that memory of caches and
+      // requests is taken into account
+      size_t target = flush_scheduler_options_.dirty_memory_limit;
+      auto memory = seastar::memory::stats();
+      size_t min_free_memory = memory.total_memory() * min_free_memory_ratio;
+
+      if( memory.free_memory() < min_free_memory )
+      {
+        size_t missing = min_free_memory - memory.free_memory();
+
+        target = std::min( target, dirty > missing ? dirty - missing : 0 );
+      }
+
+      std::ranges::sort( others, by_dirty_memory );
+
+      for( size_t i : others )
+      {
+        if( dirty <= target )
+          break;
+
+        due.push_back( i );
+        dirty -= segments_[ i ]->pkvs.dirty_memory_footprint();
+        ++flush_stats_.memory_pressure;
+      }
+
+      std::ranges::stable_sort( due, by_dirty_memory );
+
+      co_await seastar::max_concurrent_for_each(
+        due,
+        flush_scheduler_options_.concurrency,
+        [ this ]( size_t i ) -> seastar::future<>
+        {
+          // the segment could start moving while earlier flushes were running
+          auto* segment = segments_[ i ].get();
+
+          if( segment == nullptr || segment->moving )
+            co_return;
+
+          auto holder = segment->gate.hold();
+          std::exception_ptr failure;
+
+          try
+          {
+            co_await segment->pkvs.flush();
+          }
+          catch( ... )
+          {
+            failure = std::current_exception();
+          }
+
+          // memtables stay frozen and are flushed again by a later pass
+          if( failure )
+          {
+            ++flush_stats_.failures;
+            std::cerr << "flush of segment " << i << " failed: " << failure << '\n';
+          }
+
+          update_dirty_memory();
+        });
+    }
+
+    template< typename func_t >
+    detail::owner_result_t< func_t > route( std::string_view key, func_t& func, bool received )
+    {
+      size_t segment_no = key_to_segment_no( key_hash_, key, segments_count_ );
+
+      while( true )
+      {
+        if( unsigned shard_no = placement_[ segment_no ]; shard_no != seastar::this_shard_id() )
+        {
+          if( received )
+            ++request_stats_.cross_shard_hops;
+
+          co_return
+            co_await
+              container().invoke_on(
+                shard_no,
+                [ key, &func ]( pkvs_shard& owner )
+                {
+                  return owner.route_owned_key( std::string{ key }, func );
+                });
+        }
+
+        if( auto* segment = segments_[ segment_no ].get(); segment != nullptr && segment->moving == false )
+        {
+          if( received )
+            ++request_stats_.local;
+
+          auto holder = segment->gate.hold();
+
+          co_return co_await seastar::futurize_invoke( func, *this, key );
+        }
+
+        co_await placement_changed_.wait();
+      }
+    }
+
+    // runs on the owning shard, key is a coroutine parameter so it is copied
+    // into memory of that shard instead of being read from the receiving one
+    template< typename func_t >
+    detail::owner_result_t< func_t > route_owned_key( std::string key, func_t& func )
+    {
+      co_return co_await route( key, func, false );
+    }
+
+    seastar::future<std::optional<std::string>> execute
+    (
+      batch_operation_type_t type,
+      std::string_view key,
+      std::string_view value
+    )
+    {
+      auto& pkvs = owned_segment( key );
+
+      switch( type )
+      {
+      case batch_operation_type_t::get:
+        co_return co_await pkvs.get_item( key );
+      case batch_operation_type_t::insert:
+        co_await pkvs.insert_item( key, value );
+        break;
+      case batch_operation_type_t::remove:
+        co_await pkvs.delete_item( key );
+        break;
+      }
+
+      co_return std::nullopt;
+    }
+
+    // flushes the segment and marks it as flushed in the commit log so that
+    // its older records are not replayed over writes that the next owner
+    // logs, the segment is then closed
+    seastar::future<> release_segment( size_t segment_no )
+    {
+      auto& segment = segments_[ segment_no ];
+
+      assert( segment != nullptr && segment->moving == false );
+
+      segment->moving = true;
+      ++placement_version_;
+      co_await segment->gate.close();
+
+      std::exception_ptr failure;
+
+      try
+      {
+        co_await segment->pkvs.flush();
+        commitlog_->add_segment_flushed( segment_no );
+        co_await commitlog_->sync();
+      }
+      catch( ... )
+      {
+        failure = std::current_exception();
+      }
+
+      if( failure )
+      {
+        // a closed gate can't be reopened so the instance gets a new one
+        segment = std::make_unique< segment_t >( std::move( segment->pkvs ) );
+        ++placement_version_;
+        placement_changed_.broadcast();
+
+        std::rethrow_exception( failure );
+      }
+
+      auto released = std::move( segment );
+      auto directory = directories_.segment( segment_no );
+
+      update_dirty_memory();
+
+      co_await released->pkvs.stop();
+      co_await file_cache_->evict_directory( directory );
+      block_cache_->evict_directory( directory );
+    }
+
+    // does nothing but update the placement if the segment is already here
+    seastar::future<> adopt_segment( size_t segment_no )
+    {
+      if( segments_[ segment_no ] == nullptr )
+      {
+        segments_[ segment_no ] =
+          std::make_unique< segment_t >(
+            co_await pkvs_t::make(
+              directories_.segment( segment_no ),
+              segment_no,
+              memtable_memory_budget_ / ( owned_segments() + 1 ),
+              sstable_options_,
+              *file_cache_,
+              *block_cache_,
+              *commitlog_,
+              {},
+              false ) );
+      }
+
+      placement_[ segment_no ] = seastar::this_shard_id();
+      ++placement_version_;
+      placement_changed_.broadcast();
+    }
+
+    void register_metrics()
+    {
+      namespace sm = seastar::metrics;
+
+      metrics_.add_group(
+        "sstables",
+        {
+          sm::make_counter(
+            "bloom_filter_hits",
+            [ this ]
+            {
+              return sum( []( pkvs_t const& pkvs ){ return pkvs.sstables_stats().bloom_filter_hits; } );
+            },
+            sm::description( "point reads that skipped an sstable because of its bloom filter" ) ),
+          sm::make_counter(
+            "bloom_filter_false_positives",
+            [ this ]
+            {
+              return
+                sum(
+                  []( pkvs_t const& pkvs )
+                  {
+                    return pkvs.sstables_stats().bloom_filter_false_positives;
+                  } );
+            },
+            sm::description( "point reads that passed the bloom filter but missed the sstable" ) ),
+          sm::make_gauge(
+            "bloom_filter_memory_bytes",
+            [ this ]
+            {
+              return sum( []( pkvs_t const& pkvs ){ return pkvs.bloom_filters_memory_footprint(); } );
+            },
+            sm::description( "memory used by bloom filters of all sstables" ) ),
+          sm::make_counter(
+            "compactions",
+            [ this ]
+            {
+              return sum( []( pkvs_t const& pkvs ){ return pkvs.sstables_stats().compactions; } );
+            },
+            sm::description( "finished sstable compactions" ) ),
+          sm::make_counter(
+            "compaction_bytes_read",
+            [ this ]
+            {
+              return
+                sum(
+                  []( pkvs_t const& pkvs )
+                  {
+                    return pkvs.sstables_stats().compaction_bytes_read;
+                  } );
+            },
+            sm::description( "sstable bytes read by compactions" ) )
+        });
+
+      metrics_.add_group(
+        "requests",
+        {
+          sm::make_counter(
+            "local",
+            [ this ]{ return request_stats_.local; },
+            sm::description( "requests served by the shard that received them" ) ),
+          sm::make_counter(
+            "cross_shard_hops",
+            [ this ]{ return request_stats_.cross_shard_hops; },
+            sm::description( "requests forwarded to the shard that owns the keys" ) )
+        });
+
+      metrics_.add_group(
+        "segments",
+        {
+          sm::make_gauge(
+            "owned",
+            [ this ]{ return owned_segments(); },
+            sm::description( "segments served by the shard" ) ),
+          sm::make_counter(
+            "moves",
+            [ this ]{ return segment_moves_; },
+            sm::description( "segments moved between shards (counted by shard 0 that coordinates them)" ) ),
+          sm::make_gauge(
+            "hottest_operations",
+            [ this ]{ return hottest_segment_operations_; },
+            sm::description( "operations of the busiest segment of the shard in the last load sample" ) )
+        });
+
+      metrics_.add_group(
+        "flushes",
+        {
+          sm::make_counter(
+            "due",
+            [ this ]{ return flush_stats_.due; },
+            sm::description( "memtable flushes of segments that were over their threshold or too old" ) ),
+          sm::make_counter(
+            "memory_pressure",
+            [ this ]{ return flush_stats_.memory_pressure; },
+            sm::description( "memtable flushes started early to stay within the shard dirty memory limit" ) ),
+          sm::make_counter(
+            "failures",
+            [ this ]{ return flush_stats_.failures; },
+            sm::description( "memtable flushes that failed and will be retried" ) ),
+          sm::make_gauge(
+            "dirty_memory_bytes",
+            [ this ]{ return sum( []( pkvs_t const& pkvs ){ return pkvs.dirty_memory_footprint(); } ); },
+            sm::description( "memory of memtables that were not flushed yet" ) ),
+          sm::make_gauge(
+            "largest_memtable_threshold_bytes",
+            [ this ]
+            {
+              uint64_t largest = 0;
+
+              for( auto const& segment : segments_ )
+              {
+                if( segment != nullptr )
+                  largest = std::max< uint64_t >( largest, segment->pkvs.memtable_memory_footprint_eviction_threshold() );
+              }
+
+              return largest;
+            },
+            sm::description( "largest share of the memtable budget that a segment of the shard got" ) )
+        });
+
+      metrics_.add_group(
+        "write_admission",
+        {
+          sm::make_counter(
+            "delayed",
+            [ this ]{ return write_admission_stats_.delayed; },
+            sm::description( "writes slowed down because the shard was over its dirty memory limit" ) ),
+          sm::make_counter(
+            "stalled",
+            [ this ]{ return write_admission_stats_.stalled; },
+            sm::description( "writes that waited for flushes at twice the dirty memory limit" ) ),
+          sm::make_counter(
+            "rejected",
+            [ this ]{ return write_admission_stats_.rejected; },
+            sm::description( "writes rejected as overloaded" ) ),
+          sm::make_counter(
+            "delay_microseconds",
+            [ this ]{ return write_admission_stats_.delay_time.count(); },
+            sm::description( "time that delayed writes were held back" ) ),
+          sm::make_counter(
+            "stall_microseconds",
+            [ this ]{ return write_admission_stats_.stall_time.count(); },
+            sm::description( "time that stalled writes waited" ) ),
+          sm::make_gauge(
+            "waiting",
+            [ this ]{ return stalled_writes_; },
+            sm::description( "writes that are currently stalled" ) )
+        });
+
+      metrics_.add_group(
+        "scrub",
+        {
+          sm::make_counter(
+            "passes",
+            [ this ]{ return scrub_stats_.passes; },
+            sm::description( "completed scrubs of all segments of the shard" ) ),
+          sm::make_counter(
+            "files",
+            [ this ]{ return scrub_stats_.files; },
+            sm::description( "sstable and value files that were verified" ) ),
+          sm::make_counter(
+            "corrupted_files",
+            [ this ]{ return scrub_stats_.corrupted_files; },
+            sm::description( "verified files that didn't match their checksums" ) )
+        });
+
+      metrics_.add_group(
+        "file_cache",
+        {
+          sm::make_counter(
+            "hits",
+            [ this ]{ return file_cache_->stats().hits; },
+            sm::description( "reads that reused a cached file handle" ) ),
+          sm::make_counter(
+            "misses",
+            [ this ]{ return file_cache_->stats().misses; },
+            sm::description( "reads that had to open a file" ) ),
+          sm::make_gauge(
+            "open_files",
+            [ this ]{ return file_cache_->open_files(); },
+            sm::description( "file handles held open by the cache" ) )
+        });
+
+      metrics_.add_group(
+        "block_cache",
+        {
+          sm::make_counter(
+            "hits",
+            [ this ]{ return block_cache_->stats().hits; },
+            sm::description( "block and value reads served from memory" ) ),
+          sm::make_counter(
+            "misses",
+            [ this ]{ return block_cache_->stats().misses; },
+            sm::description( "block and value reads that went to disk" ) ),
+          sm::make_counter(
+            "evictions",
+            [ this ]{ return block_cache_->stats().evictions; },
+            sm::description( "blocks dropped to stay within the budget" ) ),
+          sm::make_gauge(
+            "memory_bytes",
+            [ this ]{ return block_cache_->memory_footprint(); },
+            sm::description( "memory used by cached blocks" ) )
+        });
+    }
+
+    template< typename duration_t = std::chrono::milliseconds >
+    static duration_t elapsed_since( std::chrono::steady_clock::time_point start )
+    {
+      return std::chrono::duration_cast<duration_t>( std::chrono::steady_clock::now() - start );
+    }
+
+    template < typename Func >
+    uint64_t sum( Func&& func ) const
+    {
+      uint64_t total = 0;
+
+      for( auto const& segment : segments_ )
+      {
+        if( segment != nullptr )
+          total += func( segment->pkvs );
+      }
+
+      return total;
+    }
+
+    size_t owned_segments() const
+    {
+      return std::ranges::count_if( segments_, []( auto const& segment ){ return segment != nullptr; } );
+    }
+
+    pkvs_t& owned_segment( std::string_view key )
+    {
+      auto const& segment = segments_[ key_to_segment_no( key_hash_, key, segments_count_ ) ];
+
+      assert( segment != nullptr );
+
+      return segment->pkvs;
+    }
+
+    store_directories_t directories_;
+    size_t segments_count_ = 0;
+    key_hash_t key_hash_ = key_hash_t::xxh64;
+    // shared by active memtables of all segments of the shard
+    size_t memtable_memory_budget_ = 0;
+    sstable_options_t sstable_options_;
+    std::unique_ptr< file_cache_t > file_cache_;
+    std::unique_ptr< block_cache_t > block_cache_;
+    std::unique_ptr< commitlog_t > commitlog_;
+    // indexed by segment number, empty for segments of other shards
+    std::vector< std::unique_ptr< segment_t > > segments_;
+    // owning shard of every segment
+    std::vector< unsigned > placement_;
+    // changes whenever a segment of this shard is released or adopted so
+    // that scans over the old segments are started again
+    uint64_t placement_version_ = 0;
+    // signalled whenever a segment of this shard was moved or its move failed
+    seastar::condition_variable placement_changed_;
+    // only used on shard 0
+    seastar::semaphore moves_lock_{ 1 };
+    uint64_t segment_moves_ = 0;
+    uint64_t hottest_segment_operations_ = 0;
+    request_stats_t request_stats_;
+    startup_timings_t startup_timings_;
+    flush_scheduler_options_t flush_scheduler_options_;
+    flush_stats_t flush_stats_;
+    write_admission_options_t write_admission_options_;
+    write_admission_stats_t write_admission_stats_;
+    // approximate memory of unflushed memtables, recalculated after flushes
+    size_t dirty_memory_ = 0;
+    size_t stalled_writes_ = 0;
+    // signalled whenever dirty memory was recalculated
+    seastar::condition_variable dirty_memory_released_;
+    seastar::timer<> housekeeping_timer_;
+    // held by the running housekeeping pass
+    seastar::gate housekeeping_gate_;
+    bool housekeeping_running_ = false;
+    std::chrono::steady_clock::time_point next_maintenance_;
+    seastar::timer<> scrub_timer_;
+    // held by the running scrub pass
+    seastar::gate scrub_gate_;
+    bool scrub_running_ = false;
+    scrub_stats_t scrub_stats_;
+    seastar::metrics::metric_groups metrics_;
+  };
+
+  namespace detail
+  {
+    // counts the request on the receiving shard, returns true if shard_no is
+    // the receiving shard so that no hop is needed
+    inline bool count_request( seastar::sharded< pkvs_shard >& store, size_t shard_no )
+    {
+      auto& stats = store.local().request_stats();
+
+      if( shard_no == seastar::this_shard_id() )
+      {
+        ++stats.local;
+
+        return true;
+      }
+
+      ++stats.cross_shard_hops;
+
+      return false;
+    }
+  }
+
+  // see pkvs_shard::invoke_on_owner
+  template< typename func_t >
+  detail::owner_result_t< func_t > invoke_on_owner
+  (
+    seastar::sharded< pkvs_shard >& store,
+    std::string_view key,
+    func_t func
+  )
+  {
+    return store.local().invoke_on_owner( key, std::move( func ) );
+  }
+
+  // lazy scan of [start, end) over all shards where an empty end is
+  // unbounded, shard scans are merged with a heap and asked for at most a
+  // page worth of keys at once so memory use is bounded by the page size and
+  // not by the amount of stored keys
+  //
+  // shard scans are started again from the first key that wasn't returned
+  // yet if a segment moved in the meantime so that every segment is read
+  // exactly once
+  class store_range_t
+  {
+  public:
+    store_range_t( seastar::sharded< pkvs_shard >& store, std::string start, std::string end )
+      : store_{ &store }
+      , start_{ std::move( start ) }
+      , end_{ std::move( end ) }
+    {}
+
+    // next page of at most limit keys, next of the page is only set if there
+    // are more keys - calls must not overlap
+    seastar::future<key_range_t> next( size_t limit )
+    {
+      assert( limit > 0 );
+
+      key_range_t page;
+      size_t batch = std::min( limit, range_shard_batch );
+      auto greater =
+        [ this ]( size_t a, size_t b )
+        {
+          auto const& first = shards_[ a ];
+          auto const& second = shards_[ b ];
+
+          return first.keys[ first.position ] > second.keys[ second.position ];
+        };
+
+      while( true )
+      {
+        if( started_ == false )
+        {
+          // smallest key that is greater than the last one that was returned
+          if( page.keys.empty() == false )
+            start_ = page.keys.back() + '\0';
+
+          if( co_await start( batch ) == false )
+            continue;
+
+          std::ranges::make_heap( heap_, greater );
+        }
+
+        bool stale = false;
+
+        while( page.keys.size() < limit && heap_.empty() == false )
+        {
+          std::ranges::pop_heap( heap_, greater );
+
+          size_t shard_no = heap_.back();
+          auto& shard = shards_[ shard_no ];
+
+          page.keys.push_back( std::move( shard.keys[ shard.position++ ] ) );
+
+          if( shard.position == shard.keys.size() && shard.exhausted == false && co_await fill( shard_no, batch ) == false )
+          {
+            stale = true;
+
+            break;
+          }
+
+          if( shard.position == shard.keys.size() )
+            heap_.pop_back();
+          else
+            std::ranges::push_heap( heap_, greater );
+        }
+
+        if( stale )
+        {
+          started_ = false;
+
+          continue;
+        }
+
+        break;
+      }
+
+      if( page.keys.empty() == false )
+        start_ = page.keys.back() + '\0';
+
+      if( heap_.empty() == false )
+        page.next = start_;
+
+      co_return page;
+    }
+
+  private:
+    struct shard_t
+    {
+      seastar::foreign_ptr< std::unique_ptr< pkvs_shard::shard_scan_t > > scan;
+      std::vector<std::string> keys;
+      size_t position = 0;
+      bool exhausted = false;
+    };
+
+    // starts shard scans from start_ and reads their first batches, returns
+    // false if a segment moved in the meantime
+    seastar::future<bool> start( size_t batch )
+    {
+      shards_.clear();
+      heap_.clear();
+
+      while( true )
+      {
+        std::vector<pkvs_shard::shard_range_t> shard_ranges( seastar::smp::count );
+
+        co_await seastar::coroutine::parallel_for_each(
+          std::views::iota( 0u, seastar::smp::count ),
+          [ this, &shard_ranges ]( size_t shard_no ) -> seastar::future<>
+          {
+            if( detail::count_request( *store_, shard_no ) )
+            {
+              shard_ranges[ shard_no ] = store_->local().start_range( start_, end_ );
+
+              co_return;
+            }
+
+            // bounds are copied on the owning shard
+            shard_ranges[ shard_no ] =
+              co_await
+                store_->invoke_on(
+                  shard_no,
+                  [ start = std::string_view{ start_ }, end = std::string_view{ end_ } ]
+                  (
+                    pkvs_shard& local_shard
+                  )
+                  {
+                    return local_shard.start_range( std::string{ start }, std::string{ end } );
+                  });
+          });
+
+        std::vector<size_t> reads( store_->local().segments_count() );
+
+        for( auto const& shard_range : shard_ranges )
+        {
+          for( auto segment_no : shard_range.segments )
+            ++reads[ segment_no ];
+        }
+
+        if( std::ranges::all_of( reads, []( size_t count ){ return count == 1; } ) )
+        {
+          shards_.resize( seastar::smp::count );
+
+          for( size_t i = 0; i < shards_.size(); ++i )
+            shards_[ i ].scan = std::move( shard_ranges[ i ].scan );
+
+          break;
+        }
+
+        // moves are rare and short
+        co_await seastar::sleep( std::chrono::milliseconds( 1 ) );
+      }
+
+      std::vector<bool> filled( shards_.size() );
+
+      co_await seastar::coroutine::parallel_for_each(
+        std::views::iota( size_t{ 0 }, shards_.size() ),
+        [ this, &filled, batch ]( size_t shard_no ) -> seastar::future<>
+        {
+          filled[ shard_no ] = co_await fill( shard_no, batch );
+        });
+
+      if( std::ranges::find( filled, false ) != filled.end() )
+        co_return false;
+
+      for( size_t i = 0; i < shards_.size(); ++i )
+      {
+        if( shards_[ i ].keys.empty() == false )
+          heap_.push_back( i );
+      }
+
+      started_ = true;
+
+      co_return true;
+    }
+
+    // replaces the keys of the shard with its next batch, returns false if
+    // the shard scan has to be started again
+    seastar::future<bool> fill( size_t shard_no, size_t batch )
+    {
+      auto& shard = shards_[ shard_no ];
+      std::optional< std::vector<std::string> > keys;
+
+      if( detail::count_request( *store_, shard_no ) )
+        keys = co_await store_->local().range( *shard.scan, batch );
+      else
+      {
+        keys =
+          co_await
+            store_->invoke_on(
+              shard_no,
+              [ scan = shard.scan.get(), batch ]( pkvs_shard& local_shard )
+              {
+                return local_shard.range( *scan, batch );
+              });
+      }
+
+      if( keys == std::nullopt )
+        co_return false;
+
+      shard.exhausted = keys->size() < batch;
+      shard.keys = std::move( *keys );
+      shard.position = 0;
+
+      co_return true;
+    }
+
+    seastar::sharded< pkvs_shard >* store_;
+    // smallest key that was not returned yet, shard scans are started again
+    // from it
+    std::string start_;
+    std::string end_;
+    std::vector<shard_t> shards_;
+    // shards with unread keys, smallest next key first
+    std::vector<size_t> heap_;
+    bool started_ = false;
+  };
+
+  // single page of a store_range_t
+  inline seastar::future<key_range_t> range_on_all_shards
+  (
+    seastar::sharded< pkvs_shard >& store,
+    std::string start,
+    std::string end,
+    size_t limit
+  )
+  {
+    store_range_t range{ store, std::move( start ), std::move( end ) };
+
+    co_return co_await range.next( limit );
+  }
+
+  // splits operations into a single sub-batch per owning shard and returns
+  // the results in the original order (see pkvs_shard::batch)
+  inline seastar::future<std::vector<std::optional<std::string>>> batch_on_all_shards
+  (
+    seastar::sharded< pkvs_shard >& store,
+    std::vector<batch_operation_t> operations
+  )
+  {
+    std::vector< std::vector<batch_operation_t> > sub_batches( seastar::smp::count );
+    std::vector< std::vector<size_t> > positions( seastar::smp::count );
+
+    for( size_t i = 0; i < operations.size(); ++i )
+    {
+      size_t shard_no = store.local().key_to_shard_no( operations[ i ].key );
+
+      positions[ shard_no ].push_back( i );
+      sub_batches[ shard_no ].push_back( std::move( operations[ i ] ) );
+    }
+
+    std::vector< std::optional<std::string> > results( operations.size() );
+
+    co_await seastar::coroutine::parallel_for_each(
+      std::views::iota( 0u, seastar::smp::count ),
+      [ &store, &sub_batches, &positions, &results ]( size_t shard_no ) -> seastar::future<>
+      {
+        if( sub_batches[ shard_no ].empty() )
+          co_return;
+
+        seastar::foreign_ptr< std::unique_ptr< std::vector<batch_operation_t> const > > sub_batch =
+          seastar::make_foreign(
+            std::make_unique< std::vector<batch_operation_t> const >( std::move( sub_batches[ shard_no ] ) ) );
+        std::vector< std::optional<std::string> > shard_results;
+
+        if( detail::count_request( store, shard_no ) )
+          shard_results = co_await store.local().batch( std::move( sub_batch ) );
+        else
+        {
+          shard_results =
+            co_await
+              store.invoke_on(
+                shard_no,
+                [ sub_batch = std::move( sub_batch ) ]
+                (
+                  pkvs_shard& local_shard
+                ) mutable
+                {
+                  return local_shard.batch( std::move( sub_batch ) );
+                });
+        }
+
+        for( size_t i = 0; i < shard_results.size(); ++i )
+          results[ positions[ shard_no ][ i ] ] = std::move( shard_results[ i ] );
+      });
+
+    co_return results;
+  }
+
+  // shards below this amount of operations per sample are never rebalanced
+  inline constexpr uint64_t rebalance_min_operations = 1000;
+
+  // samples the load of all segments and moves a single segment from the
+  // busiest to the least busy shard if the busiest one served more than
+  // (1 + threshold) times the average amount of operations since the
+  // previous call (threshold 0 only samples)
+  //
+  // the moved segment is the one that brings the two shards closest to an
+  // even load, a single hot segment is never moved as that would only move
+  // the hot spot
+  inline seastar::future<> rebalance( seastar::sharded< pkvs_shard >& store, double threshold )
+  {
+    std::vector< std::vector<segment_load_t> > loads( seastar::smp::count );
+
+    co_await seastar::coroutine::parallel_for_each(
+      std::views::iota( 0u, seastar::smp::count ),
+      [ &store, &loads ]( size_t shard_no ) -> seastar::future<>
+      {
+        loads[ shard_no ] =
+          co_await
+            store.invoke_on(
+              shard_no,
+              []( pkvs_shard& local_shard )
+              {
+                return local_shard.sample_load();
+              });
+      });
+
+    if( threshold <= 0 || seastar::smp::count < 2 )
+      co_return;
+
+    std::vector<uint64_t> totals;
+    uint64_t total = 0;
+
+    for( auto const& shard_loads : loads )
+    {
+      totals.push_back( 0 );
+
+      for( auto const& load : shard_loads )
+        totals.back() += load.operations;
+
+      total += totals.back();
+    }
+
+    size_t busiest = std::ranges::max_element( totals ) - totals.begin();
+    size_t idlest = std::ranges::min_element( totals ) - totals.begin();
+    double average = static_cast<double>( total ) / seastar::smp::count;
+
+    if
+    (
+      totals[ busiest ] < rebalance_min_operations ||
+      totals[ busiest ] <= average * ( 1 + threshold )
+    )
+    {
+      co_return;
+    }
+
+    // moving a segment with x operations changes the difference between the
+    // two shards from gap to |gap - 2x| so only segments with less than gap
+    // operations make it smaller
+    uint64_t gap = totals[ busiest ] - totals[ idlest ];
+    std::optional<segment_load_t> candidate;
+
+    for( auto const& load : loads[ busiest ] )
+    {
+      if( load.operations == 0 || load.operations >= gap )
+        continue;
+
+      auto distance = []( uint64_t gap, uint64_t operations )
+        {
+          return gap > 2 * operations ? gap - 2 * operations : 2 * operations - gap;
+        };
+
+      if( candidate == std::nullopt || distance( gap, load.operations ) < distance( gap, candidate->operations ) )
+        candidate = load;
+    }
+
+    if( candidate == std::nullopt )
+      co_return;
+
+    co_await store.local().move_segment( candidate->segment_no, idlest );
+  }
 }
 
-#endif // PKVS_SHARD_HPP_INCLUDED
\ No newline at end of file
+#endif // PKVS_SHARD_HPP_INCLUDED
@@ -0,0 +1,496 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#include "resp_server.hpp"
+
+#include <seastar/core/coroutine.hh>
+#include <seastar/core/seastar.hh>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "detail/hex.hpp"
+
+using namespace pkvs;
+
+namespace
+{
+  constexpr size_t max_arguments = 1024 * 1024;
+  constexpr size_t max_bulk_size = 64 * 1024 * 1024;
+  // incomplete commands that grow over it are treated as protocol errors
+  constexpr size_t max_pending_size = max_bulk_size + 64 * 1024;
+
+  constexpr size_t scan_default_count = 10;
+  constexpr size_t scan_max_count = 1000;
+
+  enum class parse_result_t
+  {
+    complete,
+    incomplete,
+    error
+  };
+
+  // line without the terminating \r\n starting at pos which is moved past it
+  std::optional<std::string_view> take_line( std::string_view data, size_t& pos )
+  {
+    auto end = data.find( "\r\n", pos );
+
+    if( end == std::string_view::npos )
+      return std::nullopt;
+
+    auto line = data.substr( pos, end - pos );
+    pos = end + 2;
+
+    return line;
+  }
+
+  std::optional<int64_t> to_integer( std::string_view text )
+  {
+    int64_t value = 0;
+    auto [ end, error ] = std::from_chars( text.data(), text.data() + text.size(), value );
+
+    if( text.empty() || error != std::errc{} || end != text.data() + text.size() )
+      return std::nullopt;
+
+    return value;
+  }
+
+  // parses a single command from the front of data and removes it from data
+  // if it was complete, both arrays of bulk strings and space separated
+  // inline commands are accepted
+  parse_result_t parse_command( std::string_view& data, std::vector<std::string>& arguments )
+  {
+    size_t pos = 0;
+    auto line = take_line( data, pos );
+
+    if( line == std::nullopt )
+      return parse_result_t::incomplete;
+
+    if( line->starts_with( '*' ) == false )
+    {
+      for( size_t start = 0; start < line->size(); )
+      {
+        auto end = std::min( line->find( ' ', start ), line->size() );
+
+        if( end > start )
+          arguments.emplace_back( line->substr( start, end - start ) );
+
+        start = end + 1;
+      }
+
+      data.remove_prefix( pos );
+
+      return parse_result_t::complete;
+    }
+
+    auto count = to_integer( line->substr( 1 ) );
+
+    if( count == std::nullopt || *count > static_cast<int64_t>( max_arguments ) )
+      return parse_result_t::error;
+
+    for( int64_t i = 0; i < *count; ++i )
+    {
+      auto header = take_line( data, pos );
+
+      if( header == std::nullopt )
+        return parse_result_t::incomplete;
+      else if( header->starts_with( '$' ) == false )
+        return parse_result_t::error;
+
+      auto size = to_integer( header->substr( 1 ) );
+
+      if( size == std::nullopt || *size < 0 || *size > static_cast<int64_t>( max_bulk_size ) )
+        return parse_result_t::error;
+
+      if( data.size() < pos + *size + 2 )
+        return parse_result_t::incomplete;
+      else if( data.substr( pos + *size, 2 ) != "\r\n" )
+        return parse_result_t::error;
+
+      arguments.emplace_back( data.substr( pos, *size ) );
+      pos += *size + 2;
+    }
+
+    data.remove_prefix( pos );
+
+    return parse_result_t::complete;
+  }
+
+  std::string bulk( std::string_view value )
+  {
+    return '$' + std::to_string( value.size() ) + "\r\n" + std::string{ value } + "\r\n";
+  }
+
+  std::string wrong_arity( std::string_view name )
+  {
+    std::string lower{ name };
+
+    std::ranges::transform( lower, lower.begin(), []( unsigned char c ){ return std::tolower( c ); } );
+
+    return "-ERR wrong number of arguments for '" + lower + "' command\r\n";
+  }
+
+  bool valid_key( std::string_view key )
+  {
+    return key.empty() == false && key.size() < 256;
+  }
+
+  seastar::future<std::string> scan
+  (
+    seastar::sharded< pkvs_shard >& store,
+    std::vector<std::string> const& command
+  )
+  {
+    if( command.size() < 2 || command.size() % 2 != 0 )
+      co_return wrong_arity( command[ 0 ] );
+
+    std::string start;
+
+    // cursor 0 starts and ends the iteration
+    if( command[ 1 ] != "0" )
+    {
+      auto decoded = from_hex( command[ 1 ] );
+
+      if( decoded == std::nullopt )
+        co_return "-ERR invalid cursor\r\n";
+
+      start = std::move( *decoded );
+    }
+
+    size_t count = scan_default_count;
+
+    for( size_t i = 2; i < command.size(); i += 2 )
+    {
+      std::string option{ command[ i ] };
+
+      std::ranges::transform( option, option.begin(), []( unsigned char c ){ return std::toupper( c ); } );
+
+      if( option == "COUNT" )
+      {
+        auto value = to_integer( command[ i + 1 ] );
+
+        if( value == std::nullopt || *value <= 0 )
+          co_return "-ERR value is not an integer or out of range\r\n";
+
+        count = std::min( static_cast<size_t>( *value ), scan_max_count );
+      }
+      else if( option == "MATCH" && command[ i + 1 ] == "*" )
+        continue;
+      else
+        co_return "-ERR syntax error\r\n";
+    }
+
+    auto page = co_await range_on_all_shards( store, std::move( start ), {}, count );
+    std::string reply = "*2\r\n";
+
+    reply += bulk( page.next != std::nullopt ? to_hex( *page.next ) : "0" );
+    reply += '*' + std::to_string( page.keys.size() ) + "\r\n";
+
+    for( auto const& key : page.keys )
+      reply += bulk( key );
+
+    co_return reply;
+  }
+
+  // executes commands in order and returns their concatenated replies,
+  // consecutive key value commands are grouped into a single batch
+  seastar::future<std::string> execute
+  (
+    seastar::sharded< pkvs_shard >& store,
+    std::vector< std::vector<std::string> > commands
+  )
+  {
+    struct planned_t
+    {
+      // batched command or std::nullopt if reply is already known
+      std::optional<std::string> name;
+      size_t command = 0;
+      std::string reply;
+    };
+
+    std::string replies;
+    std::vector<batch_operation_t> operations;
+    std::vector<planned_t> planned;
+
+    auto run_batch =
+      [ & ] -> seastar::future<>
+      {
+        std::vector< std::optional<std::string> > results;
+        std::optional<std::string> failed; // error reply of every batched command
+
+        if( operations.empty() == false )
+        {
+          try
+          {
+            results = co_await batch_on_all_shards( store, std::move( operations ) );
+          }
+          catch( overloaded_error const& )
+          {
+            failed = "-BUSY store is overloaded, retry later\r\n";
+          }
+          catch( ... )
+          {
+            std::cerr << "resp batch failed: " << std::current_exception() << '\n';
+
+            failed = "-ERR internal error\r\n";
+          }
+        }
+
+        size_t next = 0;
+
+        for( auto const& current : planned )
+        {
+          auto const& command = commands[ current.command ];
+
+          if( current.name == std::nullopt )
+            replies += current.reply;
+          else if( failed )
+            replies += *failed;
+          else if( *current.name == "GET" )
+          {
+            auto const& value = results[ next++ ];
+
+            replies += value != std::nullopt ? bulk( *value ) : "$-1\r\n";
+          }
+          else if( *current.name == "SET" )
+          {
+            ++next;
+            replies += "+OK\r\n";
+          }
+          else if( *current.name == "DEL" )
+          {
+            // every key has a get followed by a delete
+            size_t removed = 0;
+
+            for( size_t i = 1; i < command.size(); ++i, next += 2 )
+              removed += results[ next ] != std::nullopt;
+
+            replies += ':' + std::to_string( removed ) + "\r\n";
+          }
+          else if( *current.name == "MGET" )
+          {
+            replies += '*' + std::to_string( command.size() - 1 ) + "\r\n";
+
+            for( size_t i = 1; i < command.size(); ++i )
+            {
+              auto const& value = results[ next++ ];
+
+              replies += value != std::nullopt ? bulk( *value ) : "$-1\r\n";
+            }
+          }
+        }
+
+        operations.clear();
+        planned.clear();
+      };
+
+    for( size_t i = 0; i < commands.size(); ++i )
+    {
+      auto const& command = commands[ i ];
+      std::string name{ command[ 0 ] };
+
+      std::ranges::transform( name, name.begin(), []( unsigned char c ){ return std::toupper( c ); } );
+
+      auto reply =
+        [ &planned, i ]( std::string text )
+        {
+          planned.push_back( planned_t{ std::nullopt, i, std::move( text ) } );
+        };
+
+      bool keys_valid = std::ranges::all_of( command | std::views::drop( 1 ), valid_key );
+
+      if( name == "PING" )
+      {
+        if( command.size() == 1 )
+          reply( "+PONG\r\n" );
+        else if( command.size() == 2 )
+          reply( bulk( command[ 1 ] ) );
+        else
+          reply( wrong_arity( name ) );
+      }
+      else if( name == "GET" || name == "SET" || name == "DEL" || name == "MGET" )
+      {
+        bool arity_valid =
+          ( name == "GET" && command.size() == 2 ) ||
+          ( name == "SET" && command.size() == 3 ) ||
+          ( ( name == "DEL" || name == "MGET" ) && command.size() >= 2 );
+
+        if( arity_valid == false )
+          reply( wrong_arity( name ) );
+        else if( name == "SET" && valid_key( command[ 1 ] ) == false )
+          reply( "-ERR invalid key size\r\n" );
+        else if( name != "SET" && keys_valid == false )
+          reply( "-ERR invalid key size\r\n" );
+        else
+        {
+          if( name == "GET" )
+            operations.emplace_back( batch_operation_type_t::get, command[ 1 ], std::string{} );
+          else if( name == "SET" )
+            operations.emplace_back( batch_operation_type_t::insert, command[ 1 ], command[ 2 ] );
+          else
+          {
+            for( auto const& key : command | std::views::drop( 1 ) )
+            {
+              operations.emplace_back( batch_operation_type_t::get, key, std::string{} );
+
+              if( name == "DEL" )
+                operations.emplace_back( batch_operation_type_t::remove, key, std::string{} );
+            }
+          }
+
+          planned.push_back( planned_t{ name, i, {} } );
+        }
+      }
+      else if( name == "SCAN" )
+      {
+        // replies of earlier commands have to be written first
+        co_await run_batch();
+
+        replies += co_await scan( store, command );
+      }
+      else if( name == "COMMAND" )
+        reply( "*0\r\n" ); // clients query it on connect
+      else
+        reply( "-ERR unknown command\r\n" );
+    }
+
+    co_await run_batch();
+
+    co_return replies;
+  }
+}
+
+resp_server_t::resp_server_t( seastar::sharded< pkvs_shard >& store )
+  : store_{ &store }
+{}
+
+seastar::future<> resp_server_t::listen( uint16_t port )
+{
+  seastar::listen_options options;
+  options.reuse_address = true;
+
+  listener_ = seastar::listen( seastar::socket_address( seastar::ipv4_addr( port ) ), options );
+
+  (void)seastar::with_gate( gate_, [ this ]{ return accept_loop(); } );
+
+  return seastar::make_ready_future<>();
+}
+
+seastar::future<> resp_server_t::accept_loop()
+{
+  while( true )
+  {
+    std::optional<seastar::accept_result> accepted;
+
+    try
+    {
+      accepted = co_await listener_->accept();
+    }
+    catch( ... )
+    {
+      // aborted by stop
+      co_return;
+    }
+
+    (void)seastar::with_gate(
+      gate_,
+      [ this, socket = std::move( accepted->connection ) ]() mutable
+      {
+        return handle_connection( std::move( socket ) );
+      });
+  }
+}
+
+seastar::future<> resp_server_t::handle_connection( seastar::connected_socket socket )
+{
+  auto in = socket.input();
+  auto out = socket.output();
+  std::string pending;
+  std::exception_ptr failure;
+
+  connections_.insert( &socket );
+
+  try
+  {
+    while( true )
+    {
+      auto buffer = co_await in.read();
+
+      if( buffer.empty() )
+        break;
+
+      pending.append( buffer.get(), buffer.size() );
+
+      std::string_view data = pending;
+      std::vector< std::vector<std::string> > commands;
+      auto result = parse_result_t::complete;
+
+      // everything that arrived together is executed as a single pipeline
+      while( data.empty() == false )
+      {
+        std::vector<std::string> arguments;
+
+        result = parse_command( data, arguments );
+
+        if( result != parse_result_t::complete )
+          break;
+        else if( arguments.empty() == false )
+          commands.push_back( std::move( arguments ) );
+      }
+
+      pending.erase( 0, pending.size() - data.size() );
+
+      auto replies = co_await execute( *store_, std::move( commands ) );
+
+      if( result == parse_result_t::error || pending.size() > max_pending_size )
+        replies += "-ERR Protocol error\r\n";
+
+      co_await out.write( replies );
+      co_await out.flush();
+
+      if( result == parse_result_t::error || pending.size() > max_pending_size )
+        break;
+    }
+  }
+  catch( ... )
+  {
+    failure = std::current_exception();
+  }
+
+  connections_.erase( &socket );
+
+  try
+  {
+    co_await out.close();
+  }
+  catch( ... )
+  {
+    // connection was already broken
+  }
+
+  co_await in.close();
+
+  if( failure )
+    std::cerr << "resp connection failed: " << failure << '\n';
+}
+
+seastar::future<> resp_server_t::stop()
+{
+  if( listener_ )
+    listener_->abort_accept();
+
+  for( auto* socket : connections_ )
+    socket->shutdown_input();
+
+  co_await gate_.close();
+}
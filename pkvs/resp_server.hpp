@@ -0,0 +1,51 @@
+//  Copyright 2024 Domen Vrankar
+//
+//  Distributed under the Boost Software License, Version 1.0.
+//  See http://www.boost.org/LICENSE_1_0.txt
+
+#ifndef RESP_SERVER_HPP_INCLUDED
+#define RESP_SERVER_HPP_INCLUDED
+
+#include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/sharded.hh>
+#include <seastar/net/api.hh>
+
+#include <cstdint>
+#include <optional>
+#include <unordered_set>
+
+#include "pkvs_shard.hpp"
+
+namespace pkvs
+{
+  // redis protocol (RESP2) front end supporting a subset of commands:
+  // PING, GET, SET, DEL, MGET and SCAN
+  //
+  // pipelined commands that arrive together are executed as a single batch
+  // with one hop per owning shard, replies are written in request order and
+  // flushed once per batch
+  //
+  // meant to be run as seastar::sharded so that every shard accepts
+  // connections on the same port
+  class resp_server_t
+  {
+  public:
+    explicit resp_server_t( seastar::sharded< pkvs_shard >& store );
+
+    seastar::future<> listen( uint16_t port );
+    seastar::future<> stop();
+
+  private:
+    seastar::future<> accept_loop();
+    seastar::future<> handle_connection( seastar::connected_socket socket );
+
+    seastar::sharded< pkvs_shard >* store_;
+    std::optional< seastar::server_socket > listener_;
+    // open connections that are shut down on stop
+    std::unordered_set< seastar::connected_socket* > connections_;
+    seastar::gate gate_;
+  };
+}
+
+#endif // RESP_SERVER_HPP_INCLUDED
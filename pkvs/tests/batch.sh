@@ -0,0 +1,55 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/batch -d "{\"operations\":[{\"op\":\"post\",\"key\":\"abc\",\"value\":\"efg\"},{\"op\":\"post\",\"key\":\"bcd\",\"value\":\"fgh\"},{\"op\":\"get\",\"key\":\"abc\"},{\"op\":\"post\",\"key\":\"cde\",\"value\":\"ghi\"}]}"`
+
+if ! [[ "$output" =~ "{\"results\":[{\"result\":\"ok\"},{\"result\":\"ok\"},{\"value\":\"efg\"},{\"result\":\"ok\"}]}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/batch -d "{\"operations\":[{\"op\":\"get\",\"key\":\"cde\"},{\"op\":\"delete\",\"key\":\"bcd\"},{\"op\":\"get\",\"key\":\"bcd\"},{\"op\":\"get\",\"key\":\"abc\"}]}"`
+
+if ! [[ "$output" =~ "{\"results\":[{\"value\":\"ghi\"},{\"result\":\"ok\"},{\"result\":\"missing\"},{\"value\":\"efg\"}]}" ]]
+then
+  exit 1
+fi
+
+# batch writes are visible to single key requests
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"cde\"}"`
+
+if ! [[ "$output" =~ "{\"value\":\"ghi\"}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/batch -d "{\"operations\":[{\"op\":\"get\",\"key\":\"abc\",\"value\":\"efg\"}]}"`
+
+if ! [[ "$output" =~ "{\"result\":\"request error\"}" ]]
+then
+  exit 1
+fi
+
+# keys are shorter than 256 bytes
+long_key=`head -c 256 /dev/zero | tr '\0' 'k'`
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/batch -d "{\"operations\":[{\"op\":\"post\",\"key\":\"$long_key\",\"value\":\"efg\"}]}"`
+
+if ! [[ "$output" =~ "{\"result\":\"invalid key size\"}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"$long_key\",\"value\":\"efg\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"invalid key size\"}" ]]
+then
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+# values longer than 8 bytes go to separate value files
+./pkvs -c1 --port 8080 --segments 1 -t 1 --inline_value_threshold 8 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request POST post "{\"key\":\"small\",\"value\":\"short\"}" "{\"result\":\"ok\"}"
+request POST post "{\"key\":\"large\",\"value\":\"a value that is stored in its own file\"}" "{\"result\":\"ok\"}"
+request POST post "{\"key\":\"other\",\"value\":\"another value that is stored in its own file\"}" "{\"result\":\"ok\"}"
+
+sleep 2 # wait for memtables to be flushed to sstables
+
+kill -9 $pid
+
+# flip the first byte of one value and the last byte of the trailer magic of
+# the other one as the trailer can't tell a damaged magic from a missing one
+value_file=pkvs_data/0/sstables/values/`ls pkvs_data/0/sstables/values | head -n 1`
+printf 'A' | dd of=$value_file bs=1 seek=0 count=1 conv=notrunc
+tail_file=pkvs_data/0/sstables/values/`ls pkvs_data/0/sstables/values | tail -n 1`
+printf 'A' | dd of=$tail_file bs=1 seek=$(( `stat -c %s $tail_file` - 1 )) count=1 conv=notrunc
+
+./pkvs -c1 --port 8080 --scrub_period_s 1 > checksums_scrub.log 2>&1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request GET get "{\"key\":\"small\"}" "{\"value\":\"short\"}"
+request GET get "{\"key\":\"large\"}" "500"
+request GET get "{\"key\":\"other\"}" "500"
+
+sleep 2 # wait for a scrub pass
+
+if ! grep -q "file corruption detected in .*$value_file" checksums_scrub.log ||
+   ! grep -q "file corruption detected in .*$tail_file" checksums_scrub.log
+then
+  cat checksums_scrub.log
+  exit 1
+fi
+
+kill -9 $pid
+
+# damage the first record of every sstable (the 16 byte header is skipped)
+for sstable in `ls pkvs_data/0/sstables | grep -E "^[0-9]+$"`
+do
+  printf '\xff' | dd of=pkvs_data/0/sstables/$sstable bs=1 seek=20 count=1 conv=notrunc
+done
+
+./pkvs -c1 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request GET get "{\"key\":\"small\"}" "500"
+
+# corruption fails the request instead of the process
+if ! kill -0 $pid
+then
+  exit 1
+fi
+
+request GET get "{\"key\":\"small\"}" "500"
+
+rm -f checksums_scrub.log
+
+exit 0
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request POST post "{\"key\":\"abcd\",\"value\":\"efg\"}" "{\"result\":\"ok\"}"
+request POST post "{\"key\":\"removed\",\"value\":\"efg\"}" "{\"result\":\"ok\"}"
+request POST delete "{\"key\":\"removed\"}" "{\"result\":\"ok\"}"
+
+# acknowledged writes have to survive a crash before the memtable is flushed
+kill -9 $pid
+
+# shard count change moves segments to other shards
+./pkvs -c4 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request GET get "{\"key\":\"abcd\"}" "{\"value\":\"efg\"}"
+request GET get "{\"key\":\"removed\"}" "{\"result\":\"missing\"}"
+
+# replayed writes were flushed so they must not depend on the old log
+kill -9 $pid
+
+./pkvs -c1 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request GET get "{\"key\":\"abcd\"}" "{\"value\":\"efg\"}"
+
+exit 0
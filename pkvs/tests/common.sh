@@ -0,0 +1,14 @@
+# helpers shared by the test scripts, sourced after the shebang line
+
+# request <method> <path> <json body> <expected part of the reply>
+function request()
+{
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X $1 localhost:8080/$2 -d "$3"`
+
+  if ! [[ "$output" =~ "$4" ]]
+  then
+    echo "error: "
+    echo ${output}
+    exit 1
+  fi
+}
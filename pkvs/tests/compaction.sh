@@ -0,0 +1,53 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c1 --port 8080 -t 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+# every housekeeping pass flushes a new sstable so the segment collects enough
+# of them for a compaction
+for i in 1 2 3 4 5 6
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"abc\",\"value\":\"efg$i\"}"`
+
+  if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+  then
+    exit 1
+  fi
+
+  sleep 1.5
+done
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"abc\"}"`
+
+if ! [[ "$output" =~ "{\"value\":\"efg6\"}" ]]
+then
+  exit 1
+fi
+
+if [ `ls pkvs_data/*/sstables | grep -c -E '^[0-9]+$'` -ge 6 ]
+then
+  echo "sstables were not compacted"
+  exit 1
+fi
+
+kill -9 $pid
+
+./pkvs -c1 --port 8080 -t 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"abc\"}"`
+
+if ! [[ "$output" =~ "{\"value\":\"efg6\"}" ]]
+then
+  echo "error: "
+  echo ${output}
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,49 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+./pkvs -c1 --port 8080 --segments 1 -t 1 --compression lz4 --compaction_compression lz4 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+# inline values that compress well
+value=`printf 'name=pkvs;%.0s' $(seq 1 80)`
+
+for i in `seq 1 20`
+do
+  request POST post "{\"key\":\"key$i\",\"value\":\"$value$i\"}" "{\"result\":\"ok\"}"
+done
+
+sleep 2 # wait for memtables to be flushed to sstables
+
+# 20 values of 800 bytes
+size=0
+
+for sstable in `ls pkvs_data/0/sstables | grep -E "^[0-9]+$"`
+do
+  size=$(( size + `stat -c %s pkvs_data/0/sstables/$sstable` ))
+done
+
+if [ $size -eq 0 ] || [ $size -ge 8000 ]
+then
+  echo "sstables take $size bytes"
+  exit 1
+fi
+
+kill -9 $pid
+
+# codec is stored per block so sstables stay readable with another one
+./pkvs -c1 --port 8080 --compression none &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 20`
+do
+  request GET get "{\"key\":\"key$i\"}" "{\"value\":\"$value$i\"}"
+done
+
+exit 0
@@ -0,0 +1,81 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data pkvs_data_2 pkvs_commitlog
+
+./pkvs -c2 --port 8080 --segments 16 --data_dir pkvs_data --data_dir pkvs_data_2 --commitlog_dir pkvs_commitlog &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 20`
+do
+  request POST post "{\"key\":\"key$i\",\"value\":\"value$i\"}" "{\"result\":\"ok\"}"
+done
+
+# even segments are in the first and odd ones in the second directory
+if ! [[ -d pkvs_data/0 && -d pkvs_data_2/1 && ! -e pkvs_data/1 && ! -e pkvs_data_2/0 ]]
+then
+  ls pkvs_data pkvs_data_2
+  exit 1
+fi
+
+if [[ -e pkvs_data/commitlog || -z `ls pkvs_commitlog` ]]
+then
+  exit 1
+fi
+
+# writes are only in the commit logs
+kill -9 $pid
+
+./pkvs -c2 --port 8080 --data_dir pkvs_data --data_dir pkvs_data_2 --commitlog_dir pkvs_commitlog &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 20`
+do
+  request GET get "{\"key\":\"key$i\"}" "{\"value\":\"value$i\"}"
+done
+
+kill -9 $pid
+
+# other directories would not contain the segments or the unflushed writes
+for arguments in \
+  "--data_dir pkvs_data --commitlog_dir pkvs_commitlog" \
+  "--data_dir pkvs_data --data_dir pkvs_data_2" \
+  "--data_dir pkvs_data_2 --data_dir pkvs_data --commitlog_dir pkvs_commitlog" \
+  "--data_dir pkvs_data --data_dir pkvs_commitlog --commitlog_dir pkvs_data_2"
+do
+  timeout 5 ./pkvs -c1 --port 8080 $arguments
+  status=$?
+
+  if [[ $status == 0 || $status == 124 ]]
+  then
+    echo "store opened with $arguments"
+    exit 1
+  fi
+done
+
+# directories are recognized by their markers so the store can be moved
+rm -rf pkvs_moved pkvs_moved_2 pkvs_moved_commitlog
+mv pkvs_data pkvs_moved
+mv pkvs_data_2 pkvs_moved_2
+mv pkvs_commitlog pkvs_moved_commitlog
+
+./pkvs -c2 --port 8080 --data_dir pkvs_moved --data_dir pkvs_moved_2 --commitlog_dir pkvs_moved_commitlog &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 20`
+do
+  request GET get "{\"key\":\"key$i\"}" "{\"value\":\"value$i\"}"
+done
+
+kill -9 $pid
+
+rm -rf pkvs_moved pkvs_moved_2 pkvs_moved_commitlog
+
+exit 0
@@ -0,0 +1,47 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c1 --port 8080 -t 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"abc\",\"value\":\"efg\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+then
+  exit 1
+fi
+
+sleep 2 # value gets flushed to an sstable and evicted from the memtable
+
+# served from the sstable (and then from the block cache)
+for i in 1 2
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"abc\"}"`
+
+  if ! [[ "$output" =~ "{\"value\":\"efg\"}" ]]
+  then
+    exit 1
+  fi
+done
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/delete -d "{\"key\":\"abc\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+then
+  exit 1
+fi
+
+# tombstone is still only in the memtable
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"abc\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"missing\"}" ]]
+then
+  echo "error: "
+  echo ${output}
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+# memtables are far below their own threshold and deadline so only the shard
+# dirty memory limit can get them flushed
+./pkvs -c1 --port 8080 --segments 1 --dirty_memory_limit 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 10`
+do
+  request POST post "{\"key\":\"key$i\",\"value\":\"value$i\"}" "{\"result\":\"ok\"}"
+done
+
+sleep 1 # give the scheduler a few passes
+
+if ! grep -q "^sstable [0-9]*$" pkvs_data/0/sstables/MANIFEST
+then
+  cat pkvs_data/0/sstables/MANIFEST
+  exit 1
+fi
+
+for i in `seq 1 10`
+do
+  request GET get "{\"key\":\"key$i\"}" "{\"value\":\"value$i\"}"
+done
+
+exit 0
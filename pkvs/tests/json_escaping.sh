@@ -0,0 +1,55 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c1 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+# escaped quotes, backslashes and unicode escapes are decoded
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d '{"key":"abc","value":"say \"hi\" \u005c é\ttab"}'`
+
+if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+then
+  exit 1
+fi
+
+# and escaped again in the reply so that it stays valid json
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d '{"key":"abc"}'`
+
+if ! [[ "$output" =~ '{"value":"say \"hi\" \\ é\ttab"}' ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d '{"key":"\u0061bc"}'`
+
+if ! [[ "$output" =~ '{"value":"say \"hi\" \\ é\ttab"}' ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/batch -d '{"operations":[{"op":"get","key":"abc"}]}'`
+
+if ! [[ "$output" =~ '{"results":[{"value":"say \"hi\" \\ é\ttab"}]}' ]]
+then
+  exit 1
+fi
+
+for request in \
+  '{"key":"abc","key":"abc"}' \
+  '{"key":"abc","other":"x"}' \
+  '{"key":"abc"' \
+  '{"key":"\ud800"}' \
+  '{"key":1}'
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "$request"`
+
+  if ! [[ "$output" =~ "{\"result\":\"request error\"}" ]]
+  then
+    exit 1
+  fi
+done
+
+exit 0
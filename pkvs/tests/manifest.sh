@@ -0,0 +1,58 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+./pkvs -c1 --port 8080 --segments 1 -t 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 10`
+do
+  request POST post "{\"key\":\"key$i\",\"value\":\"value$i\"}" "{\"result\":\"ok\"}"
+done
+
+sleep 2 # wait for memtables to be flushed to sstables
+
+# flushed sstables are listed in the manifest
+if ! grep -q "^sstable [0-9]*$" pkvs_data/0/sstables/MANIFEST
+then
+  cat pkvs_data/0/sstables/MANIFEST
+  exit 1
+fi
+
+kill -9 $pid
+
+# leftovers of a value upload and of an sstable write of an earlier run
+touch pkvs_data/0/sstables/value_1_0_0.tmp
+touch pkvs_data/0/sstables/0.index.tmp
+
+./pkvs -c1 --port 8080 > manifest_startup.log &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 10`
+do
+  request GET get "{\"key\":\"key$i\"}" "{\"value\":\"value$i\"}"
+done
+
+if ! grep -q "startup took" manifest_startup.log || ! grep -q "shard 0 startup: " manifest_startup.log
+then
+  cat manifest_startup.log
+  exit 1
+fi
+
+sleep 2 # leftovers are removed by housekeeping
+
+if [[ -e pkvs_data/0/sstables/value_1_0_0.tmp || -e pkvs_data/0/sstables/0.index.tmp ]]
+then
+  ls pkvs_data/0/sstables
+  exit 1
+fi
+
+rm -f manifest_startup.log
+
+exit 0
@@ -0,0 +1,53 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+# values longer than 8 bytes go to separate value files
+./pkvs -c1 --port 8080 -t 1 --inline_value_threshold 8 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+function post()
+{
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"$1\",\"value\":\"$2\"}"`
+
+  if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+  then
+    exit 1
+  fi
+}
+
+post small short
+post large "a value that is stored in its own file"
+post replaced "a value that is stored in its own file"
+
+sleep 2 # sleep so that the file gets persisted - TODO look for file on filesystem instead
+
+post replaced tiny
+
+sleep 2
+kill -9 $pid
+
+./pkvs -c1 --port 8080 -t 1 --inline_value_threshold 8 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+function expect()
+{
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"$1\"}"`
+
+  if ! [[ "$output" =~ "{\"value\":\"$2\"}" ]]
+  then
+    echo "error: "
+    echo ${output}
+    exit 1
+  fi
+}
+
+expect small short
+expect large "a value that is stored in its own file"
+expect replaced tiny
+
+exit 0
@@ -0,0 +1,48 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c1 --port 8080 -t 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+# keys end up spread over many segments and sstables
+for i in $(seq 100 199)
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"key$i\",\"value\":\"value$i\"}"`
+
+  if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+  then
+    exit 1
+  fi
+done
+
+sleep 2 # sleep so that the file gets persisted - TODO look for file on filesystem instead
+kill -9 $pid
+
+./pkvs -c1 --port 8080 -t 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in 100 115 116 150 199
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"key$i\"}"`
+
+  if ! [[ "$output" =~ "{\"value\":\"value$i\"}" ]]
+  then
+    echo "error: "
+    echo ${output}
+    exit 1
+  fi
+done
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"key200\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"missing\"}" ]]
+then
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,80 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c2 --port 8080 -t 1 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for key in a1 a2 a3 a4 a5
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"$key\",\"value\":\"efg\"}"`
+
+  if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+  then
+    exit 1
+  fi
+done
+
+sleep 2 # wait for memtables to be flushed to sstables
+
+# tombstone in memtable shadows the key in sstables
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/delete -d "{\"key\":\"a3\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"a6\",\"value\":\"efg\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+then
+  exit 1
+fi
+
+# cursor is the hex encoded key after the last returned one ("a2\0")
+output=`curl -i -H "Accept: application/json" -X GET "localhost:8080/range?limit=2"`
+
+if ! [[ "$output" =~ "{\"keys\":[\"a1\",\"a2\"],\"cursor\":\"613200\"}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -X GET "localhost:8080/range?limit=2&cursor=613200"`
+
+if ! [[ "$output" =~ "{\"keys\":[\"a4\",\"a5\"],\"cursor\":\"613500\"}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -X GET "localhost:8080/range?limit=2&cursor=613500"`
+
+if ! [[ "$output" =~ "{\"keys\":[\"a6\"]}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -X GET "localhost:8080/range?start=a2&end=a5"`
+
+if ! [[ "$output" =~ "{\"keys\":[\"a2\",\"a4\"]}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -X GET "localhost:8080/range?limit=0"`
+
+if ! [[ "$output" =~ "{\"result\":\"invalid limit\"}" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -X GET localhost:8080/sorted_keys`
+
+if ! [[ "$output" =~ "{\"keys\":[\"a1\",\"a2\",\"a4\",\"a5\",\"a6\"]}" ]]
+then
+  exit 1
+fi
+
+exit 0
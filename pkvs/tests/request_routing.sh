@@ -0,0 +1,42 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+# keys are spread over both shards so some requests are served locally and
+# some are forwarded to the owning shard
+for i in `seq 1 20`
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"key$i\",\"value\":\"value$i\"}"`
+
+  if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+  then
+    exit 1
+  fi
+done
+
+for i in `seq 1 20`
+do
+  output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"key$i\"}"`
+
+  if ! [[ "$output" =~ "{\"value\":\"value$i\"}" ]]
+  then
+    exit 1
+  fi
+done
+
+output=`curl -s localhost:8080/metrics`
+
+local_requests=`echo "$output" | grep -E "^pkvs_requests_local(_total)?\{" | awk '{ sum += $2 } END { print sum }'`
+hops=`echo "$output" | grep -E "^pkvs_requests_cross_shard_hops(_total)?\{" | awk '{ sum += $2 } END { print sum }'`
+
+if [[ "$local_requests" == "" || "$hops" == "" || $(( local_requests + hops )) -lt 40 ]]
+then
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,59 @@
+#!/bin/bash
+
+rm -rf pkvs_data
+
+./pkvs -c2 --port 8080 --resp_port 6380 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+exec 3<>/dev/tcp/localhost/6380
+
+expect()
+{
+  IFS= read -r -t 2 line <&3
+
+  if [[ "$line" != "$1"$'\r' ]]
+  then
+    exit 1
+  fi
+}
+
+# pipelined commands are sent at once
+printf '*3\r\n$3\r\nSET\r\n$3\r\nabc\r\n$3\r\nefg\r\n*3\r\n$3\r\nSET\r\n$3\r\nbcd\r\n$3\r\nfgh\r\n*2\r\n$3\r\nGET\r\n$3\r\nabc\r\n*4\r\n$4\r\nMGET\r\n$3\r\nabc\r\n$1\r\nx\r\n$3\r\nbcd\r\n' >&3
+
+expect "+OK"
+expect "+OK"
+expect "\$3"
+expect "efg"
+expect "*3"
+expect "\$3"
+expect "efg"
+expect "\$-1"
+expect "\$3"
+expect "fgh"
+
+printf '*3\r\n$3\r\nDEL\r\n$3\r\nabc\r\n$1\r\nx\r\n*2\r\n$3\r\nGET\r\n$3\r\nabc\r\nPING\r\n' >&3
+
+expect ":1"
+expect "\$-1"
+expect "+PONG"
+
+printf '*4\r\n$4\r\nSCAN\r\n$1\r\n0\r\n$5\r\nCOUNT\r\n$2\r\n10\r\n' >&3
+
+expect "*2"
+expect "\$1"
+expect "0"
+expect "*1"
+expect "\$3"
+expect "bcd"
+
+# writes are visible through http as well
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"bcd\"}"`
+
+if ! [[ "$output" =~ "{\"value\":\"fgh\"}" ]]
+then
+  exit 1
+fi
+
+exit 0
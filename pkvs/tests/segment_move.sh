@@ -0,0 +1,89 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+./pkvs -c2 --port 8080 --segments 16 --rebalance_threshold 0 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+for i in `seq 1 30`
+do
+  request POST post "{\"key\":\"key$i\",\"value\":\"old$i\"}" "{\"result\":\"ok\"}"
+done
+
+request POST delete "{\"key\":\"key1\"}" "{\"result\":\"ok\"}"
+
+# every segment moves to the other shard
+for segment in `seq 0 15`
+do
+  request POST "move_segment?segment=$segment&shard=$(( ( segment + 1 ) % 2 ))" "" "{\"result\":\"ok\"}"
+done
+
+request POST "move_segment?segment=16&shard=0" "" "{\"result\":\"invalid segment or shard\"}"
+request POST "move_segment?segment=0&shard=2" "" "{\"result\":\"invalid segment or shard\"}"
+
+request GET get "{\"key\":\"key1\"}" "{\"result\":\"missing\"}"
+
+for i in `seq 2 30`
+do
+  request GET get "{\"key\":\"key$i\"}" "{\"value\":\"old$i\"}"
+done
+
+output=`curl -s localhost:8080/metrics`
+moves=`echo "$output" | grep -E "^pkvs_segments_moves(_total)?\{" | awk '{ sum += $2 } END { print sum }'`
+
+if [[ "$moves" != "16" ]]
+then
+  echo "unexpected amount of moves: $moves"
+  exit 1
+fi
+
+# writes after the move are logged by the new owner and must not be
+# overridden by the log of the previous one
+for i in `seq 1 30`
+do
+  request POST post "{\"key\":\"key$i\",\"value\":\"new$i\"}" "{\"result\":\"ok\"}"
+done
+
+request POST delete "{\"key\":\"key2\"}" "{\"result\":\"ok\"}"
+
+kill -9 $pid
+
+# segment count is taken from the store
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request GET get "{\"key\":\"key1\"}" "{\"value\":\"new1\"}"
+request GET get "{\"key\":\"key2\"}" "{\"result\":\"missing\"}"
+
+for i in `seq 3 30`
+do
+  request GET get "{\"key\":\"key$i\"}" "{\"value\":\"new$i\"}"
+done
+
+output=`curl -s localhost:8080/range?limit=1000`
+
+if [[ `echo "$output" | grep -o "\"key[0-9]*\"" | wc -l` != 29 ]]
+then
+  echo "unexpected range: $output"
+  exit 1
+fi
+
+kill -9 $pid
+
+# a different segment count would move keys to other segments
+timeout 5 ./pkvs -c1 --port 8080 --segments 8
+status=$?
+
+if [[ $status == 0 || $status == 124 ]]
+then
+  echo "store opened with a different segment count"
+  exit 1
+fi
+
+exit 0
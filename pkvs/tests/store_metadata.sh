@@ -0,0 +1,68 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request POST post "{\"key\":\"abcd\",\"value\":\"efg\"}" "{\"result\":\"ok\"}"
+
+# new stores hash keys with a hash that doesn't depend on the standard library
+if ! grep -qx "key_hash xxh64" pkvs_data/metadata || ! grep -qx "value_checksums 1" pkvs_data/metadata
+then
+  cat pkvs_data/metadata
+  exit 1
+fi
+
+kill -9 $pid
+
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request GET get "{\"key\":\"abcd\"}" "{\"value\":\"efg\"}"
+
+kill -9 $pid
+
+# stores from before the metadata file keep using std::hash
+rm -rf pkvs_data
+mkdir -p pkvs_data/0
+
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+# and may have value files without checksums
+if
+  ! grep -qx "key_hash std_hash" pkvs_data/metadata ||
+  ! grep -qx "segments_count 256" pkvs_data/metadata ||
+  ! grep -qx "value_checksums 0" pkvs_data/metadata
+then
+  cat pkvs_data/metadata
+  exit 1
+fi
+
+request POST post "{\"key\":\"abcd\",\"value\":\"efg\"}" "{\"result\":\"ok\"}"
+request GET get "{\"key\":\"abcd\"}" "{\"value\":\"efg\"}"
+
+kill -9 $pid
+
+# data of an unknown hash can't be found so the store must not be opened
+echo "key_hash unknown" >> pkvs_data/metadata
+
+timeout 5 ./pkvs -c1 --port 8080
+status=$?
+
+if [[ $status == 0 || $status == 124 ]]
+then
+  echo "store opened with an unknown key hash"
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,52 @@
+#!/bin/bash
+
+rm -rf pkvs_data value_overwrite_0 value_overwrite_1 value_overwrite_out
+
+head -c 1000000 /dev/zero | tr '\0' 'a' > value_overwrite_0
+head -c 1000000 /dev/zero | tr '\0' 'b' > value_overwrite_1
+
+./pkvs -c1 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid; rm -f value_overwrite_0 value_overwrite_1 value_overwrite_out" EXIT
+
+for i in `seq 1 20`
+do
+  # reads of the old value race the replacement of its value file so the
+  # handle that they open must not be cached for later reads
+  readers=()
+
+  for j in `seq 1 4`
+  do
+    curl -s -X GET "localhost:8080/value?key=big" -o /dev/null &
+    readers+=($!)
+  done
+
+  output=`curl -i -H "Content-Type: application/octet-stream" -X POST "localhost:8080/value?key=big" --data-binary @value_overwrite_$((i % 2))`
+
+  if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+  then
+    exit 1
+  fi
+
+  wait ${readers[@]}
+
+  rm -f value_overwrite_out
+  curl -s -X GET "localhost:8080/value?key=big" -o value_overwrite_out
+
+  if ! cmp -s value_overwrite_$((i % 2)) value_overwrite_out
+  then
+    echo "stale value after overwrite $i"
+    exit 1
+  fi
+
+  output=`curl -s -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"big\"}"`
+
+  if ! [[ "$output" =~ ^\{\"value\":\"$( head -c 8 value_overwrite_$((i % 2)) ) ]]
+  then
+    echo "stale value after overwrite $i"
+    exit 1
+  fi
+done
+
+exit 0
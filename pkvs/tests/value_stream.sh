@@ -0,0 +1,69 @@
+#!/bin/bash
+
+rm -rf pkvs_data value_stream_in value_stream_out
+
+head -c 1000000 /dev/zero | tr '\0' 'a' > value_stream_in
+
+./pkvs -c2 --port 8080 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid; rm -f value_stream_in value_stream_out" EXIT
+
+output=`curl -i -H "Content-Type: application/octet-stream" -X POST "localhost:8080/value?key=big" --data-binary @value_stream_in`
+
+if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+then
+  exit 1
+fi
+
+curl -s -X GET "localhost:8080/value?key=big" -o value_stream_out
+
+if ! cmp -s value_stream_in value_stream_out
+then
+  exit 1
+fi
+
+# streamed values are restored from the commit log
+kill -9 $pid
+./pkvs -c1 --port 8080 &
+pid=$!
+sleep 1
+trap "kill -9 $pid; rm -f value_stream_in value_stream_out" EXIT
+
+rm -f value_stream_out
+curl -s -X GET "localhost:8080/value?key=big" -o value_stream_out
+
+if ! cmp -s value_stream_in value_stream_out
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X GET localhost:8080/get -d "{\"key\":\"big\"}"`
+
+if ! [[ "$output" =~ "{\"value\":\"aaaa" ]]
+then
+  exit 1
+fi
+
+output=`curl -i -H "Accept: application/json" -H "Content-Type: application/json" -X POST localhost:8080/post -d "{\"key\":\"big\",\"value\":\"small\"}"`
+
+if ! [[ "$output" =~ "{\"result\":\"ok\"}" ]]
+then
+  exit 1
+fi
+
+output=`curl -s -X GET "localhost:8080/value?key=big"`
+
+if [[ "$output" != "small" ]]
+then
+  exit 1
+fi
+
+output=`curl -s -X GET "localhost:8080/value?key=missing"`
+
+if ! [[ "$output" =~ "{\"result\":\"missing\"}" ]]
+then
+  exit 1
+fi
+
+exit 0
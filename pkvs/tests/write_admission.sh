@@ -0,0 +1,24 @@
+#!/bin/bash
+
+source "$(dirname "$0")/common.sh"
+
+rm -rf pkvs_data
+
+# flushes only start once a write is throttled and no write may wait for them
+./pkvs -c1 --port 8080 --segments 1 --dirty_memory_limit 1 --flush_period_ms 100000 --max_stalled_writes 0 &
+pid=$!
+sleep 1 # TODO wait for certain output instead of sleep
+trap "kill -9 $pid" EXIT
+
+request POST post "{\"key\":\"key1\",\"value\":\"value1\"}" "{\"result\":\"ok\"}"
+
+# the shard is over twice its dirty memory limit so the write is rejected
+request POST post "{\"key\":\"key2\",\"value\":\"value2\"}" "{\"result\":\"busy\"}"
+
+sleep 1 # rejected write started the flush
+
+request POST post "{\"key\":\"key2\",\"value\":\"value2\"}" "{\"result\":\"ok\"}"
+request GET get "{\"key\":\"key1\"}" "{\"value\":\"value1\"}"
+request GET get "{\"key\":\"key2\"}" "{\"value\":\"value2\"}"
+
+exit 0